@@ -0,0 +1,100 @@
+#include <stdint.h>
+#include <string.h>
+#include "include/openrtl.h"
+#include "internal.h"
+
+#define DEFAULT_ARENA_BLOCK 65536
+#define ARENA_ALIGN 16
+
+static void *openrtl_arena_alloc(void *user, size_t size);
+static void *openrtl_arena_realloc(void *user, void *ptr, size_t old, size_t size);
+static void openrtl_arena_free(void *user, void *ptr);
+
+static char *openrtl_arena_top(struct OpenrtlArenaBlock *block) {
+    uintptr_t top = (uintptr_t) (block->ptr + block->len);
+    return (char *) ((top + ARENA_ALIGN - 1) & ~(uintptr_t) (ARENA_ALIGN - 1));
+}
+
+// `ptr` may be NULL, otherwise it becomes the first block and is never
+// handed to `parent`
+void openrtl_arena(OpenrtlArena *arena, const OpenrtlAllocator *parent, void *ptr, size_t len) {
+    arena->allocator.alloc = openrtl_arena_alloc;
+    arena->allocator.realloc = openrtl_arena_realloc;
+    arena->allocator.free = openrtl_arena_free;
+    arena->allocator.user = arena;
+    arena->parent = parent;
+    arena->first = NULL;
+    arena->last = NULL;
+    if (ptr && len > sizeof(struct OpenrtlArenaBlock)) {
+        arena->first = ptr;
+        arena->first->next = NULL;
+        arena->first->cap = len - sizeof(struct OpenrtlArenaBlock);
+        arena->first->len = 0;
+    }
+    arena->block = arena->first;
+}
+
+void openrtl_del_arena(OpenrtlArena *arena) {
+    while (arena->block != arena->first) {
+        struct OpenrtlArenaBlock *next = arena->block->next;
+        openrtl_free(arena->parent, arena->block);
+        arena->block = next;
+    }
+}
+
+// releases everything allocated so far, objects that used the arena
+// must not be touched afterwards
+void openrtl_reset_arena(OpenrtlArena *arena) {
+    openrtl_del_arena(arena);
+    if (arena->first) {
+        arena->first->len = 0;
+    }
+    arena->last = NULL;
+}
+
+static void *openrtl_arena_alloc(void *user, size_t size) {
+    OpenrtlArena *arena = user;
+    struct OpenrtlArenaBlock *block = arena->block;
+    char *ptr = block ? openrtl_arena_top(block) : NULL;
+    if (!block || ptr + size > block->ptr + block->cap) {
+        size_t cap = block && block->cap > DEFAULT_ARENA_BLOCK / 2 ? 2 * block->cap : DEFAULT_ARENA_BLOCK;
+        while (cap < size + ARENA_ALIGN) {
+            cap *= 2;
+        }
+        block = openrtl_malloc(arena->parent, sizeof(struct OpenrtlArenaBlock) + cap);
+        if (!block) {
+            return NULL;
+        }
+        block->next = arena->block;
+        block->cap = cap;
+        block->len = 0;
+        arena->block = block;
+        ptr = openrtl_arena_top(block);
+    }
+    block->len = ptr + size - block->ptr;
+    arena->last = ptr;
+    return ptr;
+}
+
+// the most recent allocation grows and shrinks in place
+static void *openrtl_arena_realloc(void *user, void *ptr, size_t old, size_t size) {
+    OpenrtlArena *arena = user;
+    struct OpenrtlArenaBlock *block = arena->block;
+    if (ptr && ptr == arena->last && (char *) ptr + size <= block->ptr + block->cap) {
+        block->len = (char *) ptr + size - block->ptr;
+        return ptr;
+    }
+    void *next = openrtl_arena_alloc(arena, size);
+    if (next && ptr) {
+        memcpy(next, ptr, old < size ? old : size);
+    }
+    return next;
+}
+
+static void openrtl_arena_free(void *user, void *ptr) {
+    OpenrtlArena *arena = user;
+    if (ptr && ptr == arena->last) {
+        arena->block->len = (char *) ptr - arena->block->ptr;
+        arena->last = NULL;
+    }
+}
@@ -0,0 +1,109 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../include/openrtl.h"
+
+#define INSTS (1 << 22)
+#define ROUNDS 5
+
+static double openrtl_bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// a mix of arithmetic, memory, immediate moves of every width and
+// branches, roughly as a frontend emits them
+static void openrtl_bench_buffer(OpenrtlBuffer *buf) {
+    uint64_t state = 0x9e3779b97f4a7c15;
+    openrtl_buffer(buf);
+    buf->record = 0;
+    for (size_t i = 0; i < INSTS; i++) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        switch (state % 8) {
+        case 0:
+            openrtl_imove_immediate(buf, OPENRTL_SIZE_64, state >> 8 & 15, state >> 8 & (((uint64_t) 1 << (state >> 4 & 63)) - 1));
+            break;
+        case 1:
+            openrtl_branch_less(buf, state >> 16 & 0xffff);
+            break;
+        case 2:
+            openrtl_iload(buf, OPENRTL_SIZE_64, 1, 2, 3);
+            break;
+        case 3:
+            openrtl_istore(buf, OPENRTL_SIZE_32, 1, 2, 3);
+            break;
+        default:
+            openrtl_iadd(buf, OPENRTL_SIZE_64, 1, 2, 3);
+            break;
+        }
+    }
+}
+
+static void openrtl_bench_report(const char *name, double best, size_t n) {
+    printf("%-20s %10.3f ms %10.1f Minst/s\n", name, best * 1e3, n / best * 1e-6);
+}
+
+int main(void) {
+    OpenrtlBuffer buf;
+    openrtl_bench_buffer(&buf);
+
+    // keeps the loops from being optimized out
+    uint64_t sum = 0;
+    double best = 0;
+    for (int r = 0; r < ROUNDS; r++) {
+        double start = openrtl_bench_now();
+        OpenrtlIter it;
+        openrtl_iter(&it, &buf);
+        while (openrtl_iter_next(&it)) {
+            sum += it.inst.opcode + it.operand;
+        }
+        double elapsed = openrtl_bench_now() - start;
+        if (!r || elapsed < best) {
+            best = elapsed;
+        }
+    }
+    openrtl_bench_report("iterator", best, INSTS);
+
+    for (int r = 0; r < ROUNDS; r++) {
+        double start = openrtl_bench_now();
+        for (size_t offset = 0; offset < buf.len;) {
+            OpenrtlInst inst;
+            uint64_t operand;
+            offset = openrtl_decode(&buf, offset, &inst, &operand);
+            sum += inst.opcode + operand;
+        }
+        double elapsed = openrtl_bench_now() - start;
+        if (!r || elapsed < best) {
+            best = elapsed;
+        }
+    }
+    openrtl_bench_report("decode", best, INSTS);
+
+    double start = openrtl_bench_now();
+    openrtl_build_index(&buf);
+    openrtl_bench_report("index build", openrtl_bench_now() - start, INSTS);
+
+    // random access through the index
+    uint64_t state = 1;
+    for (int r = 0; r < ROUNDS; r++) {
+        double start = openrtl_bench_now();
+        for (size_t i = 0; i < INSTS; i++) {
+            state = state * 6364136223846793005 + 1442695040888963407;
+            OpenrtlInst inst;
+            openrtl_decode(&buf, openrtl_inst_offset(&buf, (state >> 33) % INSTS), &inst, NULL);
+            sum += inst.opcode;
+        }
+        double elapsed = openrtl_bench_now() - start;
+        if (!r || elapsed < best) {
+            best = elapsed;
+        }
+    }
+    openrtl_bench_report("indexed access", best, INSTS);
+
+    printf("(%zu bytes, checksum %llx)\n", buf.len, (unsigned long long) sum);
+    openrtl_del_buffer(&buf);
+    return 0;
+}
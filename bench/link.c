@@ -0,0 +1,54 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../include/openrtl.h"
+
+#define CALLS 8
+#define ROUNDS 5
+
+static double openrtl_bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// a context of `n` functions, each calling `CALLS` others by name
+static void openrtl_bench_context(OpenrtlContext *ctx, size_t n) {
+    char name[32];
+    openrtl_context(ctx);
+    for (size_t i = 0; i < n; i++) {
+        OpenrtlBuffer buf;
+        openrtl_context_buffer(ctx, &buf);
+        for (size_t j = 0; j < CALLS; j++) {
+            snprintf(name, sizeof(name), "f%zu", (i * 7919 + j * 104729) % n);
+            openrtl_symbol(&buf, OPENRTL_SYMBOL_GLOBAL, name);
+            openrtl_call(&buf, 0xffffffffffffffff);
+        }
+        openrtl_return(&buf);
+        snprintf(name, sizeof(name), "f%zu", i);
+        openrtl_add_buffer(ctx, name, &buf);
+        openrtl_global(ctx, name, 0x100000 + 64 * i);
+    }
+}
+
+// linking is linear in the number of symbols, so the time per symbol
+// stays flat as the context grows
+int main(void) {
+    printf("%10s %12s %12s\n", "functions", "link ms", "ns/symbol");
+    for (size_t n = 1024; n <= 65536; n *= 4) {
+        OpenrtlContext ctx;
+        openrtl_bench_context(&ctx, n);
+        double best = 0;
+        for (int r = 0; r < ROUNDS; r++) {
+            double start = openrtl_bench_now();
+            openrtl_link(&ctx);
+            double elapsed = openrtl_bench_now() - start;
+            if (!r || elapsed < best) {
+                best = elapsed;
+            }
+        }
+        printf("%10zu %12.3f %12.2f\n", n, best * 1e3, best * 1e9 / (n * CALLS));
+        openrtl_del_context(&ctx);
+    }
+    return 0;
+}
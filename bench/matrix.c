@@ -0,0 +1,60 @@
+#include <stdio.h>
+#include "../include/openrtl.h"
+
+#define INSTS (1 << 20)
+
+// bytes held by the columns of `matrix`, and by its chains once built
+static size_t openrtl_bench_bytes(const OpenrtlMatrix *matrix, int chains) {
+    size_t bytes = matrix->cap * (3 * sizeof(uint32_t) + 2) + matrix->wide.cap * sizeof(union OpenrtlOperand);
+    if (chains && matrix->last) {
+        bytes += 2 * matrix->cap * sizeof(uint32_t) + 3 * 256 * sizeof(uint32_t);
+    }
+    return bytes;
+}
+
+// every instruction that records an element, with immediates of every
+// width, against an array of `struct OpenrtlElement` holding the same
+int main(void) {
+    uint64_t state = 0x9e3779b97f4a7c15;
+    OpenrtlBuffer buf;
+    openrtl_buffer(&buf);
+    printf("empty buffer:    %8zu bytes\n", openrtl_bench_bytes(&buf.matrix, 1));
+    for (size_t i = 0; i < INSTS; i++) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        uint8_t reg = state >> 8 & 15;
+        switch (state % 6) {
+        case 0:
+            openrtl_imove_immediate(&buf, OPENRTL_SIZE_64, reg, state >> 12 & (((uint64_t) 1 << (state >> 4 & 63)) - 1));
+            break;
+        case 1:
+            openrtl_imove_unsigned(&buf, OPENRTL_SIZE_64, reg, 1, OPENRTL_SIZE_32);
+            break;
+        case 2:
+            openrtl_iload(&buf, OPENRTL_SIZE_64, reg, 2, 3);
+            break;
+        case 3:
+            openrtl_fstore(&buf, OPENRTL_SIZE_64, reg, 2, 3);
+            break;
+        case 4:
+            openrtl_ipush(&buf, reg);
+            break;
+        default:
+            openrtl_ipop(&buf, reg);
+            break;
+        }
+    }
+
+    size_t len = buf.matrix.len;
+    size_t columns = openrtl_bench_bytes(&buf.matrix, 0);
+    openrtl_matrix_last_def(&buf.matrix, OPENRTL_GP_REGISTER, 0);
+    size_t chained = openrtl_bench_bytes(&buf.matrix, 1);
+    size_t array = len * sizeof(struct OpenrtlElement);
+    printf("elements:        %8zu (%zu wide operands)\n", len, buf.matrix.wide.len);
+    printf("element array:   %8.2f bytes/element\n", (double) array / len);
+    printf("columns:         %8.2f bytes/element, %.0f%% smaller\n", (double) columns / len, 100.0 - 100.0 * columns / array);
+    printf("columns, chains: %8.2f bytes/element, %.0f%% smaller\n", (double) chained / len, 100.0 - 100.0 * chained / array);
+    openrtl_del_buffer(&buf);
+    return 0;
+}
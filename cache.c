@@ -0,0 +1,329 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "include/openrtl.h"
+#include "internal.h"
+
+#define DEFAULT_CACHE_CAP 64
+
+static const char openrtl_cache_magic[8] = "OPENRTLC";
+// names what `openrtl_alloc_cached` stores, so that its entries never
+// match the key of an artifact of another kind or format
+static const char openrtl_cache_regalloc[8] = "REGALLOC";
+
+struct OpenrtlCacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t entry;
+    struct OpenrtlCacheKey key;
+    uint64_t len;
+    uint64_t artifact;
+};
+
+static inline uint64_t openrtl_cache_mix(uint64_t hash, uint64_t word) {
+    hash ^= word;
+    hash *= 0x9e3779b97f4a7c15;
+    return hash ^ (hash >> 29);
+}
+
+void openrtl_cache_key_init(struct OpenrtlCacheKey *key) {
+    key->lo = 0x243f6a8885a308d3;
+    key->hi = 0x13198a2e03707344;
+}
+
+// folds `len` bytes into both halves of the key, eight at a time
+void openrtl_cache_key_update(struct OpenrtlCacheKey *key, const void *ptr, size_t len) {
+    const unsigned char *p = ptr;
+    for (; len >= 8; p += 8, len -= 8) {
+        uint64_t word;
+        memcpy(&word, p, 8);
+        key->lo = openrtl_cache_mix(key->lo, word);
+        key->hi = openrtl_cache_mix(key->hi, word ^ 0xa4093822299f31d0);
+    }
+    uint64_t word = (uint64_t) len << 56;
+    if (len) {
+        memcpy(&word, p, len);
+    }
+    key->lo = openrtl_cache_mix(key->lo, word);
+    key->hi = openrtl_cache_mix(key->hi, word ^ 0xa4093822299f31d0);
+}
+
+// identifies a buffer by its code and parameter count
+void openrtl_cache_key(const OpenrtlBuffer *buf, struct OpenrtlCacheKey *key) {
+    openrtl_cache_key_init(key);
+    uint64_t head[2] = { buf->params, buf->len };
+    openrtl_cache_key_update(key, head, sizeof(head));
+    size_t n;
+    for (size_t i = 0; i < buf->len; i += n) {
+        const void *ptr = openrtl_buffer_span(buf, i, &n);
+        openrtl_cache_key_update(key, ptr, n);
+    }
+}
+
+// `dir` may be NULL for a cache that only lives in memory, otherwise
+// entries are also written to and read from files in it
+int openrtl_cache(OpenrtlCache *cache, const OpenrtlAllocator *allocator, const char *dir) {
+    cache->allocator = allocator;
+    cache->dir = dir;
+    cache->cap = DEFAULT_CACHE_CAP;
+    cache->len = 0;
+    cache->ptr = openrtl_malloc(allocator, cache->cap * sizeof(struct OpenrtlCacheEntry));
+    cache->index = openrtl_calloc(allocator, 2 * cache->cap, sizeof(size_t));
+    if (!cache->ptr || !cache->index) {
+        openrtl_free(allocator, cache->ptr);
+        openrtl_free(allocator, cache->index);
+        cache->ptr = NULL;
+        cache->index = NULL;
+        return 1;
+    }
+    return 0;
+}
+
+void openrtl_del_cache(OpenrtlCache *cache) {
+    for (size_t i = 0; i < cache->len; i++) {
+        openrtl_free(cache->allocator, cache->ptr[i].table.entries);
+        openrtl_free(cache->allocator, cache->ptr[i].artifact);
+    }
+    openrtl_free(cache->allocator, cache->ptr);
+    openrtl_free(cache->allocator, cache->index);
+}
+
+static int openrtl_cache_equal(const struct OpenrtlCacheKey *a, const struct OpenrtlCacheKey *b) {
+    return a->lo == b->lo && a->hi == b->hi;
+}
+
+static size_t *openrtl_cache_slot(OpenrtlCache *cache, const struct OpenrtlCacheKey *key) {
+    size_t mask = 2 * cache->cap - 1;
+    size_t slot = key->lo & mask;
+    while (cache->index[slot] && !openrtl_cache_equal(&cache->ptr[cache->index[slot] - 1].key, key)) {
+        slot = (slot + 1) & mask;
+    }
+    return cache->index + slot;
+}
+
+static void openrtl_cache_path(const OpenrtlCache *cache, const struct OpenrtlCacheKey *key, char *path, size_t len) {
+    snprintf(path, len, "%s/%016llx%016llx.rtlc", cache->dir, (unsigned long long) key->hi, (unsigned long long) key->lo);
+}
+
+// adds an entry that takes ownership of `entries` and `artifact`
+static struct OpenrtlCacheEntry *openrtl_cache_add(OpenrtlCache *cache, const struct OpenrtlCacheKey *key, struct OpenrtlRegEntry *entries, size_t len, void *artifact, size_t size) {
+    if (cache->len == cache->cap) {
+        size_t cap = 2 * cache->cap;
+        struct OpenrtlCacheEntry *ptr = openrtl_realloc(cache->allocator, cache->ptr, cache->cap * sizeof(struct OpenrtlCacheEntry), cap * sizeof(struct OpenrtlCacheEntry));
+        size_t *index = openrtl_calloc(cache->allocator, 2 * cap, sizeof(size_t));
+        if (!ptr || !index) {
+            if (ptr) {
+                cache->ptr = ptr;
+            }
+            openrtl_free(cache->allocator, index);
+            return NULL;
+        }
+        cache->ptr = ptr;
+        cache->cap = cap;
+        openrtl_free(cache->allocator, cache->index);
+        cache->index = index;
+        for (size_t i = 0; i < cache->len; i++) {
+            *openrtl_cache_slot(cache, &cache->ptr[i].key) = i + 1;
+        }
+    }
+
+    struct OpenrtlCacheEntry *ent = cache->ptr + cache->len;
+    ent->key = *key;
+    ent->table.allocator = cache->allocator;
+    ent->table.len = len;
+    ent->table.cap = len;
+    ent->table.entries = entries;
+    ent->artifact = artifact;
+    ent->size = size;
+    *openrtl_cache_slot(cache, key) = ++cache->len;
+    return ent;
+}
+
+static struct OpenrtlCacheEntry *openrtl_cache_load(OpenrtlCache *cache, const struct OpenrtlCacheKey *key) {
+    char path[4096];
+    openrtl_cache_path(cache, key, path, sizeof(path));
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        return NULL;
+    }
+
+    struct OpenrtlCacheHeader head;
+    struct OpenrtlRegEntry *entries = NULL;
+    void *artifact = NULL;
+    int status = fread(&head, sizeof(head), 1, file) != 1
+        || memcmp(head.magic, openrtl_cache_magic, sizeof(head.magic))
+        || head.version != OPENRTL_CACHE_VERSION
+        || head.entry != sizeof(struct OpenrtlRegEntry)
+        || !openrtl_cache_equal(&head.key, key);
+    if (!status) {
+        entries = openrtl_malloc(cache->allocator, (head.len ? head.len : 1) * sizeof(struct OpenrtlRegEntry));
+        artifact = head.artifact ? openrtl_malloc(cache->allocator, head.artifact) : NULL;
+        status = !entries || (head.artifact && !artifact)
+            || fread(entries, sizeof(struct OpenrtlRegEntry), head.len, file) != head.len
+            || (head.artifact && fread(artifact, 1, head.artifact, file) != head.artifact);
+    }
+    fclose(file);
+
+    struct OpenrtlCacheEntry *ent = NULL;
+    if (!status) {
+        ent = openrtl_cache_add(cache, key, entries, head.len, artifact, head.artifact);
+    }
+    if (!ent) {
+        openrtl_free(cache->allocator, entries);
+        openrtl_free(cache->allocator, artifact);
+    }
+    return ent;
+}
+
+// the entry cached for `key`, looked up in memory first and then in the
+// directory. the entry belongs to the cache
+const struct OpenrtlCacheEntry *openrtl_cache_find(OpenrtlCache *cache, const struct OpenrtlCacheKey *key) {
+    size_t *slot = openrtl_cache_slot(cache, key);
+    if (*slot) {
+        return cache->ptr + *slot - 1;
+    }
+    return cache->dir ? openrtl_cache_load(cache, key) : NULL;
+}
+
+// copies `table` and the optional `artifact` of `size` bytes into the
+// cache. an entry that is already cached is left as it is
+int openrtl_cache_insert(OpenrtlCache *cache, const struct OpenrtlCacheKey *key, const struct OpenrtlRegisterTable *table, const void *artifact, size_t size) {
+    if (*openrtl_cache_slot(cache, key)) {
+        return 0;
+    }
+
+    struct OpenrtlRegEntry *entries = openrtl_malloc(cache->allocator, (table->len ? table->len : 1) * sizeof(struct OpenrtlRegEntry));
+    void *copy = size ? openrtl_malloc(cache->allocator, size) : NULL;
+    if (!entries || (size && !copy)) {
+        openrtl_free(cache->allocator, entries);
+        openrtl_free(cache->allocator, copy);
+        return 1;
+    }
+    if (table->len) {
+        memcpy(entries, table->entries, table->len * sizeof(struct OpenrtlRegEntry));
+    }
+    if (size) {
+        memcpy(copy, artifact, size);
+    }
+    if (!openrtl_cache_add(cache, key, entries, table->len, copy, size)) {
+        openrtl_free(cache->allocator, entries);
+        openrtl_free(cache->allocator, copy);
+        return 1;
+    }
+    if (!cache->dir) {
+        return 0;
+    }
+
+    // written aside and renamed, so other processes never read a
+    // partial entry
+    char path[4096];
+    char temp[4096 + 16];
+    openrtl_cache_path(cache, key, path, sizeof(path));
+    snprintf(temp, sizeof(temp), "%s.%p", path, (void *) cache);
+    FILE *file = fopen(temp, "wb");
+    if (!file) {
+        return 1;
+    }
+    struct OpenrtlCacheHeader head = {
+        .version = OPENRTL_CACHE_VERSION,
+        .entry = sizeof(struct OpenrtlRegEntry),
+        .key = *key,
+        .len = table->len,
+        .artifact = size,
+    };
+    memcpy(head.magic, openrtl_cache_magic, sizeof(head.magic));
+    int status = fwrite(&head, sizeof(head), 1, file) != 1
+        || (table->len && fwrite(table->entries, sizeof(struct OpenrtlRegEntry), table->len, file) != table->len)
+        || (size && fwrite(artifact, 1, size, file) != size);
+    status |= fclose(file) != 0;
+    if (status || rename(temp, path)) {
+        remove(temp);
+        return 1;
+    }
+    return 0;
+}
+
+static int openrtl_cache_compare_addr(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *) a;
+    uint64_t y = *(const uint64_t *) b;
+    return (x > y) - (x < y);
+}
+
+// folds in what the blocks of `buf` are made of besides its code: where
+// its symbols are and what local ones resolve to, and its labels in
+// order of address. names are left out, they differ between processes
+static int openrtl_cache_key_blocks(const OpenrtlBuffer *buf, struct OpenrtlCacheKey *key) {
+    uint64_t head[2] = { buf->pcrel, buf->linker.len };
+    openrtl_cache_key_update(key, head, sizeof(head));
+    for (size_t i = 0; i < buf->linker.len; i++) {
+        const struct OpenrtlSymbol *sym = buf->linker.ptr + i;
+        uint64_t word[5] = { sym->type, sym->relative, sym->offset, 0, 0 };
+        const struct OpenrtlEntry *ent = sym->type == OPENRTL_SYMBOL_LOCAL ? openrtl_table_find(&buf->local, sym->name) : NULL;
+        if (ent) {
+            word[3] = ent->label ? 1 : 2;
+            word[4] = ent->addr;
+        }
+        openrtl_cache_key_update(key, word, sizeof(word));
+    }
+
+    size_t n = 0;
+    uint64_t *labels = openrtl_malloc(buf->allocator, (buf->local.len ? buf->local.len : 1) * sizeof(uint64_t));
+    if (!labels) {
+        return 1;
+    }
+    for (size_t i = 0; i < buf->local.len; i++) {
+        if (buf->local.ptr[i].label) {
+            labels[n++] = buf->local.ptr[i].addr;
+        }
+    }
+    qsort(labels, n, sizeof(uint64_t), openrtl_cache_compare_addr);
+    uint64_t len = n;
+    openrtl_cache_key_update(key, &len, sizeof(len));
+    openrtl_cache_key_update(key, labels, n * sizeof(uint64_t));
+    openrtl_free(buf->allocator, labels);
+    return 0;
+}
+
+// register allocation of `buf` that is looked up in the cache before it
+// is computed. the key also covers the symbols and labels of `buf`, the
+// registers `alloc` has free, so a fresh allocator should be passed for
+// every buffer, and the format of the table
+int openrtl_alloc_cached(OpenrtlCache *cache, OpenrtlRegalloc *alloc, OpenrtlContext *ctx, OpenrtlBuffer *buf, struct OpenrtlRegisterTable *dest) {
+    struct OpenrtlCacheKey key;
+    openrtl_cache_key(buf, &key);
+    if (openrtl_cache_key_blocks(buf, &key)) {
+        return 1;
+    }
+    uint64_t format[2] = { OPENRTL_CACHE_VERSION, sizeof(struct OpenrtlRegEntry) };
+    openrtl_cache_key_update(&key, openrtl_cache_regalloc, sizeof(openrtl_cache_regalloc));
+    openrtl_cache_key_update(&key, format, sizeof(format));
+    uint64_t regs[2] = { alloc->registers.len, alloc->parameters.len };
+    openrtl_cache_key_update(&key, regs, sizeof(regs));
+    openrtl_cache_key_update(&key, alloc->registers.registers, alloc->registers.len * sizeof(struct OpenrtlGmReg));
+    openrtl_cache_key_update(&key, alloc->parameters.registers, alloc->parameters.len * sizeof(struct OpenrtlGmReg));
+
+    const struct OpenrtlCacheEntry *ent = openrtl_cache_find(cache, &key);
+    if (ent) {
+        dest->allocator = alloc->allocator;
+        dest->len = ent->table.len;
+        dest->cap = ent->table.len ? ent->table.len : 1;
+        dest->entries = openrtl_malloc(dest->allocator, dest->cap * sizeof(struct OpenrtlRegEntry));
+        if (!dest->entries) {
+            return 1;
+        }
+        if (ent->table.len) {
+            memcpy(dest->entries, ent->table.entries, ent->table.len * sizeof(struct OpenrtlRegEntry));
+        }
+        return 0;
+    }
+
+    openrtl_alloc_find(alloc, ctx, buf);
+    int status = openrtl_alloc_allocate(alloc);
+    if (status) {
+        return status;
+    }
+    if (openrtl_alloc_regtable(dest, alloc)) {
+        return 1;
+    }
+    return openrtl_cache_insert(cache, &key, dest, NULL, 0);
+}
@@ -0,0 +1,385 @@
+#include <string.h>
+#include "include/openrtl.h"
+#include "internal.h"
+
+#define DEFAULT_LOOPS_CAP 8
+
+static int openrtl_cfg_blocks(OpenrtlCfg *cfg, OpenrtlBuffer *buf, const size_t *target, size_t n);
+static int openrtl_cfg_order(OpenrtlCfg *cfg);
+static void openrtl_cfg_dominators(OpenrtlCfg *cfg);
+static int openrtl_cfg_loops(OpenrtlCfg *cfg);
+static size_t openrtl_cfg_find_inst(const OpenrtlBuffer *buf, size_t n, size_t offset);
+
+// splits `buf` into basic blocks, which end at a branch, a call or a
+// return and begin at the target of a branch or a local label. a branch
+// resolves through its local symbol when it has one. only pc-relative
+// operands and labels are in the buffer, any other target leaves it
+int openrtl_cfg(OpenrtlCfg *cfg, OpenrtlBuffer *buf) {
+    memset(cfg, 0, sizeof(*cfg));
+    cfg->allocator = buf->allocator;
+    if (openrtl_build_index(buf)) {
+        return 1;
+    }
+    size_t n = buf->index.len;
+    if (!n) {
+        return 0;
+    }
+
+    // instruction index of the target of every branch, `n` when there is
+    // none or it is out of the buffer
+    size_t *target = openrtl_malloc(cfg->allocator, n * sizeof(size_t));
+    if (!target) {
+        return 1;
+    }
+    OpenrtlIter iter;
+    openrtl_iter(&iter, buf);
+    for (size_t i = 0; openrtl_iter_next(&iter); i++) {
+        target[i] = n;
+        if (openrtl_is_branch(iter.inst.opcode) && openrtl_is_pcrel(&iter.inst)) {
+            target[i] = openrtl_cfg_find_inst(buf, n, iter.operand + iter.offset);
+        }
+    }
+    for (size_t i = 0; i < buf->linker.len; i++) {
+        const struct OpenrtlSymbol *sym = buf->linker.ptr + i;
+        size_t at = openrtl_cfg_find_inst(buf, n, sym->offset - 4);
+        if (at == n) {
+            continue;
+        }
+        OpenrtlInst inst;
+        openrtl_decode(buf, sym->offset - 4, &inst, NULL);
+        if (!openrtl_is_branch(inst.opcode)) {
+            continue;
+        }
+        const struct OpenrtlEntry *ent = NULL;
+        if (sym->type == OPENRTL_SYMBOL_LOCAL) {
+            ent = openrtl_table_find(&buf->local, sym->name);
+        }
+        target[at] = ent && ent->label ? openrtl_cfg_find_inst(buf, n, ent->addr) : n;
+    }
+
+    int status = openrtl_cfg_blocks(cfg, buf, target, n);
+    openrtl_free(cfg->allocator, target);
+    if (!status) {
+        status = openrtl_cfg_order(cfg);
+    }
+    if (!status) {
+        openrtl_cfg_dominators(cfg);
+        status = openrtl_cfg_loops(cfg);
+    }
+    return status;
+}
+
+void openrtl_del_cfg(OpenrtlCfg *cfg) {
+    openrtl_free(cfg->allocator, cfg->blocks);
+    openrtl_free(cfg->allocator, cfg->preds);
+    openrtl_free(cfg->allocator, cfg->order);
+    openrtl_free(cfg->allocator, cfg->loops.ptr);
+}
+
+// block holding the instruction at `offset`
+size_t openrtl_cfg_block(const OpenrtlCfg *cfg, size_t offset) {
+    size_t lo = 0;
+    size_t hi = cfg->len;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (cfg->blocks[mid].end <= offset) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// whether block `a` dominates block `b`, both reachable
+int openrtl_cfg_dominates(const OpenrtlCfg *cfg, size_t a, size_t b) {
+    while (b != a && cfg->blocks[b].idom) {
+        b = cfg->blocks[b].idom - 1;
+    }
+    return a == b;
+}
+
+// instruction index at exactly `offset`, or `n`
+static size_t openrtl_cfg_find_inst(const OpenrtlBuffer *buf, size_t n, size_t offset) {
+    size_t lo = 0;
+    size_t hi = n;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (buf->index.ptr[mid] < offset) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo < n && buf->index.ptr[lo] == offset ? lo : n;
+}
+
+static int openrtl_cfg_blocks(OpenrtlCfg *cfg, OpenrtlBuffer *buf, const size_t *target, size_t n) {
+    // block of every instruction plus one, leaders first marked with one
+    size_t *block = openrtl_calloc(cfg->allocator, n + 1, sizeof(size_t));
+    if (!block) {
+        return 1;
+    }
+    block[0] = 1;
+    for (size_t i = 0; i < buf->local.len; i++) {
+        if (buf->local.ptr[i].label) {
+            block[openrtl_cfg_find_inst(buf, n, buf->local.ptr[i].addr)] = 1;
+        }
+    }
+    OpenrtlIter iter;
+    openrtl_iter(&iter, buf);
+    for (size_t i = 0; openrtl_iter_next(&iter); i++) {
+        unsigned int opcode = iter.inst.opcode;
+        if (openrtl_is_branch(opcode) || opcode == OPENRTL_OP_CALL || opcode == OPENRTL_OP_CALL_INDIRECT || opcode == OPENRTL_OP_RETURN) {
+            block[i + 1] = 1;
+            block[target[i]] = 1;
+        }
+    }
+
+    size_t len = 0;
+    for (size_t i = 0; i < n; i++) {
+        len += block[i];
+    }
+    cfg->blocks = openrtl_malloc(cfg->allocator, len * sizeof(struct OpenrtlBlock));
+    if (!cfg->blocks) {
+        openrtl_free(cfg->allocator, block);
+        return 1;
+    }
+    cfg->len = len;
+    for (size_t i = 0, b = 0; i < n; i++) {
+        if (block[i] && i) {
+            ++b;
+        }
+        block[i] = b;
+    }
+
+    openrtl_iter(&iter, buf);
+    for (size_t i = 0; openrtl_iter_next(&iter); i++) {
+        struct OpenrtlBlock *it = cfg->blocks + block[i];
+        if (!i || block[i] != block[i - 1]) {
+            it->first = i;
+            it->start = iter.offset;
+            it->nsucc = 0;
+            it->exit = 0;
+            it->idom = 0;
+            it->loop = 0;
+        }
+        it->last = i + 1;
+        it->end = iter.next;
+        if (i + 1 < n && block[i + 1] == block[i]) {
+            continue;
+        }
+
+        // the last instruction decides where control goes
+        unsigned int opcode = iter.inst.opcode;
+        int falls = opcode != OPENRTL_OP_RETURN && opcode != OPENRTL_OP_BRANCH;
+        if (falls) {
+            if (i + 1 < n) {
+                it->succ[it->nsucc++] = block[i + 1];
+            } else {
+                it->exit = 1;
+            }
+        }
+        if (openrtl_is_branch(opcode)) {
+            if (target[i] == n) {
+                it->exit = 1;
+            } else if (!it->nsucc || it->succ[0] != block[target[i]]) {
+                it->succ[it->nsucc++] = block[target[i]];
+            }
+        }
+        if (opcode == OPENRTL_OP_RETURN) {
+            it->exit = 1;
+        }
+    }
+    openrtl_free(cfg->allocator, block);
+
+    // predecessors are packed per block, `pred` is where those of a
+    // block start
+    size_t edges = 0;
+    for (size_t b = 0; b < len; b++) {
+        cfg->blocks[b].npred = 0;
+        edges += cfg->blocks[b].nsucc;
+    }
+    cfg->preds = openrtl_malloc(cfg->allocator, (edges ? edges : 1) * sizeof(size_t));
+    if (!cfg->preds) {
+        return 1;
+    }
+    for (size_t b = 0; b < len; b++) {
+        for (size_t s = 0; s < cfg->blocks[b].nsucc; s++) {
+            cfg->blocks[cfg->blocks[b].succ[s]].npred++;
+        }
+    }
+    for (size_t b = 0, at = 0; b < len; b++) {
+        cfg->blocks[b].pred = at;
+        at += cfg->blocks[b].npred;
+        cfg->blocks[b].npred = 0;
+    }
+    for (size_t b = 0; b < len; b++) {
+        for (size_t s = 0; s < cfg->blocks[b].nsucc; s++) {
+            struct OpenrtlBlock *succ = cfg->blocks + cfg->blocks[b].succ[s];
+            cfg->preds[succ->pred + succ->npred++] = b;
+        }
+    }
+    return 0;
+}
+
+// reverse postorder of the blocks reachable from the entry, found by an
+// explicit depth-first walk
+static int openrtl_cfg_order(OpenrtlCfg *cfg) {
+    cfg->order = openrtl_malloc(cfg->allocator, cfg->len * sizeof(size_t));
+    size_t *stack = openrtl_malloc(cfg->allocator, cfg->len * sizeof(size_t));
+    // successors visited so far plus one, zero while unvisited
+    size_t *seen = openrtl_calloc(cfg->allocator, cfg->len, sizeof(size_t));
+    if (!cfg->order || !stack || !seen) {
+        openrtl_free(cfg->allocator, stack);
+        openrtl_free(cfg->allocator, seen);
+        return 1;
+    }
+
+    size_t post = cfg->len;
+    size_t top = 0;
+    stack[top++] = 0;
+    seen[0] = 1;
+    while (top) {
+        size_t b = stack[top - 1];
+        struct OpenrtlBlock *it = cfg->blocks + b;
+        if (seen[b] - 1 < it->nsucc) {
+            size_t succ = it->succ[seen[b]++ - 1];
+            if (!seen[succ]) {
+                seen[succ] = 1;
+                stack[top++] = succ;
+            }
+        } else {
+            cfg->order[--post] = b;
+            --top;
+        }
+    }
+    // reachable blocks are moved to the front
+    cfg->reachable = cfg->len - post;
+    memmove(cfg->order, cfg->order + post, cfg->reachable * sizeof(size_t));
+    for (size_t b = 0; b < cfg->len; b++) {
+        cfg->blocks[b].rpo = cfg->len;
+    }
+    for (size_t i = 0; i < cfg->reachable; i++) {
+        cfg->blocks[cfg->order[i]].rpo = i;
+    }
+
+    openrtl_free(cfg->allocator, stack);
+    openrtl_free(cfg->allocator, seen);
+    return 0;
+}
+
+// Cooper, Harvey and Kennedy, "A Simple, Fast Dominance Algorithm". the
+// entry is its own dominator while this runs and gets none at the end
+static void openrtl_cfg_dominators(OpenrtlCfg *cfg) {
+    struct OpenrtlBlock *blocks = cfg->blocks;
+    blocks[0].idom = 1;
+    int changed;
+    do {
+        changed = 0;
+        for (size_t i = 1; i < cfg->reachable; i++) {
+            struct OpenrtlBlock *it = blocks + cfg->order[i];
+            size_t idom = 0;
+            for (size_t p = 0; p < it->npred; p++) {
+                size_t pred = cfg->preds[it->pred + p];
+                if (!blocks[pred].idom) {
+                    continue;
+                }
+                if (!idom) {
+                    idom = pred + 1;
+                    continue;
+                }
+                // intersect
+                size_t a = pred;
+                size_t b = idom - 1;
+                while (a != b) {
+                    while (blocks[a].rpo > blocks[b].rpo) {
+                        a = blocks[a].idom - 1;
+                    }
+                    while (blocks[b].rpo > blocks[a].rpo) {
+                        b = blocks[b].idom - 1;
+                    }
+                }
+                idom = a + 1;
+            }
+            if (it->idom != idom) {
+                it->idom = idom;
+                changed = 1;
+            }
+        }
+    } while (changed);
+    blocks[0].idom = 0;
+}
+
+// natural loops, one per header with every back edge into it merged.
+// loops are found from the outermost in, so a block ends up in its
+// innermost loop and a loop's parent is the loop its header was in
+static int openrtl_cfg_loops(OpenrtlCfg *cfg) {
+    // a block is pushed once for every edge out of it at most
+    size_t *stack = openrtl_malloc(cfg->allocator, 2 * cfg->len * sizeof(size_t));
+    size_t *mark = openrtl_calloc(cfg->allocator, cfg->len, sizeof(size_t));
+    if (!stack || !mark) {
+        openrtl_free(cfg->allocator, stack);
+        openrtl_free(cfg->allocator, mark);
+        return 1;
+    }
+
+    // headers in reverse postorder, outer loops come before the loops
+    // they contain
+    for (size_t i = 0; i < cfg->reachable; i++) {
+        size_t h = cfg->order[i];
+        struct OpenrtlBlock *header = cfg->blocks + h;
+        size_t top = 0;
+        for (size_t p = 0; p < header->npred; p++) {
+            size_t pred = cfg->preds[header->pred + p];
+            if (cfg->blocks[pred].rpo < cfg->reachable && openrtl_cfg_dominates(cfg, h, pred)) {
+                stack[top++] = pred;
+            }
+        }
+        if (!top) {
+            continue;
+        }
+
+        if (cfg->loops.len == cfg->loops.cap) {
+            size_t cap = cfg->loops.cap ? 2 * cfg->loops.cap : DEFAULT_LOOPS_CAP;
+            void *ptr = openrtl_realloc(cfg->allocator, cfg->loops.ptr, cfg->loops.cap * sizeof(struct OpenrtlLoop), cap * sizeof(struct OpenrtlLoop));
+            if (!ptr) {
+                openrtl_free(cfg->allocator, stack);
+                openrtl_free(cfg->allocator, mark);
+                return 1;
+            }
+            cfg->loops.ptr = ptr;
+            cfg->loops.cap = cap;
+        }
+        size_t id = cfg->loops.len++;
+        struct OpenrtlLoop *loop = cfg->loops.ptr + id;
+        loop->header = h;
+        loop->parent = header->loop;
+        loop->depth = header->loop ? cfg->loops.ptr[header->loop - 1].depth + 1 : 1;
+        loop->len = 1;
+
+        // walks back from the latches to the header, `mark` tells which
+        // loop visited a block last
+        mark[h] = id + 1;
+        header->loop = id + 1;
+        while (top) {
+            size_t b = stack[--top];
+            if (mark[b] == id + 1) {
+                continue;
+            }
+            mark[b] = id + 1;
+            cfg->blocks[b].loop = id + 1;
+            loop->len++;
+            for (size_t p = 0; p < cfg->blocks[b].npred; p++) {
+                size_t pred = cfg->preds[cfg->blocks[b].pred + p];
+                if (mark[pred] != id + 1 && cfg->blocks[pred].rpo < cfg->reachable) {
+                    stack[top++] = pred;
+                }
+            }
+        }
+    }
+
+    openrtl_free(cfg->allocator, stack);
+    openrtl_free(cfg->allocator, mark);
+    return 0;
+}
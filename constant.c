@@ -0,0 +1,385 @@
+#include <string.h>
+#include "include/openrtl.h"
+#include "internal.h"
+
+static int openrtl_const_round(OpenrtlBuffer *buf, int *resolved);
+static int openrtl_const_eval(unsigned int opcode, unsigned int size, uint64_t a, uint64_t b, uint64_t *result);
+static int openrtl_const_shift(unsigned int kind, unsigned int size, uint64_t a, uint64_t count, uint64_t *result);
+static int openrtl_const_bits(unsigned int kind, unsigned int size, uint64_t a, uint64_t *result);
+static int openrtl_const_branch(unsigned int opcode, const struct OpenrtlConstFlags *flags);
+
+// replaces integer arithmetic on registers holding known constants with
+// `IMOVE_IMMEDIATE` and resolves conditional branches after a compare of
+// constants, a branch that is always taken becomes `BRANCH` and one that
+// never is goes away. constants flow across the blocks of the graph
+int openrtl_fold_constants(OpenrtlBuffer *buf) {
+    if (!openrtl_const_moved(buf)) {
+        return 0;
+    }
+
+    // a resolved branch may make more constants known where it joined
+    // other paths
+    int resolved;
+    do {
+        if (openrtl_const_round(buf, &resolved)) {
+            return 1;
+        }
+    } while (resolved);
+    return 0;
+}
+
+static int openrtl_const_round(OpenrtlBuffer *buf, int *resolved) {
+    *resolved = 0;
+    struct OpenrtlRewrite rw;
+    OpenrtlCfg cfg;
+    if (openrtl_rewrite(&rw, buf)) {
+        openrtl_del_rewrite(&rw);
+        return 1;
+    }
+    if (openrtl_cfg(&cfg, buf)) {
+        openrtl_del_cfg(&cfg);
+        openrtl_del_rewrite(&rw);
+        return 1;
+    }
+    struct OpenrtlConsts *out = openrtl_malloc(rw.allocator, (cfg.len ? cfg.len : 1) * sizeof(struct OpenrtlConsts));
+    uint8_t *seen = openrtl_calloc(rw.allocator, cfg.len ? cfg.len : 1, 1);
+    uint8_t *entry = openrtl_rewrite_entries(&rw, buf);
+    struct OpenrtlConsts *state = openrtl_malloc(rw.allocator, sizeof(struct OpenrtlConsts));
+    if (!out || !seen || !entry || !state) {
+        openrtl_free(rw.allocator, out);
+        openrtl_free(rw.allocator, seen);
+        openrtl_free(rw.allocator, entry);
+        openrtl_free(rw.allocator, state);
+        openrtl_del_cfg(&cfg);
+        openrtl_del_rewrite(&rw);
+        return 1;
+    }
+
+    openrtl_const_flow(&rw, &cfg, entry, out, seen, state);
+    int edited = 0;
+    for (size_t i = 0; i < cfg.reachable; i++) {
+        size_t b = cfg.order[i];
+        const struct OpenrtlBlock *block = cfg.blocks + b;
+        struct OpenrtlConstFlags flags = {0};
+        openrtl_const_entry(&cfg, out, seen, entry, b, state);
+        for (size_t at = block->first; at < block->last; at++) {
+            struct OpenrtlRewriteInst *it = rw.ptr + at;
+            unsigned int opcode = it->inst.opcode;
+            if (openrtl_is_branch(opcode) && opcode != OPENRTL_OP_BRANCH) {
+                int taken = openrtl_const_branch(opcode, &flags);
+                if (taken >= 0) {
+                    if (taken) {
+                        it->inst.opcode = OPENRTL_OP_BRANCH;
+                    } else {
+                        it->dead = 1;
+                    }
+                    *resolved = 1;
+                    edited = 1;
+                }
+            }
+
+            uint64_t result;
+            if (!openrtl_const_step(state, &flags, it, &result) || opcode == OPENRTL_OP_IMOVE_IMMEDIATE) {
+                continue;
+            }
+            if (openrtl_sets_flags(opcode) && openrtl_rewrite_flags(&rw, at)) {
+                continue;
+            }
+            OpenrtlInst inst = {0};
+            inst.opcode = OPENRTL_OP_IMOVE_IMMEDIATE;
+            inst.size = it->inst.size;
+            inst.rel.dest = it->inst.arith.dest;
+            it->inst = inst;
+            it->operand = result;
+            edited = 1;
+        }
+    }
+
+    openrtl_free(rw.allocator, out);
+    openrtl_free(rw.allocator, seen);
+    openrtl_free(rw.allocator, entry);
+    openrtl_free(rw.allocator, state);
+    openrtl_del_cfg(&cfg);
+    int status = edited ? openrtl_rewrite_commit(&rw, buf) : 0;
+    openrtl_del_rewrite(&rw);
+    return status;
+}
+
+// registers known on exit from every block of the graph in `out`, with
+// `seen` flagging the reachable blocks. `state` is room for one block
+void openrtl_const_flow(const struct OpenrtlRewrite *rw, const OpenrtlCfg *cfg, const uint8_t *entry, struct OpenrtlConsts *out, uint8_t *seen, struct OpenrtlConsts *state) {
+    // forward over the reachable blocks in reverse postorder, a block
+    // starts from what all its visited predecessors agree on
+    int changed;
+    do {
+        changed = 0;
+        for (size_t i = 0; i < cfg->reachable; i++) {
+            size_t b = cfg->order[i];
+            const struct OpenrtlBlock *block = cfg->blocks + b;
+            struct OpenrtlConstFlags flags = {0};
+            uint64_t result;
+            openrtl_const_entry(cfg, out, seen, entry, b, state);
+            for (size_t at = block->first; at < block->last; at++) {
+                openrtl_const_step(state, &flags, rw->ptr + at, &result);
+            }
+            if (!seen[b] || memcmp(state, out + b, sizeof(struct OpenrtlConsts))) {
+                out[b] = *state;
+                seen[b] = 1;
+                changed = 1;
+            }
+        }
+    } while (changed);
+}
+
+// registers known on entry to block `b`. nothing is known where the
+// buffer may be entered from outside
+void openrtl_const_entry(const OpenrtlCfg *cfg, const struct OpenrtlConsts *out, const uint8_t *seen, const uint8_t *entry, size_t b, struct OpenrtlConsts *state) {
+    const struct OpenrtlBlock *block = cfg->blocks + b;
+    int first = 1;
+    memset(state->known, 0, sizeof(state->known));
+    memset(state->value, 0, sizeof(state->value));
+    if (entry[block->first]) {
+        return;
+    }
+    for (size_t p = 0; p < block->npred; p++) {
+        size_t pred = cfg->preds[block->pred + p];
+        if (!seen[pred]) {
+            continue;
+        }
+        const struct OpenrtlConsts *from = out + pred;
+        if (first) {
+            *state = *from;
+            first = 0;
+            continue;
+        }
+        for (size_t r = 0; r < 256; r++) {
+            if (state->known[r] != from->known[r] || state->value[r] != from->value[r]) {
+                state->known[r] = 0;
+            }
+        }
+    }
+    for (size_t r = 0; r < 256; r++) {
+        if (!state->known[r]) {
+            state->value[r] = 0;
+        }
+    }
+}
+
+// applies the instruction to what is known, returns whether the register
+// it writes then holds the constant `result`
+int openrtl_const_step(struct OpenrtlConsts *state, struct OpenrtlConstFlags *flags, const struct OpenrtlRewriteInst *it, uint64_t *result) {
+    const OpenrtlInst *inst = &it->inst;
+    unsigned int opcode = inst->opcode;
+    unsigned int size = inst->size;
+    int known = 0;
+    uint64_t value = 0;
+    switch (opcode) {
+    case OPENRTL_OP_IMOVE_IMMEDIATE:
+        known = !it->symbol;
+        value = it->operand;
+        break;
+    case OPENRTL_OP_IMOVE_UNSIGNED:
+    case OPENRTL_OP_IMOVE_SIGNED: {
+        uint8_t src = inst->arith_b.src;
+        unsigned int from = inst->arith_b.size;
+        if (state->known[src] > from) {
+            known = 1;
+            value = state->value[src] & openrtl_const_mask(from);
+            if (opcode == OPENRTL_OP_IMOVE_SIGNED) {
+                value = (uint64_t) openrtl_const_signed(value, from);
+            }
+        }
+        break;
+    }
+    case OPENRTL_OP_ISHIFT:
+        if (state->known[inst->arith.src1] > size) {
+            known = openrtl_const_shift(inst->arith.src2 >> 6, size, state->value[inst->arith.src1], inst->arith.src2 & 63, &value);
+        }
+        break;
+    case OPENRTL_OP_ISHIFT_VARIABLE:
+        if (state->known[inst->arith.dest] > size && state->known[inst->arith.src1] > size) {
+            known = openrtl_const_shift(inst->arith.src2, size, state->value[inst->arith.dest], state->value[inst->arith.src1], &value);
+        }
+        break;
+    case OPENRTL_OP_IBITS:
+        if (state->known[inst->arith.src1] > size) {
+            known = openrtl_const_bits(inst->arith.src2, size, state->value[inst->arith.src1], &value);
+        }
+        break;
+    case OPENRTL_OP_ICOMPARE:
+        flags->known = state->known[inst->arith.src1] > size && state->known[inst->arith.src2] > size;
+        flags->size = size;
+        flags->a = state->value[inst->arith.src1] & openrtl_const_mask(size);
+        flags->b = state->value[inst->arith.src2] & openrtl_const_mask(size);
+        break;
+    case OPENRTL_OP_CALL:
+    case OPENRTL_OP_CALL_INDIRECT:
+        // whatever is called may clobber any register
+        memset(state->known, 0, sizeof(state->known));
+        memset(state->value, 0, sizeof(state->value));
+        flags->known = 0;
+        break;
+    default:
+        if (state->known[inst->arith.src1] > size && state->known[inst->arith.src2] > size) {
+            known = openrtl_const_eval(opcode, size, state->value[inst->arith.src1], state->value[inst->arith.src2], &value);
+        }
+        break;
+    }
+    if (openrtl_sets_flags(opcode) && opcode != OPENRTL_OP_ICOMPARE) {
+        flags->known = 0;
+    }
+
+    // only general purpose registers are tracked, the others are of no
+    // concern to what is known of them
+    struct OpenrtlInstRegs regs;
+    openrtl_inst_regs(inst, &regs);
+    if (!regs.ndef || regs.def_file != OPENRTL_FILE_GP) {
+        return 0;
+    }
+    known = known && opcode != OPENRTL_OP_ICOMPARE;
+    value &= openrtl_const_mask(size);
+    state->known[regs.def] = known ? size + 1 : 0;
+    state->value[regs.def] = known ? value : 0;
+    *result = value;
+    return known;
+}
+
+// integer arithmetic of `size`, zero when it cannot be evaluated
+static int openrtl_const_eval(unsigned int opcode, unsigned int size, uint64_t a, uint64_t b, uint64_t *result) {
+    uint64_t mask = openrtl_const_mask(size);
+    int64_t sa = openrtl_const_signed(a & mask, size);
+    int64_t sb = openrtl_const_signed(b & mask, size);
+    a &= mask;
+    b &= mask;
+    switch (opcode) {
+    case OPENRTL_OP_IADD:
+        *result = a + b;
+        return 1;
+    case OPENRTL_OP_IAND:
+        *result = a & b;
+        return 1;
+    case OPENRTL_OP_IOR:
+        *result = a | b;
+        return 1;
+    case OPENRTL_OP_IXOR:
+        *result = a ^ b;
+        return 1;
+    case OPENRTL_OP_ISUBTRACT:
+        *result = a - b;
+        return 1;
+    case OPENRTL_OP_IMULTIPLY_UNSIGNED:
+    case OPENRTL_OP_IMULTIPLY_SIGNED:
+        // the low bytes of a product do not depend on the signedness
+        *result = a * b;
+        return 1;
+    case OPENRTL_OP_IDIVIDE_UNSIGNED:
+    case OPENRTL_OP_IMODULO_UNSIGNED:
+        if (!b) {
+            return 0;
+        }
+        *result = opcode == OPENRTL_OP_IDIVIDE_UNSIGNED ? a / b : a % b;
+        return 1;
+    case OPENRTL_OP_IDIVIDE_SIGNED:
+    case OPENRTL_OP_IMODULO_SIGNED:
+        // the overflow of the most negative value by -1 is left to run
+        if (!sb || (sb == -1 && sa == openrtl_const_signed((mask >> 1) + 1, size))) {
+            return 0;
+        }
+        *result = (uint64_t) (opcode == OPENRTL_OP_IDIVIDE_SIGNED ? sa / sb : sa % sb);
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+// a shift of `kind` by `count` modulo the width of `size`, zero when the
+// kind is not known
+static int openrtl_const_shift(unsigned int kind, unsigned int size, uint64_t a, uint64_t count, uint64_t *result) {
+    unsigned int bits = 8u << size;
+    a &= openrtl_const_mask(size);
+    count &= bits - 1;
+    switch (kind) {
+    case OPENRTL_SHIFT_LEFT:
+        *result = a << count;
+        return 1;
+    case OPENRTL_SHIFT_RIGHT:
+        *result = a >> count;
+        return 1;
+    case OPENRTL_SHIFT_RIGHT_SIGNED:
+        *result = (uint64_t) (openrtl_const_signed(a, size) >> count);
+        return 1;
+    case OPENRTL_ROTATE_LEFT:
+        *result = count ? a << count | a >> (bits - count) : a;
+        return 1;
+    case OPENRTL_ROTATE_RIGHT:
+        *result = count ? a >> count | a << (bits - count) : a;
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+static int openrtl_const_bits(unsigned int kind, unsigned int size, uint64_t a, uint64_t *result) {
+    unsigned int bits = 8u << size;
+    a &= openrtl_const_mask(size);
+    uint64_t value = 0;
+    switch (kind) {
+    case OPENRTL_BITS_POPCOUNT:
+        for (; a; a &= a - 1) {
+            ++value;
+        }
+        break;
+    case OPENRTL_BITS_LEADING_ZEROS:
+        for (value = bits; a; a >>= 1) {
+            --value;
+        }
+        break;
+    case OPENRTL_BITS_TRAILING_ZEROS:
+        while (value < bits && !((a >> value) & 1)) {
+            ++value;
+        }
+        break;
+    case OPENRTL_BITS_SWAP:
+        for (unsigned int i = 0; i < bits; i += 8) {
+            value = value << 8 | ((a >> i) & 0xff);
+        }
+        break;
+    default:
+        return 0;
+    }
+    *result = value;
+    return 1;
+}
+
+// whether a conditional branch after a compare of `flags` is taken, -1
+// when the compare is unknown
+static int openrtl_const_branch(unsigned int opcode, const struct OpenrtlConstFlags *flags) {
+    if (!flags->known) {
+        return -1;
+    }
+    uint64_t a = flags->a;
+    uint64_t b = flags->b;
+    int64_t sa = openrtl_const_signed(a, flags->size);
+    int64_t sb = openrtl_const_signed(b, flags->size);
+    uint64_t diff = (a - b) & openrtl_const_mask(flags->size);
+    switch (opcode) {
+    case OPENRTL_OP_BRANCH_CARRY:
+        return a < b;
+    case OPENRTL_OP_BRANCH_OVERFLOW:
+        return openrtl_const_signed(((a ^ b) & (a ^ diff)), flags->size) < 0;
+    case OPENRTL_OP_BRANCH_EQUAL:
+        return a == b;
+    case OPENRTL_OP_BRANCH_NOT_EQUAL:
+        return a != b;
+    case OPENRTL_OP_BRANCH_LESS:
+        return sa < sb;
+    case OPENRTL_OP_BRANCH_LESS_EQ:
+        return sa <= sb;
+    case OPENRTL_OP_BRANCH_GREATER:
+        return sa > sb;
+    case OPENRTL_OP_BRANCH_GREATER_EQ:
+        return sa >= sb;
+    default:
+        return -1;
+    }
+}
@@ -0,0 +1,250 @@
+#include <string.h>
+#include "include/openrtl.h"
+#include "internal.h"
+
+static int openrtl_dead_round(OpenrtlBuffer *buf, int *edited);
+static int openrtl_dead_reach(const struct OpenrtlRewrite *rw, const OpenrtlBuffer *buf, const OpenrtlCfg *cfg, uint8_t *reach);
+static int openrtl_dead_block(struct OpenrtlRewrite *rw, const OpenrtlCfg *cfg, const struct OpenrtlRegSet *in, size_t b, struct OpenrtlRegSet *live, uint8_t *kill);
+static int openrtl_dead_jump(struct OpenrtlRewrite *rw, const OpenrtlBuffer *buf, size_t at);
+
+// instructions that only write their register and the flags
+static int openrtl_dead_pure(unsigned int opcode) {
+    switch (opcode) {
+    case OPENRTL_OP_IADD:
+    case OPENRTL_OP_IADD_CARRY:
+    case OPENRTL_OP_IAND:
+    case OPENRTL_OP_IOR:
+    case OPENRTL_OP_IXOR:
+    case OPENRTL_OP_ISUBTRACT:
+    case OPENRTL_OP_ICOMPARE:
+    case OPENRTL_OP_IMULTIPLY_UNSIGNED:
+    case OPENRTL_OP_IMULTIPLY_SIGNED:
+    case OPENRTL_OP_IMOVE_IMMEDIATE:
+    case OPENRTL_OP_IMOVE_UNSIGNED:
+    case OPENRTL_OP_IMOVE_SIGNED:
+    case OPENRTL_OP_FADD:
+    case OPENRTL_OP_FSUBTRACT:
+    case OPENRTL_OP_FCOMPARE:
+    case OPENRTL_OP_FMULTIPLY:
+    case OPENRTL_OP_FDIVIDE:
+    case OPENRTL_OP_FMOVE:
+    case OPENRTL_OP_F2I:
+    case OPENRTL_OP_I2F:
+    case OPENRTL_OP_EXTEND:
+    case OPENRTL_OP_F2BITS:
+    case OPENRTL_OP_BITS2F:
+    case OPENRTL_OP_VADD:
+    case OPENRTL_OP_VSUBTRACT:
+    case OPENRTL_OP_VMULTIPLYF:
+    case OPENRTL_OP_VDIVIDEF:
+    case OPENRTL_OP_VMULTIPLY:
+    case OPENRTL_OP_VDIVIDE:
+    case OPENRTL_OP_VDOT:
+    case OPENRTL_OP_VCROSS:
+    case OPENRTL_OP_VEXTEND:
+    case OPENRTL_OP_VTRUNCATE:
+    case OPENRTL_OP_ISHIFT:
+    case OPENRTL_OP_ISHIFT_VARIABLE:
+    case OPENRTL_OP_IBITS:
+        return 1;
+    default:
+        // integer division may trap, loads may fault and the stack
+        // moves with every push and pop
+        return 0;
+    }
+}
+
+// deletes the code no entry into the buffer reaches, definitions nothing
+// reads and branches to the instruction that follows them. registers
+// are taken to be read wherever control leaves the buffer or calls out
+int openrtl_eliminate_dead(OpenrtlBuffer *buf) {
+    int edited;
+    do {
+        if (openrtl_dead_round(buf, &edited)) {
+            return 1;
+        }
+    } while (edited);
+    return 0;
+}
+
+static int openrtl_dead_round(OpenrtlBuffer *buf, int *edited) {
+    *edited = 0;
+    struct OpenrtlRewrite rw;
+    OpenrtlCfg cfg;
+    if (openrtl_rewrite(&rw, buf)) {
+        openrtl_del_rewrite(&rw);
+        return 1;
+    }
+    if (openrtl_cfg(&cfg, buf)) {
+        openrtl_del_cfg(&cfg);
+        openrtl_del_rewrite(&rw);
+        return 1;
+    }
+    uint8_t *reach = openrtl_calloc(rw.allocator, cfg.len ? cfg.len : 1, 1);
+    struct OpenrtlRegSet *in = openrtl_calloc(rw.allocator, cfg.len ? cfg.len : 1, sizeof(struct OpenrtlRegSet));
+    uint8_t *kill = openrtl_calloc(rw.allocator, rw.len ? rw.len : 1, 1);
+    if (!reach || !in || !kill || openrtl_dead_reach(&rw, buf, &cfg, reach)) {
+        openrtl_free(rw.allocator, reach);
+        openrtl_free(rw.allocator, in);
+        openrtl_free(rw.allocator, kill);
+        openrtl_del_cfg(&cfg);
+        openrtl_del_rewrite(&rw);
+        return 1;
+    }
+
+    for (size_t b = 0; b < cfg.len; b++) {
+        if (reach[b]) {
+            continue;
+        }
+        for (size_t at = cfg.blocks[b].first; at < cfg.blocks[b].last; at++) {
+            rw.ptr[at].dead = 1;
+            *edited = 1;
+        }
+    }
+
+    // registers live on entry to every reached block, walked backwards
+    // until nothing changes
+    int changed;
+    do {
+        changed = 0;
+        for (size_t b = cfg.len; b-- > 0;) {
+            if (!reach[b]) {
+                continue;
+            }
+            struct OpenrtlRegSet live;
+            openrtl_dead_block(&rw, &cfg, in, b, &live, NULL);
+            if (memcmp(&live, in + b, sizeof(live))) {
+                in[b] = live;
+                changed = 1;
+            }
+        }
+    } while (changed);
+
+    // deleted only once every block has been walked, so whether the flags
+    // of an instruction are read is decided as it was above
+    for (size_t b = 0; b < cfg.len; b++) {
+        struct OpenrtlRegSet live;
+        if (reach[b]) {
+            *edited |= openrtl_dead_block(&rw, &cfg, in, b, &live, kill);
+        }
+    }
+    for (size_t at = 0; at < rw.len; at++) {
+        rw.ptr[at].dead |= kill[at];
+    }
+    for (size_t at = 0; at < rw.len; at++) {
+        if (!rw.ptr[at].dead && openrtl_dead_jump(&rw, buf, at)) {
+            rw.ptr[at].dead = 1;
+            *edited = 1;
+        }
+    }
+
+    openrtl_free(rw.allocator, reach);
+    openrtl_free(rw.allocator, in);
+    openrtl_free(rw.allocator, kill);
+    openrtl_del_cfg(&cfg);
+    int status = *edited ? openrtl_rewrite_commit(&rw, buf) : 0;
+    openrtl_del_rewrite(&rw);
+    return status;
+}
+
+// marks the blocks reached from any entry into the buffer
+static int openrtl_dead_reach(const struct OpenrtlRewrite *rw, const OpenrtlBuffer *buf, const OpenrtlCfg *cfg, uint8_t *reach) {
+    uint8_t *entry = openrtl_rewrite_entries(rw, buf);
+    size_t *stack = openrtl_malloc(rw->allocator, (cfg->len ? cfg->len : 1) * sizeof(size_t));
+    if (!entry || !stack) {
+        openrtl_free(rw->allocator, entry);
+        openrtl_free(rw->allocator, stack);
+        return 1;
+    }
+    size_t top = 0;
+    for (size_t b = 0; b < cfg->len; b++) {
+        if (entry[cfg->blocks[b].first]) {
+            reach[b] = 1;
+            stack[top++] = b;
+        }
+    }
+    while (top) {
+        const struct OpenrtlBlock *block = cfg->blocks + stack[--top];
+        for (size_t s = 0; s < block->nsucc; s++) {
+            if (!reach[block->succ[s]]) {
+                reach[block->succ[s]] = 1;
+                stack[top++] = block->succ[s];
+            }
+        }
+    }
+    openrtl_free(rw->allocator, entry);
+    openrtl_free(rw->allocator, stack);
+    return 0;
+}
+
+// walks block `b` backwards from the registers live on exit from it and
+// leaves those live on entry in `live`. the definitions found dead are
+// flagged in `kill` when it is given, returns whether there were any
+static int openrtl_dead_block(struct OpenrtlRewrite *rw, const OpenrtlCfg *cfg, const struct OpenrtlRegSet *in, size_t b, struct OpenrtlRegSet *live, uint8_t *kill) {
+    const struct OpenrtlBlock *block = cfg->blocks + b;
+    memset(live, block->exit ? 0xff : 0, sizeof(*live));
+    for (size_t s = 0; s < block->nsucc; s++) {
+        for (size_t w = 0; w < OPENRTL_REGSET_WORDS; w++) {
+            live->bits[w] |= in[block->succ[s]].bits[w];
+        }
+    }
+
+    int removed = 0;
+    for (size_t at = block->last; at-- > block->first;) {
+        struct OpenrtlRewriteInst *it = rw->ptr + at;
+        unsigned int opcode = it->inst.opcode;
+        if (it->dead) {
+            continue;
+        }
+        if (opcode == OPENRTL_OP_CALL || opcode == OPENRTL_OP_CALL_INDIRECT || opcode == OPENRTL_OP_RETURN) {
+            memset(live, 0xff, sizeof(*live));
+            continue;
+        }
+        struct OpenrtlInstRegs regs;
+        openrtl_inst_regs(&it->inst, &regs);
+        if (regs.ndef && !openrtl_regset_has(live, regs.def_file, regs.def) && openrtl_dead_pure(opcode)
+            && !(openrtl_sets_flags(opcode) && openrtl_rewrite_flags(rw, at))) {
+            if (kill) {
+                kill[at] = 1;
+            }
+            removed = 1;
+            continue;
+        }
+        if (regs.ndef) {
+            openrtl_regset_del(live, regs.def_file, regs.def);
+        }
+        for (size_t i = 0; i < regs.nuse; i++) {
+            openrtl_regset_add(live, regs.use_file[i], regs.use[i]);
+        }
+    }
+    return removed;
+}
+
+// whether the `at`th instruction is a branch to the instruction that is
+// kept after it
+static int openrtl_dead_jump(struct OpenrtlRewrite *rw, const OpenrtlBuffer *buf, size_t at) {
+    const struct OpenrtlRewriteInst *it = rw->ptr + at;
+    if (it->inst.opcode != OPENRTL_OP_BRANCH || it->inserted) {
+        return 0;
+    }
+    size_t target;
+    if (it->target) {
+        target = it->operand;
+    } else if (it->symbol) {
+        const struct OpenrtlSymbol *sym = buf->linker.ptr + it->symbol - 1;
+        const struct OpenrtlEntry *ent = sym->type == OPENRTL_SYMBOL_LOCAL ? openrtl_table_find(&buf->local, sym->name) : NULL;
+        if (!ent || !ent->label) {
+            return 0;
+        }
+        target = ent->addr;
+    } else {
+        return 0;
+    }
+
+    // everything between the branch and its target is deleted
+    size_t next = at + 1;
+    while (next < rw->len && rw->ptr[next].dead) {
+        ++next;
+    }
+    return target > it->offset && (next == rw->len || target <= rw->ptr[next].offset);
+}
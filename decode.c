@@ -0,0 +1,95 @@
+#include <string.h>
+#include "include/openrtl.h"
+#include "internal.h"
+
+#define DEFAULT_INDEX_CAP 256
+
+size_t openrtl_inst_size(const OpenrtlInst *inst) {
+    return openrtl_inst_len(inst);
+}
+
+// decodes the instruction at `offset`, `operand` may be NULL. returns the
+// offset of the following instruction
+size_t openrtl_decode(const OpenrtlBuffer *buf, size_t offset, OpenrtlInst *inst, uint64_t *operand) {
+    const char *ptr = openrtl_buffer_span(buf, offset, NULL);
+    memcpy(inst, ptr, 4);
+    size_t len = openrtl_inst_len(inst);
+    if (operand) {
+        *operand = len > 4 ? openrtl_rel_read(inst, ptr + 4) : 0;
+    }
+    return offset + len;
+}
+
+void openrtl_iter(OpenrtlIter *it, const OpenrtlBuffer *buf) {
+    it->buf = buf;
+    it->offset = 0;
+    it->next = 0;
+    it->ptr = NULL;
+    it->avail = 0;
+    it->operand = 0;
+}
+
+// returns zero at the end of the buffer
+int openrtl_iter_next(OpenrtlIter *it) {
+    if (it->next >= it->buf->len) {
+        return 0;
+    }
+    // instructions never cross a segment, so spans are fetched only when
+    // the current one runs out
+    if (!it->avail) {
+        it->ptr = openrtl_buffer_span(it->buf, it->next, &it->avail);
+    }
+    memcpy(&it->inst, it->ptr, 4);
+    size_t len = openrtl_inst_len(&it->inst);
+    it->operand = len > 4 ? openrtl_rel_read(&it->inst, it->ptr + 4) : 0;
+    it->offset = it->next;
+    it->next += len;
+    it->ptr += len;
+    it->avail -= len;
+    return 1;
+}
+
+// indexes the instructions appended since the last call, an index is
+// dropped whenever the code of the buffer is rewritten
+int openrtl_build_index(OpenrtlBuffer *buf) {
+    struct OpenrtlIndex *index = &buf->index;
+    if (!index->cap) {
+        index->ptr = openrtl_malloc(buf->allocator, DEFAULT_INDEX_CAP * sizeof(size_t));
+        if (!index->ptr) {
+            return 1;
+        }
+        index->cap = DEFAULT_INDEX_CAP;
+        index->len = 0;
+        index->ptr[0] = 0;
+    }
+
+    OpenrtlIter it;
+    openrtl_iter(&it, buf);
+    it.next = index->ptr[index->len];
+    while (openrtl_iter_next(&it)) {
+        // keeps a slot for the end offset
+        if (index->len + 1 == index->cap) {
+            void *ptr = openrtl_realloc(buf->allocator, index->ptr, index->cap * sizeof(size_t), 2 * index->cap * sizeof(size_t));
+            if (!ptr) {
+                return 1;
+            }
+            index->ptr = ptr;
+            index->cap *= 2;
+        }
+        index->ptr[index->len++] = it.offset;
+        index->ptr[index->len] = it.next;
+    }
+    return 0;
+}
+
+size_t openrtl_inst_count(OpenrtlBuffer *buf) {
+    openrtl_build_index(buf);
+    return buf->index.len;
+}
+
+// offset of the `n`th instruction, `n` may be the count of instructions
+// for the end of the buffer
+size_t openrtl_inst_offset(OpenrtlBuffer *buf, size_t n) {
+    openrtl_build_index(buf);
+    return buf->index.ptr[n];
+}
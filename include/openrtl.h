@@ -10,24 +10,90 @@
 #define OPENRTL_X(n) (n & 0xff)
 #define OPENRTL_V(n) ((n << 2) & 0xff)
 
+typedef struct OpenrtlAllocator OpenrtlAllocator;
+typedef struct OpenrtlArena OpenrtlArena;
 typedef struct OpenrtlContext OpenrtlContext;
+typedef struct OpenrtlModule OpenrtlModule;
 typedef struct OpenrtlBuffer OpenrtlBuffer;
+typedef struct OpenrtlBufferPool OpenrtlBufferPool;
 typedef struct OpenrtlInst OpenrtlInst;
+typedef struct OpenrtlIter OpenrtlIter;
 typedef struct OpenrtlTable OpenrtlTable;
+typedef struct OpenrtlStrings OpenrtlStrings;
 typedef struct OpenrtlLinker OpenrtlLinker;
 typedef struct OpenrtlMatrix OpenrtlMatrix;
 typedef struct OpenrtlTypeInfo OpenrtlTypeInfo;
 typedef struct OpenrtlRegalloc OpenrtlRegalloc;
+typedef struct OpenrtlCache OpenrtlCache;
+typedef struct OpenrtlCfg OpenrtlCfg;
+typedef struct OpenrtlLiveness OpenrtlLiveness;
+
+// every allocation of an object goes through its allocator, or through
+// the system allocator when it is NULL. `realloc` receives the size the
+// block was allocated with
+struct OpenrtlAllocator {
+    void *(*alloc)(void *user, size_t size);
+    void *(*realloc)(void *user, void *ptr, size_t old, size_t size);
+    void (*free)(void *user, void *ptr);
+    void *user;
+};
+
+struct OpenrtlArenaBlock {
+    struct OpenrtlArenaBlock *next;
+    size_t cap;
+    size_t len;
+    char ptr[];
+};
+
+// bump allocator, `free` is a no-op and everything is released at once by
+// `openrtl_reset_arena` or `openrtl_del_arena`. the first block may be
+// supplied by the caller, further blocks come from `parent`, so a compile
+// that fits into it never reaches the system allocator
+struct OpenrtlArena {
+    OpenrtlAllocator allocator;
+    const OpenrtlAllocator *parent;
+    struct OpenrtlArenaBlock *block;
+    struct OpenrtlArenaBlock *first;
+    void *last;
+};
 
+struct OpenrtlChunk {
+    struct OpenrtlChunk *next;
+    size_t cap;
+    size_t len;
+    char ptr[];
+};
+
+// interned names, `index` is an open-addressing set of pointers into
+// the chunks, so equal names always compare equal as pointers
+struct OpenrtlStrings {
+    const OpenrtlAllocator *allocator;
+    size_t cap;
+    size_t len;
+    const char **index;
+    struct OpenrtlChunk *chunk;
+    // part of a mapped module, nothing can be interned
+    int mapped;
+};
+
+// `label` tells an entry of a local table whose `addr` is an offset into
+// its buffer, defined by `openrtl_label`, from one bound to an address
 struct OpenrtlEntry {
     const char *name;
     size_t addr;
+    int label;
 };
 
+// `index` is an open-addressing hash index over `ptr`, each slot holds
+// an entry index plus one or zero when empty. names are interned, so
+// they are hashed and compared as pointers
 struct OpenrtlTable {
+    const OpenrtlAllocator *allocator;
     size_t cap;
     size_t len;
     struct OpenrtlEntry *ptr;
+    size_t mask;
+    size_t *index;
 };
 
 enum {
@@ -35,8 +101,11 @@ enum {
     OPENRTL_SYMBOL_GLOBAL,
 };
 
+// `relative` symbols are patched with the displacement from the start
+// of their instruction instead of the address
 struct OpenrtlSymbol {
     int type;
+    int relative;
     const char *name;
     size_t offset;
     uint64_t mask;
@@ -49,11 +118,48 @@ struct OpenrtlLinker {
     struct OpenrtlSymbol *ptr;
 };
 
+// a symbol that refers to a global name, `next` is the index plus one
+// of the following site of the same name or zero at the end
+struct OpenrtlSite {
+    size_t buffer;
+    size_t symbol;
+    size_t next;
+};
+
+// reverse index from a global name to the sites that use it, `head`
+// maps a name to the index plus one of its first site
+struct OpenrtlSites {
+    size_t cap;
+    size_t len;
+    struct OpenrtlSite *ptr;
+    OpenrtlTable head;
+};
+
 struct OpenrtlContext {
+    const OpenrtlAllocator *allocator;
     size_t cap;
     size_t len;
     OpenrtlBuffer *ptr;
     OpenrtlTable global;
+    OpenrtlStrings strings;
+    struct OpenrtlSites sites;
+    // loaded by `openrtl_module_load`, read-only and not owned. every
+    // function that would change it fails, and its buffers must not be
+    // emitted into
+    int mapped;
+};
+
+#define OPENRTL_MODULE_VERSION 2
+
+enum {
+    // also write the matrix of every buffer
+    OPENRTL_MODULE_MATRIX = 1,
+};
+
+struct OpenrtlModule {
+    void *base;
+    size_t size;
+    OpenrtlContext *ctx;
 };
 
 enum {
@@ -67,42 +173,117 @@ enum {
     OPENRTL_MEMORY_INDIRECT,
 };
 
+union OpenrtlOperand {
+    uint64_t immediate;
+    struct {
+        uint8_t base;
+        int32_t offset;
+    } addr;
+    struct {
+        uint8_t base;
+        uint8_t offset;
+    } addri;
+    struct {
+        uint8_t reg;
+        uint8_t size;
+        uint8_t ext;
+    } general, floating, vector;
+};
+
 struct OpenrtlElement {
     size_t offset;
     int place;
     int value;
-    union {
-        uint64_t immediate;
-        struct {
-            uint8_t base;
-            int32_t offset;
-        } addr;
-        struct {
-            uint8_t base;
-            uint8_t offset;
-        } addri;
-        struct {
-            uint8_t reg;
-            uint8_t size;
-            uint8_t ext;
-        } general, floating, vector;
-    } v1, v2;
+    union OpenrtlOperand v1, v2;
 };
 
+// the elements of `struct OpenrtlElement` stored as one column per field,
+// in a single allocation that starts at `offset`. operands are packed
+// into 32 bits as their place or value uses them, one that does not fit
+// is kept in `wide` and its column holds its index with the top bit set.
+// offsets are 32 bits too, so only the first 4 GiB of a buffer can be
+// recorded. an element whose place is a register defines it, `prev` and
+// `next` chain the definitions of the same register and `last` holds the
+// latest one of every general, floating and vector register. the chains
+// are built by the first query and `prev` holds `next` after its `cap`
+// links. links are an element index plus one, or zero when there is none
 struct OpenrtlMatrix {
+    const OpenrtlAllocator *allocator;
     size_t cap;
     size_t len;
-    struct OpenrtlElement *ptr;
+    uint32_t *offset;
+    uint32_t *v1;
+    uint32_t *v2;
+    uint8_t *place;
+    uint8_t *value;
+    struct OpenrtlWide {
+        size_t cap;
+        size_t len;
+        union OpenrtlOperand *ptr;
+    } wide;
+    uint32_t *prev;
+    uint32_t *next;
+    uint32_t *last;
+};
+
+// a run of code starting at the logical `offset` of the buffer. an
+// instruction never crosses into the next segment, so the tail of a
+// segment may be left unused
+struct OpenrtlSegment {
+    size_t offset;
+    size_t cap;
+    char ptr[];
+};
+
+// `size` is zero for a contiguous buffer, otherwise code is appended to
+// segments of at least `size` bytes and `ptr` of the buffer is unused
+struct OpenrtlSegments {
+    size_t size;
+    size_t cap;
+    size_t len;
+    struct OpenrtlSegment **ptr;
+};
+
+// offsets of the instructions of a buffer, `ptr[len]` is the offset up
+// to which the buffer has been indexed
+struct OpenrtlIndex {
+    size_t cap;
+    size_t len;
+    size_t *ptr;
 };
 
 struct OpenrtlBuffer {
+    const OpenrtlAllocator *allocator;
     size_t params;
     size_t cap;
     size_t len;
     void *ptr;
+    struct OpenrtlSegments segments;
+    // built by `openrtl_inst_offset`, extended as code is appended
+    struct OpenrtlIndex index;
     OpenrtlMatrix matrix;
     OpenrtlLinker linker;
     OpenrtlTable local;
+    // names of a buffer that is not yet part of a context are interned
+    // into a set of its own, which is merged by `openrtl_add_buffer`
+    OpenrtlStrings *strings;
+    int own_strings;
+    // interned name the buffer was added to its context under
+    const char *name;
+    // encode branches and calls to local symbols relative to the
+    // instruction, see `OPENRTL_REL_PC`. literal operands stay absolute
+    int pcrel;
+    // append an element to `matrix` for every instruction that moves a
+    // value, see `openrtl_matrix_build` for buffers that do not
+    int record;
+};
+
+// released buffers, reset but still holding their allocations
+struct OpenrtlBufferPool {
+    const OpenrtlAllocator *allocator;
+    size_t cap;
+    size_t len;
+    OpenrtlBuffer *ptr;
 };
 
 enum {
@@ -117,6 +298,13 @@ enum {
     OPENRTL_FSIZE_64,
 };
 
+// `size` of a branch or call, a pc-relative operand is the signed
+// displacement of the target from the start of the instruction
+enum {
+    OPENRTL_REL_ABSOLUTE,
+    OPENRTL_REL_PC,
+};
+
 enum {
     OPENRTL_VSIZE_1,
     OPENRTL_VSIZE_2,
@@ -215,33 +403,80 @@ enum {
     // arith v
     OPENRTL_OP_VTRUNCATE,
 
+    // arith r, r, b
+    OPENRTL_OP_ISHIFT,
+    // arith r, r, b shifting `dest` in place by `src1`
+    OPENRTL_OP_ISHIFT_VARIABLE,
+    // arith r, r, b
+    OPENRTL_OP_IBITS,
+
     OPENRTL_OP_COUNT,
 };
 
+// `src2` of a shift. `OPENRTL_OP_ISHIFT` holds it in the top two bits
+// and the count in the rest, so rotating right by a constant is rotating
+// left by the rest of the width. counts wrap at the width of `size`
+enum {
+    OPENRTL_SHIFT_LEFT,
+    OPENRTL_SHIFT_RIGHT,
+    OPENRTL_SHIFT_RIGHT_SIGNED,
+    OPENRTL_ROTATE_LEFT,
+    OPENRTL_ROTATE_RIGHT,
+};
+
+// `src2` of `OPENRTL_OP_IBITS`, the counts of zero bits of zero are the
+// width of `size`
+enum {
+    OPENRTL_BITS_POPCOUNT,
+    OPENRTL_BITS_LEADING_ZEROS,
+    OPENRTL_BITS_TRAILING_ZEROS,
+    OPENRTL_BITS_SWAP,
+};
+
+// every form shares the leading opcode byte, so an instruction is
+// exactly 4 bytes wide
 struct OpenrtlInst {
-    unsigned int opcode : 6;
-    unsigned int size : 2;
     union {
         struct {
-            unsigned char dest;
-            unsigned char src1;
-            unsigned char src2;
+            unsigned int opcode : 6;
+            unsigned int size : 2;
+        };
+        struct {
+            unsigned int : 8;
+            unsigned int dest : 8;
+            unsigned int src1 : 8;
+            unsigned int src2 : 8;
         } arith;
         struct {
-            unsigned char dest;
-            unsigned char src;
-            unsigned char size;
+            unsigned int : 8;
+            unsigned int dest : 8;
+            unsigned int src : 8;
+            unsigned int size : 8;
         } arith_b;
         struct {
+            unsigned int : 8;
             unsigned int value : 24;
         } imm;
         struct {
-            unsigned char dest;
-            unsigned char len; // only 0, 1, 2, 4 or 8 permitted
+            unsigned int : 8;
+            unsigned int dest : 8;
+            unsigned int len : 8; // only 0, 1, 2, 4 or 8 permitted
         } rel;
     };
 };
 
+// walks the instructions of a buffer, `offset` and `operand` belong to
+// the instruction last returned by `openrtl_iter_next`
+struct OpenrtlIter {
+    const OpenrtlBuffer *buf;
+    size_t offset;
+    size_t next;
+    const char *ptr;
+    size_t avail;
+    OpenrtlInst inst;
+    uint64_t operand;
+};
+
 struct OpenrtlTypeInfo {
     size_t size;
     size_t align;
@@ -298,13 +533,19 @@ struct OpenrtlRegEntry {
 };
 
 struct OpenrtlRegisterTable {
+    const OpenrtlAllocator *allocator;
     size_t len;
     size_t cap;
     struct OpenrtlRegEntry *entries;
 };
 
+// an interval with lifetime holes lists the `nranges` ranges it is live
+// in from `ranges` on in the ranges of the allocator, otherwise it is
+// live from `start` to `end`. `file` is the register file of the value,
+// only intervals of the same file share a register through a hole
 struct OpenrtlInterval {
     uint64_t name;
+    int file;
     OpenrtlTypeInfo ti;
     struct OpenrtlPurpose purpose;
     OpenrtlLifetime start;
@@ -313,6 +554,19 @@ struct OpenrtlInterval {
     int reserved;
     uint32_t reg;
     int size;
+    size_t ranges;
+    size_t nranges;
+};
+
+struct OpenrtlRange {
+    OpenrtlLifetime start;
+    OpenrtlLifetime end;
+};
+
+struct OpenrtlRanges {
+    size_t len;
+    size_t cap;
+    struct OpenrtlRange *ranges;
 };
 
 struct OpenrtlPool {
@@ -339,33 +593,213 @@ struct OpenrtlActives {
 };
 
 struct OpenrtlRegalloc {
+    const OpenrtlAllocator *allocator;
     uint64_t counter;
     struct OpenrtlPool registers;
     struct OpenrtlPool parameters;
     struct OpenrtlIntervals live;
     struct OpenrtlIntervals stack;
     struct OpenrtlActives active;
-    int64_t variables[256];
+    struct OpenrtlRanges ranges;
+    // interval of the current definition of every register, indexed by
+    // its file times 256 plus its number
+    int64_t variables[3 * 256];
     uint64_t offset;
 };
 
+// bumped whenever what is cached for the same key changes, 2 has one
+// register table entry per live range
+#define OPENRTL_CACHE_VERSION 3
+
+// 128-bit hash of the code of a buffer and anything else its results
+// depend on
+struct OpenrtlCacheKey {
+    uint64_t lo;
+    uint64_t hi;
+};
+
+// the register table of a buffer and an optional artifact of `size`
+// bytes produced from it, both owned by the cache
+struct OpenrtlCacheEntry {
+    struct OpenrtlCacheKey key;
+    struct OpenrtlRegisterTable table;
+    void *artifact;
+    size_t size;
+};
+
+// `index` is an open-addressing index over `ptr` with twice its capacity
+struct OpenrtlCache {
+    const OpenrtlAllocator *allocator;
+    const char *dir;
+    size_t cap;
+    size_t len;
+    struct OpenrtlCacheEntry *ptr;
+    size_t *index;
+};
+
+// instructions `first` to `last` of the buffer, at byte offsets `start`
+// to `end`. `pred` is where the predecessors of the block begin in the
+// preds of the graph, `exit` tells whether control may leave the buffer
+// from it. `idom` and `loop` are indices plus one, zero for the entry,
+// for a block out of every loop and for unreachable blocks
+struct OpenrtlBlock {
+    size_t start;
+    size_t end;
+    size_t first;
+    size_t last;
+    size_t succ[2];
+    size_t nsucc;
+    size_t pred;
+    size_t npred;
+    int exit;
+    size_t idom;
+    // position in reverse postorder, the number of blocks when
+    // unreachable
+    size_t rpo;
+    size_t loop;
+};
+
+// `parent` is the index plus one of the enclosing loop, `len` counts
+// the blocks of the loop including those of nested loops
+struct OpenrtlLoop {
+    size_t header;
+    size_t parent;
+    size_t depth;
+    size_t len;
+};
+
+struct OpenrtlLoops {
+    size_t cap;
+    size_t len;
+    struct OpenrtlLoop *ptr;
+};
+
+// register files, `r`, `x` and `v`. registers of different files with
+// the same number are unrelated
+enum {
+    OPENRTL_FILE_GP,
+    OPENRTL_FILE_FP,
+    OPENRTL_FILE_V,
+};
+
+// one bit for every register of every file
+struct OpenrtlRegSet {
+    uint64_t bits[12];
+};
+
+// registers live on entry to and on exit from every block of a graph
+struct OpenrtlLiveness {
+    const OpenrtlAllocator *allocator;
+    size_t len;
+    struct OpenrtlRegSet *in;
+    struct OpenrtlRegSet *out;
+};
+
+// `order` lists the `reachable` blocks in reverse postorder
+struct OpenrtlCfg {
+    const OpenrtlAllocator *allocator;
+    size_t len;
+    struct OpenrtlBlock *blocks;
+    size_t *preds;
+    size_t reachable;
+    size_t *order;
+    struct OpenrtlLoops loops;
+};
+
+void openrtl_arena(OpenrtlArena *arena, const OpenrtlAllocator *parent, void *ptr, size_t len);
+void openrtl_del_arena(OpenrtlArena *arena);
+void openrtl_reset_arena(OpenrtlArena *arena);
+
 void openrtl_context(OpenrtlContext *ctx);
+void openrtl_context_with(OpenrtlContext *ctx, const OpenrtlAllocator *allocator);
 void openrtl_del_context(OpenrtlContext *ctx);
-void openrtl_add_buffer(OpenrtlContext *ctx, const char *name, OpenrtlBuffer *buf);
-void openrtl_global(OpenrtlContext *ctx, const char *name, uint64_t addr);
-void openrtl_link(OpenrtlContext *ctx);
+int openrtl_add_buffer(OpenrtlContext *ctx, const char *name, OpenrtlBuffer *buf);
+int openrtl_global(OpenrtlContext *ctx, const char *name, uint64_t addr);
+int openrtl_link(OpenrtlContext *ctx);
+int openrtl_link_parallel(OpenrtlContext *ctx, size_t nthreads);
+int openrtl_relink(OpenrtlContext *ctx, const char *name);
+int openrtl_fold_identical(OpenrtlContext *ctx);
+int openrtl_relax(OpenrtlContext *ctx);
+int openrtl_relax_buffer(OpenrtlContext *ctx, OpenrtlBuffer *buf);
+
+int openrtl_module_save(const OpenrtlContext *ctx, const char *path, int flags);
+int openrtl_module_load(OpenrtlModule *mod, const char *path);
+void openrtl_module_close(OpenrtlModule *mod);
+
+void openrtl_strings(OpenrtlStrings *strings, const OpenrtlAllocator *allocator);
+void openrtl_del_strings(OpenrtlStrings *strings);
+const char *openrtl_intern(OpenrtlStrings *strings, const char *name);
+
+void openrtl_table(OpenrtlTable *table, const OpenrtlAllocator *allocator, size_t cap);
+void openrtl_del_table(OpenrtlTable *table);
 
 void openrtl_buffer(OpenrtlBuffer *buf);
+void openrtl_buffer_with(OpenrtlBuffer *buf, const OpenrtlAllocator *allocator);
+void openrtl_context_buffer(OpenrtlContext *ctx, OpenrtlBuffer *buf);
+int openrtl_buffer_reserve(OpenrtlBuffer *buf, size_t len);
+int openrtl_buffer_segmented(OpenrtlBuffer *buf, size_t size);
+int openrtl_coalesce(OpenrtlBuffer *buf);
+void *openrtl_buffer_span(const OpenrtlBuffer *buf, size_t offset, size_t *len);
+int openrtl_emit_batch(OpenrtlBuffer *buf, const OpenrtlInst *insts, const uint64_t *operands, size_t n);
 void openrtl_del_buffer(OpenrtlBuffer *buf);
+void openrtl_reset_buffer(OpenrtlBuffer *buf);
+void openrtl_buffer_pool(OpenrtlBufferPool *pool);
+void openrtl_buffer_pool_with(OpenrtlBufferPool *pool, const OpenrtlAllocator *allocator);
+void openrtl_del_buffer_pool(OpenrtlBufferPool *pool);
+void openrtl_acquire_buffer(OpenrtlBufferPool *pool, OpenrtlBuffer *buf);
+void openrtl_release_buffer(OpenrtlBufferPool *pool, OpenrtlBuffer *buf);
+size_t openrtl_inst_size(const OpenrtlInst *inst);
+size_t openrtl_decode(const OpenrtlBuffer *buf, size_t offset, OpenrtlInst *inst, uint64_t *operand);
+void openrtl_iter(OpenrtlIter *it, const OpenrtlBuffer *buf);
+int openrtl_iter_next(OpenrtlIter *it);
+int openrtl_build_index(OpenrtlBuffer *buf);
+size_t openrtl_inst_count(OpenrtlBuffer *buf);
+size_t openrtl_inst_offset(OpenrtlBuffer *buf, size_t n);
+void openrtl_matrix(OpenrtlMatrix *matrix, const OpenrtlAllocator *allocator);
+void openrtl_del_matrix(OpenrtlMatrix *matrix);
+void openrtl_reset_matrix(OpenrtlMatrix *matrix);
+int openrtl_matrix_reserve(OpenrtlMatrix *matrix, size_t len);
+int openrtl_matrix_append(OpenrtlMatrix *matrix, const struct OpenrtlElement *elem);
+int openrtl_matrix_build(OpenrtlBuffer *buf);
+void openrtl_matrix_get(const OpenrtlMatrix *matrix, size_t i, struct OpenrtlElement *elem);
+size_t openrtl_matrix_last_def(OpenrtlMatrix *matrix, int place, uint8_t reg);
+size_t openrtl_matrix_prev_def(OpenrtlMatrix *matrix, size_t i);
+size_t openrtl_matrix_next_def(OpenrtlMatrix *matrix, size_t i);
+int openrtl_cfg(OpenrtlCfg *cfg, OpenrtlBuffer *buf);
+void openrtl_del_cfg(OpenrtlCfg *cfg);
+size_t openrtl_cfg_block(const OpenrtlCfg *cfg, size_t offset);
+int openrtl_cfg_dominates(const OpenrtlCfg *cfg, size_t a, size_t b);
+int openrtl_liveness(OpenrtlLiveness *live, const OpenrtlCfg *cfg, const OpenrtlBuffer *buf);
+void openrtl_del_liveness(OpenrtlLiveness *live);
+int openrtl_regset_has(const struct OpenrtlRegSet *set, int file, uint8_t reg);
+int openrtl_peephole(OpenrtlBuffer *buf);
+int openrtl_fold_constants(OpenrtlBuffer *buf);
+int openrtl_eliminate_dead(OpenrtlBuffer *buf);
+int openrtl_number_values(OpenrtlBuffer *buf);
+int openrtl_hoist_invariants(OpenrtlBuffer *buf);
+int openrtl_reduce_strength(OpenrtlBuffer *buf);
 void openrtl_local(OpenrtlBuffer *ctx, const char *name, uint64_t addr);
+void openrtl_label(OpenrtlBuffer *buf, const char *name);
 void openrtl_symbol(OpenrtlBuffer *ctx, int type, const char *name);
 
+void openrtl_cache_key_init(struct OpenrtlCacheKey *key);
+void openrtl_cache_key_update(struct OpenrtlCacheKey *key, const void *ptr, size_t len);
+void openrtl_cache_key(const OpenrtlBuffer *buf, struct OpenrtlCacheKey *key);
+int openrtl_cache(OpenrtlCache *cache, const OpenrtlAllocator *allocator, const char *dir);
+void openrtl_del_cache(OpenrtlCache *cache);
+const struct OpenrtlCacheEntry *openrtl_cache_find(OpenrtlCache *cache, const struct OpenrtlCacheKey *key);
+int openrtl_cache_insert(OpenrtlCache *cache, const struct OpenrtlCacheKey *key, const struct OpenrtlRegisterTable *table, const void *artifact, size_t size);
+int openrtl_alloc_cached(OpenrtlCache *cache, OpenrtlRegalloc *alloc, OpenrtlContext *ctx, OpenrtlBuffer *buf, struct OpenrtlRegisterTable *dest);
+
 void openrtl_alloc_linscan(OpenrtlRegalloc *alloc, size_t regc, size_t paramc, struct OpenrtlGmReg *params);
+void openrtl_alloc_linscan_with(OpenrtlRegalloc *alloc, const OpenrtlAllocator *allocator, size_t regc, size_t paramc, struct OpenrtlGmReg *params);
+void openrtl_del_alloc(OpenrtlRegalloc *alloc);
 void openrtl_alloc_add(OpenrtlRegalloc *alloc, struct OpenrtlInterval *interval);
 void openrtl_alloc_param(OpenrtlRegalloc *alloc, struct OpenrtlInterval *interval, uint32_t param);
 int openrtl_alloc_allocate(OpenrtlRegalloc *alloc);
 void openrtl_alloc_find(OpenrtlRegalloc *alloc, OpenrtlContext *ctx, OpenrtlBuffer *buf);
-void openrtl_alloc_regtable(struct OpenrtlRegisterTable *dest, OpenrtlRegalloc *alloc);
+int openrtl_alloc_regtable(struct OpenrtlRegisterTable *dest, OpenrtlRegalloc *alloc);
+void openrtl_del_regtable(struct OpenrtlRegisterTable *table);
 
 int openrtl_return(OpenrtlBuffer *buf);
 int openrtl_enter(OpenrtlBuffer *buf, uint32_t imm);
@@ -402,6 +836,16 @@ int openrtl_iload(OpenrtlBuffer *buf, uint8_t size, uint8_t dest, uint8_t src1,
 int openrtl_istore(OpenrtlBuffer *buf, uint8_t size, uint8_t dest, uint8_t src1, uint8_t src2);
 int openrtl_ipop(OpenrtlBuffer *buf, uint8_t dest);
 int openrtl_ipush(OpenrtlBuffer *buf, uint8_t src);
+int openrtl_ishift_left(OpenrtlBuffer *buf, uint8_t size, uint8_t dest, uint8_t src, uint8_t count);
+int openrtl_ishift_right(OpenrtlBuffer *buf, uint8_t size, uint8_t dest, uint8_t src, uint8_t count);
+int openrtl_ishift_right_signed(OpenrtlBuffer *buf, uint8_t size, uint8_t dest, uint8_t src, uint8_t count);
+int openrtl_irotate_left(OpenrtlBuffer *buf, uint8_t size, uint8_t dest, uint8_t src, uint8_t count);
+int openrtl_irotate_right(OpenrtlBuffer *buf, uint8_t size, uint8_t dest, uint8_t src, uint8_t count);
+int openrtl_ishift_variable(OpenrtlBuffer *buf, uint8_t size, uint8_t dest, uint8_t src, uint8_t kind);
+int openrtl_ipopcount(OpenrtlBuffer *buf, uint8_t size, uint8_t dest, uint8_t src);
+int openrtl_ileading_zeros(OpenrtlBuffer *buf, uint8_t size, uint8_t dest, uint8_t src);
+int openrtl_itrailing_zeros(OpenrtlBuffer *buf, uint8_t size, uint8_t dest, uint8_t src);
+int openrtl_ibyte_swap(OpenrtlBuffer *buf, uint8_t size, uint8_t dest, uint8_t src);
 
 int openrtl_fadd(OpenrtlBuffer *buf, uint8_t size, uint8_t dest, uint8_t src1, uint8_t src2);
 int openrtl_fsubtract(OpenrtlBuffer *buf, uint8_t size, uint8_t dest, uint8_t src1, uint8_t src2);
@@ -0,0 +1,440 @@
+#ifndef OPENRTL_INTERNAL_H
+#define OPENRTL_INTERNAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "include/openrtl.h"
+
+static inline void *openrtl_malloc(const OpenrtlAllocator *allocator, size_t size) {
+    return allocator ? allocator->alloc(allocator->user, size) : malloc(size);
+}
+
+static inline void *openrtl_calloc(const OpenrtlAllocator *allocator, size_t n, size_t size) {
+    if (!allocator) {
+        return calloc(n, size);
+    }
+    void *ptr = allocator->alloc(allocator->user, n * size);
+    if (ptr) {
+        memset(ptr, 0, n * size);
+    }
+    return ptr;
+}
+
+static inline void *openrtl_realloc(const OpenrtlAllocator *allocator, void *ptr, size_t old, size_t size) {
+    return allocator ? allocator->realloc(allocator->user, ptr, old, size) : realloc(ptr, size);
+}
+
+static inline void openrtl_free(const OpenrtlAllocator *allocator, void *ptr) {
+    if (allocator) {
+        allocator->free(allocator->user, ptr);
+    } else {
+        free(ptr);
+    }
+}
+
+// interned names are only ever compared by address
+static inline size_t openrtl_hash_name(const char *name) {
+    uint64_t hash = (uintptr_t) name;
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccd;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+// `name` must have been interned into the strings the table's names
+// come from, lookups compare addresses and never the characters
+struct OpenrtlEntry *openrtl_table_insert(OpenrtlTable *table, const char *name, uint64_t addr);
+struct OpenrtlEntry *openrtl_table_find(const OpenrtlTable *table, const char *name);
+
+// inserts every entry into the cleared index of `table`
+static inline void openrtl_table_fill(OpenrtlTable *table) {
+    for (size_t i = 0; i < table->len; i++) {
+        size_t slot = openrtl_hash_name(table->ptr[i].name) & table->mask;
+        while (table->index[slot]) {
+            slot = (slot + 1) & table->mask;
+        }
+        table->index[slot] = i + 1;
+    }
+}
+
+// where the next instruction is written, `openrtl_buffer_reserve` makes
+// sure there is room for it
+static inline char *openrtl_buffer_end(OpenrtlBuffer *buf) {
+    if (buf->segments.len) {
+        struct OpenrtlSegment *tail = buf->segments.ptr[buf->segments.len - 1];
+        return tail->ptr + (buf->len - tail->offset);
+    }
+    return (char *) buf->ptr + buf->len;
+}
+
+// forgets the instruction index after the code has been rewritten
+static inline void openrtl_drop_index(OpenrtlBuffer *buf) {
+    buf->index.len = 0;
+    if (buf->index.cap) {
+        buf->index.ptr[0] = 0;
+    }
+}
+
+// smallest operand that holds `value`, see `struct OpenrtlInst`
+static inline size_t openrtl_rel_len(uint64_t value) {
+    if (value == 0) {
+        return 0;
+    } else if (value <= 0xff) {
+        return 1;
+    } else if (value <= 0xffff) {
+        return 2;
+    } else if (value <= 0xffffffff) {
+        return 4;
+    } else {
+        return 8;
+    }
+}
+
+// masks `rel.len` of the opcodes that are followed by an operand, one
+// entry for every value the opcode field can hold
+static const uint8_t openrtl_operand_mask[64] = {
+    [OPENRTL_OP_CALL] = 0xff,
+    [OPENRTL_OP_CALL_INDIRECT] = 0xff,
+    [OPENRTL_OP_BRANCH] = 0xff,
+    [OPENRTL_OP_BRANCH_CARRY] = 0xff,
+    [OPENRTL_OP_BRANCH_OVERFLOW] = 0xff,
+    [OPENRTL_OP_BRANCH_EQUAL] = 0xff,
+    [OPENRTL_OP_BRANCH_NOT_EQUAL] = 0xff,
+    [OPENRTL_OP_BRANCH_LESS] = 0xff,
+    [OPENRTL_OP_BRANCH_LESS_EQ] = 0xff,
+    [OPENRTL_OP_BRANCH_GREATER] = 0xff,
+    [OPENRTL_OP_BRANCH_GREATER_EQ] = 0xff,
+    [OPENRTL_OP_IMOVE_IMMEDIATE] = 0xff,
+};
+
+// opcodes that are followed by a `rel.len` byte operand
+static inline int openrtl_is_rel(unsigned int opcode) {
+    return openrtl_operand_mask[opcode & 63] != 0;
+}
+
+// bytes taken by `inst` and its operand
+static inline size_t openrtl_inst_len(const OpenrtlInst *inst) {
+    return 4 + (inst->rel.len & openrtl_operand_mask[inst->opcode]);
+}
+
+// opcodes whose operand is an offset into the same buffer
+static inline int openrtl_is_branch(unsigned int opcode) {
+    return opcode >= OPENRTL_OP_BRANCH && opcode <= OPENRTL_OP_BRANCH_GREATER_EQ;
+}
+
+// branches and calls may carry a pc-relative operand
+static inline int openrtl_is_jump(unsigned int opcode) {
+    return opcode == OPENRTL_OP_CALL || openrtl_is_branch(opcode);
+}
+
+// opcodes that set the flags conditional branches test
+static inline int openrtl_sets_flags(unsigned int opcode) {
+    return (opcode >= OPENRTL_OP_IADD && opcode <= OPENRTL_OP_IMODULO_SIGNED) || (opcode >= OPENRTL_OP_FADD && opcode <= OPENRTL_OP_FDIVIDE);
+}
+
+static inline int openrtl_is_pcrel(const OpenrtlInst *inst) {
+    return openrtl_is_jump(inst->opcode) && inst->size == OPENRTL_REL_PC;
+}
+
+// smallest operand that holds the signed displacement `value`
+static inline size_t openrtl_rel_slen(uint64_t value) {
+    int64_t disp = (int64_t) value;
+    if (disp == 0) {
+        return 0;
+    } else if (disp >= INT8_MIN && disp <= INT8_MAX) {
+        return 1;
+    } else if (disp >= INT16_MIN && disp <= INT16_MAX) {
+        return 2;
+    } else if (disp >= INT32_MIN && disp <= INT32_MAX) {
+        return 4;
+    } else {
+        return 8;
+    }
+}
+
+static inline size_t openrtl_inst_rel_len(const OpenrtlInst *inst, uint64_t value) {
+    return openrtl_is_pcrel(inst) ? openrtl_rel_slen(value) : openrtl_rel_len(value);
+}
+
+static inline uint64_t openrtl_rel_mask(size_t len) {
+    return len >= 8 ? 0xffffffffffffffff : ((uint64_t) 1 << (8 * len)) - 1;
+}
+
+static inline size_t openrtl_mask_len(uint64_t mask) {
+    size_t len = 0;
+    while (len < 8 && (mask >> (8 * len))) {
+        ++len;
+    }
+    return len;
+}
+
+// reads the operand that follows `inst`, sign extending displacements
+static inline uint64_t openrtl_rel_read(const OpenrtlInst *inst, const void *ptr) {
+    uint64_t value = 0;
+    size_t len = inst->rel.len;
+    memcpy(&value, ptr, len);
+    if (openrtl_is_pcrel(inst) && len && len < 8 && (value >> (8 * len - 1)) & 1) {
+        value |= ~openrtl_rel_mask(len);
+    }
+    return value;
+}
+
+// registers of every file side by side, the index of a register into
+// sets and arrays that cover them all
+#define OPENRTL_REG_SLOTS (3 * 256)
+#define OPENRTL_REGSET_WORDS (OPENRTL_REG_SLOTS / 64)
+
+static inline size_t openrtl_reg_slot(int file, uint8_t reg) {
+    return (size_t) file * 256 + reg;
+}
+
+static inline void openrtl_regset_add(struct OpenrtlRegSet *set, int file, uint8_t reg) {
+    size_t slot = openrtl_reg_slot(file, reg);
+    set->bits[slot >> 6] |= (uint64_t) 1 << (slot & 63);
+}
+
+static inline void openrtl_regset_del(struct OpenrtlRegSet *set, int file, uint8_t reg) {
+    size_t slot = openrtl_reg_slot(file, reg);
+    set->bits[slot >> 6] &= ~((uint64_t) 1 << (slot & 63));
+}
+
+// files of the `dest`, `src1` and `src2` registers of an opcode, fields
+// that hold no register are given `OPENRTL_FILE_GP`
+static inline void openrtl_inst_files(unsigned int opcode, uint8_t *files) {
+    files[0] = OPENRTL_FILE_GP;
+    files[1] = OPENRTL_FILE_GP;
+    files[2] = OPENRTL_FILE_GP;
+    switch (opcode) {
+    case OPENRTL_OP_FADD:
+    case OPENRTL_OP_FSUBTRACT:
+    case OPENRTL_OP_FCOMPARE:
+    case OPENRTL_OP_FMULTIPLY:
+    case OPENRTL_OP_FDIVIDE:
+    case OPENRTL_OP_FMOVE:
+    case OPENRTL_OP_FPOP:
+    case OPENRTL_OP_FPUSH:
+    case OPENRTL_OP_EXTEND:
+        files[0] = OPENRTL_FILE_FP;
+        files[1] = OPENRTL_FILE_FP;
+        files[2] = OPENRTL_FILE_FP;
+        break;
+    case OPENRTL_OP_FLOAD:
+    case OPENRTL_OP_FSTORE:
+    case OPENRTL_OP_I2F:
+    case OPENRTL_OP_BITS2F:
+        files[0] = OPENRTL_FILE_FP;
+        break;
+    case OPENRTL_OP_F2I:
+    case OPENRTL_OP_F2BITS:
+        files[1] = OPENRTL_FILE_FP;
+        break;
+    case OPENRTL_OP_VADD:
+    case OPENRTL_OP_VSUBTRACT:
+    case OPENRTL_OP_VMULTIPLYF:
+    case OPENRTL_OP_VDIVIDEF:
+    case OPENRTL_OP_VMULTIPLY:
+    case OPENRTL_OP_VDIVIDE:
+    case OPENRTL_OP_VDOT:
+    case OPENRTL_OP_VCROSS:
+    case OPENRTL_OP_VTRUNCATE:
+        files[0] = OPENRTL_FILE_V;
+        files[1] = OPENRTL_FILE_V;
+        files[2] = OPENRTL_FILE_V;
+        break;
+    case OPENRTL_OP_VLOAD:
+    case OPENRTL_OP_VSTORE:
+        files[0] = OPENRTL_FILE_V;
+        break;
+    case OPENRTL_OP_VEXTEND:
+        files[0] = OPENRTL_FILE_V;
+        files[1] = OPENRTL_FILE_FP;
+        break;
+    default:
+        break;
+    }
+}
+
+// registers an instruction reads and the one it writes, if any, each
+// with its file
+struct OpenrtlInstRegs {
+    uint8_t use[3];
+    uint8_t use_file[3];
+    uint8_t nuse;
+    uint8_t def;
+    uint8_t def_file;
+    uint8_t ndef;
+};
+
+static inline void openrtl_inst_use(struct OpenrtlInstRegs *regs, uint8_t reg, uint8_t file) {
+    regs->use[regs->nuse] = reg;
+    regs->use_file[regs->nuse++] = file;
+}
+
+static inline void openrtl_inst_def(struct OpenrtlInstRegs *regs, uint8_t reg, uint8_t file) {
+    regs->def = reg;
+    regs->def_file = file;
+    regs->ndef = 1;
+}
+
+// stores, pushes and indirect calls read their `dest`, extensions,
+// truncations and variable shifts rewrite it in place
+static inline void openrtl_inst_regs(const OpenrtlInst *inst, struct OpenrtlInstRegs *regs) {
+    uint8_t files[3];
+    openrtl_inst_files(inst->opcode, files);
+    regs->nuse = 0;
+    regs->ndef = 0;
+    switch (inst->opcode) {
+    case OPENRTL_OP_CALL_INDIRECT:
+    case OPENRTL_OP_IPUSH:
+    case OPENRTL_OP_FPUSH:
+        openrtl_inst_use(regs, inst->arith.dest, files[0]);
+        break;
+    case OPENRTL_OP_IMOVE_IMMEDIATE:
+    case OPENRTL_OP_IPOP:
+    case OPENRTL_OP_FPOP:
+        openrtl_inst_def(regs, inst->arith.dest, files[0]);
+        break;
+    case OPENRTL_OP_EXTEND:
+    case OPENRTL_OP_VTRUNCATE:
+        openrtl_inst_use(regs, inst->arith.dest, files[0]);
+        openrtl_inst_def(regs, inst->arith.dest, files[0]);
+        break;
+    case OPENRTL_OP_IMOVE_UNSIGNED:
+    case OPENRTL_OP_IMOVE_SIGNED:
+    case OPENRTL_OP_FMOVE:
+    case OPENRTL_OP_F2I:
+    case OPENRTL_OP_I2F:
+    case OPENRTL_OP_F2BITS:
+    case OPENRTL_OP_BITS2F:
+    case OPENRTL_OP_VEXTEND:
+    case OPENRTL_OP_ISHIFT:
+    case OPENRTL_OP_IBITS:
+        openrtl_inst_use(regs, inst->arith.src1, files[1]);
+        openrtl_inst_def(regs, inst->arith.dest, files[0]);
+        break;
+    case OPENRTL_OP_ISHIFT_VARIABLE:
+        openrtl_inst_use(regs, inst->arith.dest, files[0]);
+        openrtl_inst_use(regs, inst->arith.src1, files[1]);
+        openrtl_inst_def(regs, inst->arith.dest, files[0]);
+        break;
+    case OPENRTL_OP_ISTORE:
+    case OPENRTL_OP_FSTORE:
+    case OPENRTL_OP_VSTORE:
+        openrtl_inst_use(regs, inst->arith.dest, files[0]);
+        openrtl_inst_use(regs, inst->arith.src1, files[1]);
+        openrtl_inst_use(regs, inst->arith.src2, files[2]);
+        break;
+    case OPENRTL_OP_IADD:
+    case OPENRTL_OP_IADD_CARRY:
+    case OPENRTL_OP_IAND:
+    case OPENRTL_OP_IOR:
+    case OPENRTL_OP_IXOR:
+    case OPENRTL_OP_ISUBTRACT:
+    case OPENRTL_OP_ICOMPARE:
+    case OPENRTL_OP_IMULTIPLY_UNSIGNED:
+    case OPENRTL_OP_IMULTIPLY_SIGNED:
+    case OPENRTL_OP_IDIVIDE_UNSIGNED:
+    case OPENRTL_OP_IDIVIDE_SIGNED:
+    case OPENRTL_OP_IMODULO_UNSIGNED:
+    case OPENRTL_OP_IMODULO_SIGNED:
+    case OPENRTL_OP_ILOAD:
+    case OPENRTL_OP_FADD:
+    case OPENRTL_OP_FSUBTRACT:
+    case OPENRTL_OP_FCOMPARE:
+    case OPENRTL_OP_FMULTIPLY:
+    case OPENRTL_OP_FDIVIDE:
+    case OPENRTL_OP_FLOAD:
+    case OPENRTL_OP_VADD:
+    case OPENRTL_OP_VSUBTRACT:
+    case OPENRTL_OP_VMULTIPLYF:
+    case OPENRTL_OP_VDIVIDEF:
+    case OPENRTL_OP_VMULTIPLY:
+    case OPENRTL_OP_VDIVIDE:
+    case OPENRTL_OP_VDOT:
+    case OPENRTL_OP_VCROSS:
+    case OPENRTL_OP_VLOAD:
+        openrtl_inst_use(regs, inst->arith.src1, files[1]);
+        openrtl_inst_use(regs, inst->arith.src2, files[2]);
+        openrtl_inst_def(regs, inst->arith.dest, files[0]);
+        break;
+    default:
+        break;
+    }
+}
+
+// an instruction being edited by a pass, see `openrtl_rewrite`. `at` is
+// where it is placed when the edits are committed
+struct OpenrtlRewriteInst {
+    size_t offset;
+    size_t at;
+    OpenrtlInst inst;
+    uint64_t operand;
+    // index + 1 of the symbol patched into the operand
+    size_t symbol;
+    // the operand is the offset of a branch target in the buffer
+    int target;
+    int dead;
+    int inserted;
+};
+
+struct OpenrtlRewrite {
+    const OpenrtlAllocator *allocator;
+    size_t cap;
+    size_t len;
+    struct OpenrtlRewriteInst *ptr;
+    size_t end;
+};
+
+int openrtl_rewrite(struct OpenrtlRewrite *rw, OpenrtlBuffer *buf);
+void openrtl_del_rewrite(struct OpenrtlRewrite *rw);
+uint8_t *openrtl_rewrite_leaders(const struct OpenrtlRewrite *rw, const OpenrtlBuffer *buf);
+uint8_t *openrtl_rewrite_entries(const struct OpenrtlRewrite *rw, const OpenrtlBuffer *buf);
+int openrtl_rewrite_flags(const struct OpenrtlRewrite *rw, size_t at);
+int openrtl_rewrite_insert(struct OpenrtlRewrite *rw, size_t at, const OpenrtlInst *inst, uint64_t operand);
+int openrtl_rewrite_commit(struct OpenrtlRewrite *rw, OpenrtlBuffer *buf);
+
+// what is known of every general purpose register, `known` is zero for
+// a register whose value is unknown and its size plus one otherwise.
+// only the low bytes of that size are known
+struct OpenrtlConsts {
+    uint64_t value[256];
+    uint8_t known[256];
+};
+
+// operands of the last compare when both were known
+struct OpenrtlConstFlags {
+    int known;
+    uint8_t size;
+    uint64_t a;
+    uint64_t b;
+};
+
+static inline uint64_t openrtl_const_mask(unsigned int size) {
+    return openrtl_rel_mask((size_t) 1 << size);
+}
+
+static inline int64_t openrtl_const_signed(uint64_t value, unsigned int size) {
+    unsigned int bits = 8u << size;
+    return bits == 64 ? (int64_t) value : (int64_t) (value << (64 - bits)) >> (64 - bits);
+}
+
+void openrtl_matrix_links(const OpenrtlMatrix *matrix, size_t from, uint32_t *prev, uint32_t *next, uint32_t *last);
+
+// whether `buf` may move an immediate into a register. the matrix
+// records every one that is, so without one nothing is ever known
+static inline int openrtl_const_moved(const OpenrtlBuffer *buf) {
+    for (size_t i = 0; i < buf->matrix.len; i++) {
+        if (buf->matrix.value[i] == OPENRTL_IMMEDIATE) {
+            return 1;
+        }
+    }
+    return !buf->matrix.len;
+}
+
+void openrtl_const_flow(const struct OpenrtlRewrite *rw, const OpenrtlCfg *cfg, const uint8_t *entry, struct OpenrtlConsts *out, uint8_t *seen, struct OpenrtlConsts *state);
+void openrtl_const_entry(const OpenrtlCfg *cfg, const struct OpenrtlConsts *out, const uint8_t *seen, const uint8_t *entry, size_t b, struct OpenrtlConsts *state);
+int openrtl_const_step(struct OpenrtlConsts *state, struct OpenrtlConstFlags *flags, const struct OpenrtlRewriteInst *it, uint64_t *result);
+
+#endif /* OPENRTL_INTERNAL_H */
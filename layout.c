@@ -0,0 +1,224 @@
+#include <stdlib.h>
+#include <string.h>
+#include "include/openrtl.h"
+#include "internal.h"
+
+enum {
+    // operand does not depend on the layout
+    OPENRTL_LAYOUT_FIXED,
+    // operand is an offset into the buffer
+    OPENRTL_LAYOUT_LABEL,
+    // operand is patched by the linker with a value not yet known
+    OPENRTL_LAYOUT_UNKNOWN,
+};
+
+struct OpenrtlLayoutInst {
+    size_t offset;
+    size_t target;
+    OpenrtlInst inst;
+    uint64_t value;
+    size_t symbol;
+    int kind;
+};
+
+static size_t openrtl_layout_map(struct OpenrtlLayoutInst *insts, size_t len, size_t end, size_t offset);
+static uint64_t openrtl_layout_operand(struct OpenrtlLayoutInst *insts, size_t len, size_t end, struct OpenrtlLayoutInst *it);
+
+int openrtl_relax(OpenrtlContext *ctx) {
+    int status = ctx->mapped;
+    for (size_t i = 0; i < ctx->len && !status; i++) {
+        status = openrtl_relax_buffer(ctx, ctx->ptr + i);
+    }
+    return status;
+}
+
+// shrinks every relative operand to the smallest width that holds it once
+// the layout is known. an operand refers to the buffer when it is
+// encoded pc-relative or names a label, anything else is an address that
+// does not move. widths of operands that refer to the buffer start
+// at 8 bytes and only ever shrink, which moves every offset down, so the
+// iteration reaches a fixpoint, pc-relative displacements included as
+// they only span shrinking code. global symbols keep the width they were
+// emitted with, a global may be redefined after the context is relaxed.
+// `ctx` may be NULL
+int openrtl_relax_buffer(OpenrtlContext *ctx, OpenrtlBuffer *buf) {
+    if (ctx && ctx->mapped) {
+        return 1;
+    }
+    // relaxing rewrites the whole buffer, so a segmented one is
+    // finalized here
+    if (openrtl_coalesce(buf)) {
+        return 1;
+    }
+
+    size_t len = openrtl_inst_count(buf);
+    struct OpenrtlLayoutInst *insts = openrtl_malloc(buf->allocator, (len ? len : 1) * sizeof(struct OpenrtlLayoutInst));
+    if (!insts) {
+        return 1;
+    }
+    OpenrtlIter iter;
+    openrtl_iter(&iter, buf);
+    for (size_t i = 0; openrtl_iter_next(&iter); i++) {
+        struct OpenrtlLayoutInst *it = insts + i;
+        it->offset = iter.offset;
+        it->inst = iter.inst;
+        it->value = iter.operand;
+        it->symbol = 0;
+        it->kind = OPENRTL_LAYOUT_FIXED;
+    }
+
+    for (size_t i = 0; i < buf->linker.len; i++) {
+        size_t offset = buf->linker.ptr[i].offset - 4;
+        size_t lo = 0;
+        size_t hi = len;
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            if (insts[mid].offset < offset) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        if (lo < len && insts[lo].offset == offset && openrtl_is_rel(insts[lo].inst.opcode)) {
+            insts[lo].symbol = i + 1;
+        }
+    }
+
+    for (size_t i = 0; i < len; i++) {
+        struct OpenrtlLayoutInst *it = insts + i;
+        if (!openrtl_is_rel(it->inst.opcode)) {
+            continue;
+        }
+        if (it->symbol) {
+            struct OpenrtlSymbol *sym = buf->linker.ptr + it->symbol - 1;
+            struct OpenrtlEntry *ent = NULL;
+            if (sym->type == OPENRTL_SYMBOL_LOCAL) {
+                ent = openrtl_table_find(&buf->local, sym->name);
+            }
+            if (!ent) {
+                it->kind = OPENRTL_LAYOUT_UNKNOWN;
+            } else if (ent->label) {
+                it->kind = OPENRTL_LAYOUT_LABEL;
+                it->value = ent->addr;
+                it->inst.rel.len = 8;
+            } else {
+                // see `openrtl_jump_operand`, an address is never
+                // encoded pc-relative
+                if (openrtl_is_pcrel(&it->inst)) {
+                    it->inst.size = OPENRTL_REL_ABSOLUTE;
+                    sym->relative = 0;
+                }
+                it->value = ent->addr;
+                it->inst.rel.len = openrtl_rel_len(it->value);
+            }
+        } else if (openrtl_is_pcrel(&it->inst)) {
+            // only labels are encoded pc-relative, keep the target
+            it->value += it->offset;
+            it->kind = OPENRTL_LAYOUT_LABEL;
+            it->inst.rel.len = 8;
+        } else {
+            it->inst.rel.len = openrtl_rel_len(it->value);
+        }
+    }
+
+    size_t end;
+    int changed;
+    do {
+        end = 0;
+        for (size_t i = 0; i < len; i++) {
+            insts[i].target = end;
+            end += 4;
+            if (openrtl_is_rel(insts[i].inst.opcode)) {
+                end += insts[i].inst.rel.len;
+            }
+        }
+
+        changed = 0;
+        for (size_t i = 0; i < len; i++) {
+            struct OpenrtlLayoutInst *it = insts + i;
+            if (it->kind == OPENRTL_LAYOUT_LABEL) {
+                size_t rel = openrtl_inst_rel_len(&it->inst, openrtl_layout_operand(insts, len, end, it));
+                if (rel < it->inst.rel.len) {
+                    it->inst.rel.len = rel;
+                    changed = 1;
+                }
+            }
+        }
+    } while (changed);
+
+    char *ptr = openrtl_malloc(buf->allocator, end > buf->cap ? end : buf->cap);
+    if (!ptr) {
+        openrtl_free(buf->allocator, insts);
+        return 1;
+    }
+    for (size_t i = 0; i < len; i++) {
+        struct OpenrtlLayoutInst *it = insts + i;
+        memcpy(ptr + it->target, &it->inst, 4);
+        if (openrtl_is_rel(it->inst.opcode)) {
+            uint64_t value = openrtl_layout_operand(insts, len, end, it);
+            memcpy(ptr + it->target + 4, &value, it->inst.rel.len);
+            if (it->symbol) {
+                struct OpenrtlSymbol *sym = buf->linker.ptr + it->symbol - 1;
+                sym->mask = openrtl_rel_mask(it->inst.rel.len);
+                if (it->kind == OPENRTL_LAYOUT_LABEL) {
+                    sym->address = openrtl_layout_map(insts, len, end, it->value);
+                } else if (it->kind == OPENRTL_LAYOUT_FIXED) {
+                    sym->address = it->value;
+                }
+            }
+        }
+    }
+
+    for (size_t i = 0; i < buf->linker.len; i++) {
+        struct OpenrtlSymbol *sym = buf->linker.ptr + i;
+        sym->offset = openrtl_layout_map(insts, len, end, sym->offset - 4) + 4;
+    }
+    for (size_t i = 0; i < buf->local.len; i++) {
+        struct OpenrtlEntry *ent = buf->local.ptr + i;
+        if (ent->label) {
+            ent->addr = openrtl_layout_map(insts, len, end, ent->addr);
+        }
+    }
+    // elements are recorded at the end of their instruction
+    for (size_t i = 0; i < buf->matrix.len; i++) {
+        buf->matrix.offset[i] = openrtl_layout_map(insts, len, end, buf->matrix.offset[i]);
+    }
+
+    openrtl_free(buf->allocator, buf->ptr);
+    buf->ptr = ptr;
+    buf->len = end;
+    if (end > buf->cap) {
+        buf->cap = end;
+    }
+    openrtl_drop_index(buf);
+
+    openrtl_free(buf->allocator, insts);
+    return 0;
+}
+
+// new offset of the instruction at or after `offset` in the old layout
+static size_t openrtl_layout_map(struct OpenrtlLayoutInst *insts, size_t len, size_t end, size_t offset) {
+    size_t lo = 0;
+    size_t hi = len;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (insts[mid].offset < offset) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo < len ? insts[lo].target : end;
+}
+
+// operand as encoded in the current layout
+static uint64_t openrtl_layout_operand(struct OpenrtlLayoutInst *insts, size_t len, size_t end, struct OpenrtlLayoutInst *it) {
+    uint64_t value = it->value;
+    if (it->kind == OPENRTL_LAYOUT_LABEL) {
+        value = openrtl_layout_map(insts, len, end, value);
+    }
+    if (it->kind != OPENRTL_LAYOUT_UNKNOWN && openrtl_is_pcrel(&it->inst)) {
+        value -= it->target;
+    }
+    return value;
+}
@@ -1,139 +1,983 @@
 #include <stdlib.h>
 #include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
 #include "include/openrtl.h"
+#include "internal.h"
 
 #define DEFAULT_CONTEXT_CAP 32
 #define DEFAULT_TABLE_CAP 32
 #define DEFAULT_BUFFER_CAP 1024
-#define DEFAULT_MATRIX_CAP 256
+#define DEFAULT_LINKER_CAP 32
+#define DEFAULT_SITES_CAP 64
+#define DEFAULT_POOL_CAP 16
+#define DEFAULT_STRINGS_CAP 64
+#define DEFAULT_CHUNK_CAP 4096
+#define DEFAULT_SEGMENTS_CAP 16
 
 static int openrtl_none(OpenrtlBuffer *buf, uint8_t opcode);
 static int openrtl_arith(OpenrtlBuffer *buf, uint8_t opcode, uint8_t size, uint8_t dest, uint8_t src1, uint8_t src2);
 static int openrtl_arith_b(OpenrtlBuffer *buf, uint8_t opcode, uint8_t size, uint8_t dest, uint8_t src, uint8_t size2);
+static int openrtl_shift(OpenrtlBuffer *buf, uint8_t size, uint8_t dest, uint8_t src, uint8_t kind, uint8_t count);
 static int openrtl_imm(OpenrtlBuffer *buf, uint8_t opcode, uint32_t value);
 static int openrtl_rel(OpenrtlBuffer *buf, uint8_t opcode, uint8_t size, uint8_t dest, uint64_t value);
-static int openrtl_append(OpenrtlBuffer *buf, struct OpenrtlElement *elem);
+static int openrtl_jump(OpenrtlBuffer *buf, uint8_t opcode, uint64_t addr);
+static void openrtl_jump_operand(OpenrtlBuffer *buf, OpenrtlInst *inst, uint64_t *addr);
+static size_t openrtl_rel_slot(OpenrtlBuffer *buf, OpenrtlInst *inst, uint64_t value);
+static struct OpenrtlSymbol *openrtl_pending(OpenrtlBuffer *buf);
+static int openrtl_element(const OpenrtlInst *inst, uint64_t value, struct OpenrtlElement *elem);
+static int openrtl_record(OpenrtlBuffer *buf, const OpenrtlInst *inst, uint64_t value);
+static int openrtl_table_rehash(OpenrtlTable *table);
+static int openrtl_link_buffer(OpenrtlContext *ctx, OpenrtlBuffer *buf);
+static int openrtl_patch(OpenrtlBuffer *buf, struct OpenrtlSymbol *sym, uint64_t addr);
+static void openrtl_absolute(OpenrtlBuffer *buf, struct OpenrtlSymbol *sym);
+static void openrtl_add_site(OpenrtlContext *ctx, size_t buffer, size_t symbol);
+static void openrtl_fold_key(const OpenrtlBuffer *buf, struct OpenrtlCacheKey *key);
+static void openrtl_fold_symbol(const OpenrtlBuffer *buf, size_t i, uint64_t *word);
+static int openrtl_fold_equal(const OpenrtlBuffer *a, const OpenrtlBuffer *b);
+static int openrtl_fold_compare(const void *a, const void *b);
+static void *openrtl_link_worker(void *arg);
+static void openrtl_strings_rehash(OpenrtlStrings *strings);
+static const char *openrtl_interned(const OpenrtlStrings *strings, const char *name);
+static OpenrtlStrings *openrtl_buffer_strings(OpenrtlBuffer *buf);
+static int openrtl_add_segment(OpenrtlBuffer *buf, size_t len);
+
+// FNV-1a
+static inline size_t openrtl_hash(const char *name) {
+    uint64_t hash = 0xcbf29ce484222325;
+    for (const unsigned char *p = (const unsigned char *) name; *p; p++) {
+        hash ^= *p;
+        hash *= 0x100000001b3;
+    }
+    return hash;
+}
 
 void openrtl_context(OpenrtlContext *ctx) {
+    openrtl_context_with(ctx, NULL);
+}
+
+void openrtl_context_with(OpenrtlContext *ctx, const OpenrtlAllocator *allocator) {
+    ctx->allocator = allocator;
+    ctx->mapped = 0;
     ctx->cap = DEFAULT_CONTEXT_CAP;
     ctx->len = 0;
-    ctx->ptr = malloc(ctx->cap * sizeof(OpenrtlBuffer));
-    ctx->global.cap = DEFAULT_TABLE_CAP;
-    ctx->global.len = 0;
-    ctx->global.ptr = malloc(ctx->global.cap * sizeof(struct OpenrtlEntry));
+    ctx->ptr = openrtl_malloc(allocator, ctx->cap * sizeof(OpenrtlBuffer));
+    openrtl_table(&ctx->global, allocator, DEFAULT_TABLE_CAP);
+    openrtl_strings(&ctx->strings, allocator);
+    ctx->sites.cap = DEFAULT_SITES_CAP;
+    ctx->sites.len = 0;
+    ctx->sites.ptr = openrtl_malloc(allocator, ctx->sites.cap * sizeof(struct OpenrtlSite));
+    openrtl_table(&ctx->sites.head, allocator, DEFAULT_TABLE_CAP);
 }
 
 void openrtl_del_context(OpenrtlContext *ctx) {
+    if (ctx->mapped) {
+        return;
+    }
     for (size_t i = 0; i < ctx->len; i++) {
         openrtl_del_buffer(ctx->ptr + i);
     }
-    for (size_t i = 0; i < ctx->global.len; i++) {
-        free((char *) ctx->global.ptr[i].name);
-    }
-    free(ctx->ptr);
-    free(ctx->global.ptr);
+    openrtl_free(ctx->allocator, ctx->ptr);
+    openrtl_del_table(&ctx->global);
+    openrtl_del_strings(&ctx->strings);
+    openrtl_free(ctx->allocator, ctx->sites.ptr);
+    openrtl_del_table(&ctx->sites.head);
 }
 
-void openrtl_add_buffer(OpenrtlContext *ctx, const char *name, OpenrtlBuffer *buf) {
-    if (ctx->global.len == ctx->global.cap) {
-        ctx->global.cap *= 2;
-        ctx->global.ptr = realloc(ctx->global.ptr, ctx->global.cap);
+int openrtl_add_buffer(OpenrtlContext *ctx, const char *name, OpenrtlBuffer *buf) {
+    if (ctx->mapped) {
+        return 1;
+    }
+    buf->name = openrtl_intern(&ctx->strings, name);
+    if (!buf->name || !openrtl_table_insert(&ctx->global, buf->name, ctx->len)) {
+        return 1;
     }
 
-    ctx->global.ptr[ctx->global.len].name = malloc(strlen(name) + 1);
-    strcpy((char *) ctx->global.ptr[ctx->global.len].name, name);
-    ctx->global.ptr[ctx->global.len++].addr = ctx->len;
+    if (buf->strings != &ctx->strings) {
+        for (size_t i = 0; i < buf->local.len; i++) {
+            buf->local.ptr[i].name = openrtl_intern(&ctx->strings, buf->local.ptr[i].name);
+        }
+        if (openrtl_table_rehash(&buf->local)) {
+            return 1;
+        }
+        for (size_t i = 0; i < buf->linker.len; i++) {
+            buf->linker.ptr[i].name = openrtl_intern(&ctx->strings, buf->linker.ptr[i].name);
+        }
+        if (buf->own_strings) {
+            openrtl_del_strings(buf->strings);
+            openrtl_free(buf->allocator, buf->strings);
+        }
+        buf->strings = &ctx->strings;
+        buf->own_strings = 0;
+    }
 
     if (ctx->len == ctx->cap) {
         ctx->cap *= 2;
-        ctx->ptr = realloc(ctx->ptr, ctx->cap);
+        ctx->ptr = openrtl_realloc(ctx->allocator, ctx->ptr, ctx->len * sizeof(OpenrtlBuffer), ctx->cap * sizeof(OpenrtlBuffer));
     }
 
     ctx->ptr[ctx->len++] = *buf;
+
+    for (size_t i = 0; i < buf->linker.len; i++) {
+        if (buf->linker.ptr[i].type == OPENRTL_SYMBOL_GLOBAL) {
+            openrtl_add_site(ctx, ctx->len - 1, i);
+        }
+    }
+    return 0;
+}
+
+int openrtl_global(OpenrtlContext *ctx, const char *name, uint64_t addr) {
+    if (ctx->mapped) {
+        return 1;
+    }
+    name = openrtl_intern(&ctx->strings, name);
+    return !name || !openrtl_table_insert(&ctx->global, name, addr);
+}
+
+// returns 1 if the context is mapped and 2 if an address does not fit
+// its slot, see `openrtl_relink`
+int openrtl_link(OpenrtlContext *ctx) {
+    if (ctx->mapped) {
+        return 1;
+    }
+    int status = 0;
+    for (size_t i = 0; i < ctx->len; i++) {
+        if (openrtl_link_buffer(ctx, ctx->ptr + i)) {
+            status = 2;
+        }
+    }
+    return status;
 }
 
-void openrtl_global(OpenrtlContext *ctx, const char *name, uint64_t addr) {
-    if (ctx->global.len == ctx->global.cap) {
-        ctx->global.cap *= 2;
-        ctx->global.ptr = realloc(ctx->global.ptr, ctx->global.cap);
+// patches only the sites that refer to `name`, for when a single global
+// was redefined after the context has been linked. returns 1 if the
+// context is mapped or `name` is not one of its globals and 2 if the new
+// address does not fit its slot
+int openrtl_relink(OpenrtlContext *ctx, const char *name) {
+    if (ctx->mapped) {
+        return 1;
+    }
+    name = openrtl_interned(&ctx->strings, name);
+    struct OpenrtlEntry *ent = name ? openrtl_table_find(&ctx->global, name) : NULL;
+    if (!ent) {
+        return 1;
     }
 
-    ctx->global.ptr[ctx->global.len].name = malloc(strlen(name) + 1);
-    strcpy((char *) ctx->global.ptr[ctx->global.len].name, name);
-    ctx->global.ptr[ctx->global.len++].addr = addr;
+    int status = 0;
+    struct OpenrtlEntry *head = openrtl_table_find(&ctx->sites.head, name);
+    for (size_t i = head ? head->addr : 0; i; i = ctx->sites.ptr[i - 1].next) {
+        struct OpenrtlSite *site = ctx->sites.ptr + i - 1;
+        OpenrtlBuffer *buf = ctx->ptr + site->buffer;
+        if (openrtl_patch(buf, buf->linker.ptr + site->symbol, ent->addr)) {
+            status = 2;
+        }
+    }
+    return status;
 }
 
-void openrtl_link(OpenrtlContext *ctx) {
+struct OpenrtlFold {
+    struct OpenrtlCacheKey key;
+    size_t buffer;
+};
+
+// keeps the first of every group of buffers with the same code and the
+// same references and drops the others, their names are redirected to
+// the one that is kept. buffers are renumbered, so it runs before
+// `openrtl_link`
+int openrtl_fold_identical(OpenrtlContext *ctx) {
+    if (ctx->mapped) {
+        return 1;
+    }
+    if (ctx->len <= 1) {
+        return 0;
+    }
+
+    struct OpenrtlFold *folds = openrtl_malloc(ctx->allocator, ctx->len * sizeof(struct OpenrtlFold));
+    size_t *map = openrtl_malloc(ctx->allocator, ctx->len * sizeof(size_t));
+    const char **names = openrtl_malloc(ctx->allocator, ctx->len * sizeof(const char *));
+    if (!folds || !map || !names) {
+        openrtl_free(ctx->allocator, folds);
+        openrtl_free(ctx->allocator, map);
+        openrtl_free(ctx->allocator, names);
+        return 1;
+    }
+    for (size_t i = 0; i < ctx->len; i++) {
+        openrtl_fold_key(ctx->ptr + i, &folds[i].key);
+        folds[i].buffer = i;
+        map[i] = i;
+        names[i] = ctx->ptr[i].name;
+    }
+    qsort(folds, ctx->len, sizeof(struct OpenrtlFold), openrtl_fold_compare);
+
+    // only a buffer its name still refers to is dropped, anything else
+    // may be known to the caller by its index alone
+    size_t folded = 0;
+    for (size_t lo = 0, hi; lo < ctx->len; lo = hi) {
+        hi = lo + 1;
+        while (hi < ctx->len && folds[hi].key.lo == folds[lo].key.lo && folds[hi].key.hi == folds[lo].key.hi) {
+            hi++;
+        }
+        for (size_t j = lo + 1; j < hi; j++) {
+            size_t dup = folds[j].buffer;
+            struct OpenrtlEntry *ent = names[dup] ? openrtl_table_find(&ctx->global, names[dup]) : NULL;
+            if (!ent || ent->addr != dup) {
+                continue;
+            }
+            for (size_t k = lo; k < j; k++) {
+                size_t canon = folds[k].buffer;
+                if (map[canon] == canon && openrtl_fold_equal(ctx->ptr + canon, ctx->ptr + dup)) {
+                    map[dup] = canon;
+                    ++folded;
+                    break;
+                }
+            }
+        }
+    }
+    openrtl_free(ctx->allocator, folds);
+    if (!folded) {
+        openrtl_free(ctx->allocator, map);
+        openrtl_free(ctx->allocator, names);
+        return 0;
+    }
+
+    // kept buffers stay in order, a dropped one maps to where the buffer
+    // it folded into went
+    size_t len = 0;
+    for (size_t i = 0; i < ctx->len; i++) {
+        if (map[i] == i) {
+            ctx->ptr[len] = ctx->ptr[i];
+            map[i] = len++;
+        } else {
+            openrtl_del_buffer(ctx->ptr + i);
+            map[i] = map[map[i]];
+        }
+    }
     for (size_t i = 0; i < ctx->len; i++) {
-        OpenrtlBuffer *buf = ctx->ptr + i;
-        for (size_t j = 0; j < buf->linker.len; j++) {
-            struct OpenrtlSymbol *sym = buf->linker.ptr + j;
-            if (sym->type == OPENRTL_SYMBOL_GLOBAL) {
-                for (size_t k = 0; k < ctx->global.len; k++) {
-                    struct OpenrtlEntry *ent = ctx->global.ptr + k;
-                    if (strcmp(sym->name, ent->name) == 0) {
-                        sym->address = ent->addr;
-                        uint64_t current = 0;
-                        memcpy(&current, (char *) buf->ptr + sym->offset, sizeof(uint64_t));
-                        current &= ~sym->mask;
-                        current |= sym->address & sym->mask;
-                        memcpy((char *) buf->ptr + sym->offset, &current, sizeof(uint64_t));
-                    }
+        struct OpenrtlEntry *ent = names[i] ? openrtl_table_find(&ctx->global, names[i]) : NULL;
+        if (ent && ent->addr == i) {
+            ent->addr = map[i];
+        }
+    }
+    ctx->len = len;
+
+    ctx->sites.len = 0;
+    ctx->sites.head.len = 0;
+    memset(ctx->sites.head.index, 0, (ctx->sites.head.mask + 1) * sizeof(size_t));
+    for (size_t i = 0; i < ctx->len; i++) {
+        for (size_t j = 0; j < ctx->ptr[i].linker.len; j++) {
+            if (ctx->ptr[i].linker.ptr[j].type == OPENRTL_SYMBOL_GLOBAL) {
+                openrtl_add_site(ctx, i, j);
+            }
+        }
+    }
+
+    openrtl_free(ctx->allocator, map);
+    openrtl_free(ctx->allocator, names);
+    return 0;
+}
+
+static void openrtl_fold_key(const OpenrtlBuffer *buf, struct OpenrtlCacheKey *key) {
+    openrtl_cache_key(buf, key);
+    uint64_t head[2] = { buf->pcrel, buf->linker.len };
+    openrtl_cache_key_update(key, head, sizeof(head));
+    for (size_t i = 0; i < buf->linker.len; i++) {
+        uint64_t word[5];
+        openrtl_fold_symbol(buf, i, word);
+        openrtl_cache_key_update(key, word, sizeof(word));
+    }
+}
+
+// what a symbol resolves to as far as the buffer can tell. a local
+// label is its address and a reference to the buffer itself is kept
+// apart from its name, so recursive buffers fold too
+static void openrtl_fold_symbol(const OpenrtlBuffer *buf, size_t i, uint64_t *word) {
+    const struct OpenrtlSymbol *sym = buf->linker.ptr + i;
+    word[0] = sym->type;
+    word[1] = sym->relative;
+    word[2] = sym->offset;
+    word[3] = 0;
+    word[4] = 0;
+    if (sym->type == OPENRTL_SYMBOL_LOCAL) {
+        const struct OpenrtlEntry *ent = openrtl_table_find(&buf->local, sym->name);
+        if (ent) {
+            word[3] = ent->label ? 1 : 4;
+            word[4] = ent->addr;
+            return;
+        }
+    } else if (sym->name == buf->name) {
+        word[3] = 2;
+        return;
+    }
+    word[3] = 3;
+    word[4] = (uintptr_t) sym->name;
+}
+
+static int openrtl_fold_equal(const OpenrtlBuffer *a, const OpenrtlBuffer *b) {
+    if (a->len != b->len || a->params != b->params || a->pcrel != b->pcrel || a->linker.len != b->linker.len) {
+        return 0;
+    }
+    size_t n;
+    for (size_t i = 0; i < a->len; i += n) {
+        size_t m;
+        const void *p = openrtl_buffer_span(a, i, &n);
+        const void *q = openrtl_buffer_span(b, i, &m);
+        if (m < n) {
+            n = m;
+        }
+        if (memcmp(p, q, n)) {
+            return 0;
+        }
+    }
+    for (size_t i = 0; i < a->linker.len; i++) {
+        uint64_t x[5];
+        uint64_t y[5];
+        openrtl_fold_symbol(a, i, x);
+        openrtl_fold_symbol(b, i, y);
+        if (memcmp(x, y, sizeof(x))) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// orders by key and then by buffer, so the first of a group is the
+// earliest buffer
+static int openrtl_fold_compare(const void *a, const void *b) {
+    const struct OpenrtlFold *x = a;
+    const struct OpenrtlFold *y = b;
+    if (x->key.hi != y->key.hi) {
+        return x->key.hi < y->key.hi ? -1 : 1;
+    }
+    if (x->key.lo != y->key.lo) {
+        return x->key.lo < y->key.lo ? -1 : 1;
+    }
+    return (x->buffer > y->buffer) - (x->buffer < y->buffer);
+}
+
+// every worker owns a range of buffer indices packed as `lo << 32 | hi`.
+// owners take buffers from the bottom of their range, idle workers steal
+// the upper half of someone else's range
+struct OpenrtlLinkWorker {
+    OpenrtlContext *ctx;
+    struct OpenrtlLinkWorker *workers;
+    size_t nthreads;
+    size_t id;
+    _Atomic uint64_t range;
+    // whether an address did not fit its slot
+    int overflow;
+};
+
+// links the buffers of `ctx` on up to `nthreads` threads into the same
+// bytes `openrtl_link` gives. returns 1 when out of memory or a thread
+// fails to start, its buffers are then linked by the others, and 2 as
+// `openrtl_link` does
+int openrtl_link_parallel(OpenrtlContext *ctx, size_t nthreads) {
+    if (nthreads <= 1 || ctx->len <= 1 || ctx->mapped) {
+        return openrtl_link(ctx);
+    }
+    if (nthreads > ctx->len) {
+        nthreads = ctx->len;
+    }
+
+    int status = 0;
+    struct OpenrtlLinkWorker *workers = openrtl_malloc(ctx->allocator, nthreads * sizeof(struct OpenrtlLinkWorker));
+    pthread_t *threads = openrtl_malloc(ctx->allocator, nthreads * sizeof(pthread_t));
+    if (!workers || !threads) {
+        openrtl_free(ctx->allocator, workers);
+        openrtl_free(ctx->allocator, threads);
+        return 1;
+    }
+    for (size_t i = 0; i < nthreads; i++) {
+        uint64_t lo = i * ctx->len / nthreads;
+        uint64_t hi = (i + 1) * ctx->len / nthreads;
+        workers[i].ctx = ctx;
+        workers[i].workers = workers;
+        workers[i].nthreads = nthreads;
+        workers[i].id = i;
+        workers[i].overflow = 0;
+        atomic_init(&workers[i].range, lo << 32 | hi);
+    }
+
+    // a worker that fails to start leaves its range to be stolen
+    size_t started = 1;
+    for (size_t i = 1; i < nthreads; i++) {
+        if (pthread_create(threads + i, NULL, openrtl_link_worker, workers + i) != 0) {
+            status = 1;
+            break;
+        }
+        ++started;
+    }
+    openrtl_link_worker(workers);
+    for (size_t i = 1; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    for (size_t i = 0; i < nthreads; i++) {
+        if (workers[i].overflow) {
+            status = 2;
+        }
+    }
+
+    openrtl_free(ctx->allocator, threads);
+    openrtl_free(ctx->allocator, workers);
+    return status;
+}
+
+void openrtl_strings(OpenrtlStrings *strings, const OpenrtlAllocator *allocator) {
+    strings->allocator = allocator;
+    strings->cap = DEFAULT_STRINGS_CAP;
+    strings->len = 0;
+    strings->index = openrtl_calloc(allocator, strings->cap, sizeof(const char *));
+    strings->chunk = NULL;
+    strings->mapped = 0;
+}
+
+void openrtl_del_strings(OpenrtlStrings *strings) {
+    while (strings->chunk) {
+        struct OpenrtlChunk *next = strings->chunk->next;
+        openrtl_free(strings->allocator, strings->chunk);
+        strings->chunk = next;
+    }
+    openrtl_free(strings->allocator, strings->index);
+}
+
+// the interned copy of `name`, or NULL if it has never been interned
+static const char *openrtl_interned(const OpenrtlStrings *strings, const char *name) {
+    size_t mask = strings->cap - 1;
+    size_t slot = openrtl_hash(name) & mask;
+    while (strings->index[slot]) {
+        if (strcmp(strings->index[slot], name) == 0) {
+            return strings->index[slot];
+        }
+        slot = (slot + 1) & mask;
+    }
+    return NULL;
+}
+
+// NULL when the strings are mapped and `name` is not among them, or when
+// out of memory
+const char *openrtl_intern(OpenrtlStrings *strings, const char *name) {
+    if (strings->mapped) {
+        return openrtl_interned(strings, name);
+    }
+    size_t mask = strings->cap - 1;
+    size_t slot = openrtl_hash(name) & mask;
+    while (strings->index[slot]) {
+        if (strcmp(strings->index[slot], name) == 0) {
+            return strings->index[slot];
+        }
+        slot = (slot + 1) & mask;
+    }
+
+    size_t len = strlen(name) + 1;
+    struct OpenrtlChunk *chunk = strings->chunk;
+    if (!chunk || chunk->len + len > chunk->cap) {
+        size_t cap = len > DEFAULT_CHUNK_CAP ? len : DEFAULT_CHUNK_CAP;
+        chunk = openrtl_malloc(strings->allocator, sizeof(struct OpenrtlChunk) + cap);
+        if (!chunk) {
+            return NULL;
+        }
+        chunk->cap = cap;
+        chunk->len = 0;
+        chunk->next = strings->chunk;
+        strings->chunk = chunk;
+    }
+    char *ptr = chunk->ptr + chunk->len;
+    memcpy(ptr, name, len);
+    chunk->len += len;
+
+    strings->index[slot] = ptr;
+    if (++strings->len * 2 > strings->cap) {
+        strings->cap *= 2;
+        openrtl_strings_rehash(strings);
+    }
+    return ptr;
+}
+
+// nonzero when an address does not fit its slot
+static int openrtl_link_buffer(OpenrtlContext *ctx, OpenrtlBuffer *buf) {
+    int status = 0;
+    for (size_t j = 0; j < buf->linker.len; j++) {
+        struct OpenrtlSymbol *sym = buf->linker.ptr + j;
+        struct OpenrtlEntry *ent;
+        if (sym->type == OPENRTL_SYMBOL_GLOBAL) {
+            ent = openrtl_table_find(&ctx->global, sym->name);
+        } else {
+            ent = openrtl_table_find(&buf->local, sym->name);
+        }
+        if (ent) {
+            if (sym->relative && !ent->label) {
+                openrtl_absolute(buf, sym);
+            }
+            if (openrtl_patch(buf, sym, ent->addr)) {
+                status = 1;
+            }
+        }
+    }
+    return status;
+}
+
+// a pc-relative reference to a local name that turned out to be bound to
+// an address rather than a label is encoded absolute after all
+static void openrtl_absolute(OpenrtlBuffer *buf, struct OpenrtlSymbol *sym) {
+    char *ptr = openrtl_buffer_span(buf, sym->offset - 4, NULL);
+    OpenrtlInst inst;
+    memcpy(&inst, ptr, 4);
+    inst.size = OPENRTL_REL_ABSOLUTE;
+    memcpy(ptr, &inst, 4);
+    sym->relative = 0;
+}
+
+// only the bytes covered by the mask are touched, so a slot narrowed by
+// `openrtl_relax` never spills into the next instruction. returns
+// nonzero when the address does not fit the slot
+static int openrtl_patch(OpenrtlBuffer *buf, struct OpenrtlSymbol *sym, uint64_t addr) {
+    size_t len = openrtl_mask_len(sym->mask);
+    uint64_t value = addr;
+    if (sym->relative) {
+        value -= sym->offset - 4;
+    }
+    sym->address = addr;
+    // an operand never crosses a segment boundary
+    char *ptr = openrtl_buffer_span(buf, sym->offset, NULL);
+    uint64_t current = 0;
+    memcpy(&current, ptr, len);
+    current &= ~sym->mask;
+    current |= value & sym->mask;
+    memcpy(ptr, &current, len);
+    if (sym->relative) {
+        return len < 8 && openrtl_rel_slen(value) > len;
+    }
+    return (value & ~sym->mask) != 0;
+}
+
+static void openrtl_add_site(OpenrtlContext *ctx, size_t buffer, size_t symbol) {
+    if (ctx->sites.len == ctx->sites.cap) {
+        ctx->sites.cap *= 2;
+        ctx->sites.ptr = openrtl_realloc(ctx->allocator, ctx->sites.ptr, ctx->sites.len * sizeof(struct OpenrtlSite), ctx->sites.cap * sizeof(struct OpenrtlSite));
+    }
+
+    const char *name = ctx->ptr[buffer].linker.ptr[symbol].name;
+    struct OpenrtlEntry *head = openrtl_table_find(&ctx->sites.head, name);
+    ctx->sites.ptr[ctx->sites.len].buffer = buffer;
+    ctx->sites.ptr[ctx->sites.len].symbol = symbol;
+    ctx->sites.ptr[ctx->sites.len++].next = head ? head->addr : 0;
+    if (head) {
+        head->addr = ctx->sites.len;
+    } else {
+        openrtl_table_insert(&ctx->sites.head, name, ctx->sites.len);
+    }
+}
+
+static void *openrtl_link_worker(void *arg) {
+    struct OpenrtlLinkWorker *self = arg;
+    for (;;) {
+        uint64_t range = atomic_load(&self->range);
+        uint64_t lo = range >> 32;
+        uint64_t hi = range & 0xffffffff;
+        if (lo < hi) {
+            if (atomic_compare_exchange_weak(&self->range, &range, (lo + 1) << 32 | hi)) {
+                if (openrtl_link_buffer(self->ctx, self->ctx->ptr + lo)) {
+                    self->overflow = 1;
+                }
+            }
+            continue;
+        }
+
+        int stolen = 0;
+        for (size_t i = 1; i < self->nthreads && !stolen; i++) {
+            struct OpenrtlLinkWorker *victim = self->workers + (self->id + i) % self->nthreads;
+            uint64_t vrange = atomic_load(&victim->range);
+            for (;;) {
+                uint64_t vlo = vrange >> 32;
+                uint64_t vhi = vrange & 0xffffffff;
+                if (vlo >= vhi) {
+                    break;
                 }
-            } else {
-                for (size_t k = 0; k < buf->local.len; k++) {
-                    struct OpenrtlEntry *ent = buf->local.ptr + k;
-                    if (strcmp(sym->name, ent->name) == 0) {
-                        sym->address = ent->addr;
-                        uint64_t current = 0;
-                        memcpy(&current, (char *) buf->ptr + sym->offset, sizeof(uint64_t));
-                        current &= ~sym->mask;
-                        current |= sym->address & sym->mask;
-                        memcpy((char *) buf->ptr + sym->offset, &current, sizeof(uint64_t));
-                    }
+                uint64_t mid = vhi - (vhi - vlo + 1) / 2;
+                if (atomic_compare_exchange_weak(&victim->range, &vrange, vlo << 32 | mid)) {
+                    atomic_store(&self->range, mid << 32 | vhi);
+                    stolen = 1;
+                    break;
                 }
             }
         }
+        if (!stolen) {
+            return NULL;
+        }
+    }
+}
+
+// the index is probed with a mask, so `cap` is rounded up to a power of
+// two and grows by doubling
+void openrtl_table(OpenrtlTable *table, const OpenrtlAllocator *allocator, size_t cap) {
+    table->allocator = allocator;
+    table->cap = 1;
+    while (table->cap < cap) {
+        table->cap *= 2;
+    }
+    table->len = 0;
+    table->ptr = openrtl_malloc(allocator, table->cap * sizeof(struct OpenrtlEntry));
+    table->mask = 2 * table->cap - 1;
+    table->index = openrtl_calloc(allocator, table->mask + 1, sizeof(size_t));
+}
+
+void openrtl_del_table(OpenrtlTable *table) {
+    openrtl_free(table->allocator, table->ptr);
+    openrtl_free(table->allocator, table->index);
+}
+
+// inserting an existing name replaces its address, which is what the
+// linker observed when it used to apply every match in order. the entry
+// is returned unmarked as a label, NULL when out of memory
+struct OpenrtlEntry *openrtl_table_insert(OpenrtlTable *table, const char *name, uint64_t addr) {
+    size_t slot = openrtl_hash_name(name) & table->mask;
+    while (table->index[slot]) {
+        struct OpenrtlEntry *ent = table->ptr + table->index[slot] - 1;
+        if (ent->name == name) {
+            ent->addr = addr;
+            ent->label = 0;
+            return ent;
+        }
+        slot = (slot + 1) & table->mask;
+    }
+
+    if (table->len == table->cap) {
+        struct OpenrtlEntry *ptr = openrtl_realloc(table->allocator, table->ptr, table->len * sizeof(struct OpenrtlEntry), 2 * table->cap * sizeof(struct OpenrtlEntry));
+        if (!ptr) {
+            return NULL;
+        }
+        table->ptr = ptr;
+        table->cap *= 2;
+        if (openrtl_table_rehash(table)) {
+            // the old index only has room for the old capacity
+            table->cap /= 2;
+            return NULL;
+        }
+        slot = openrtl_hash_name(name) & table->mask;
+        while (table->index[slot]) {
+            slot = (slot + 1) & table->mask;
+        }
     }
+
+    struct OpenrtlEntry *ent = table->ptr + table->len++;
+    ent->name = name;
+    ent->addr = addr;
+    ent->label = 0;
+    table->index[slot] = table->len;
+    return ent;
+}
+
+struct OpenrtlEntry *openrtl_table_find(const OpenrtlTable *table, const char *name) {
+    size_t slot = openrtl_hash_name(name) & table->mask;
+    while (table->index[slot]) {
+        struct OpenrtlEntry *ent = table->ptr + table->index[slot] - 1;
+        if (ent->name == name) {
+            return ent;
+        }
+        slot = (slot + 1) & table->mask;
+    }
+    return NULL;
 }
 
 void openrtl_buffer(OpenrtlBuffer *buf) {
+    openrtl_buffer_with(buf, NULL);
+}
+
+void openrtl_buffer_with(OpenrtlBuffer *buf, const OpenrtlAllocator *allocator) {
+    buf->allocator = allocator;
+    buf->params = 0;
     buf->cap = DEFAULT_BUFFER_CAP;
     buf->len = 0;
-    buf->ptr = malloc(buf->cap);
-    buf->matrix.cap = DEFAULT_MATRIX_CAP;
-    buf->matrix.len = 0;
-    buf->matrix.ptr = malloc(buf->matrix.cap * sizeof(struct OpenrtlElement));
-    buf->local.cap = DEFAULT_TABLE_CAP;
-    buf->local.len = 0;
-    buf->local.ptr = malloc(buf->local.cap * sizeof(struct OpenrtlEntry));
+    buf->ptr = openrtl_malloc(allocator, buf->cap);
+    openrtl_matrix(&buf->matrix, allocator);
+    buf->linker.cap = DEFAULT_LINKER_CAP;
+    buf->linker.len = 0;
+    buf->linker.ptr = openrtl_malloc(allocator, buf->linker.cap * sizeof(struct OpenrtlSymbol));
+    buf->segments.size = 0;
+    buf->segments.cap = 0;
+    buf->segments.len = 0;
+    buf->segments.ptr = NULL;
+    buf->index.cap = 0;
+    buf->index.len = 0;
+    buf->index.ptr = NULL;
+    openrtl_table(&buf->local, allocator, DEFAULT_TABLE_CAP);
+    buf->strings = NULL;
+    buf->own_strings = 0;
+    buf->name = NULL;
+    buf->pcrel = 0;
+    buf->record = 1;
+}
+
+// a buffer for a mapped context interns into a set of its own, it can
+// never be added to it
+void openrtl_context_buffer(OpenrtlContext *ctx, OpenrtlBuffer *buf) {
+    openrtl_buffer_with(buf, ctx->allocator);
+    buf->strings = ctx->mapped ? NULL : &ctx->strings;
 }
 
 void openrtl_del_buffer(OpenrtlBuffer *buf) {
-    free(buf->ptr);
-    free(buf->matrix.ptr);
+    openrtl_free(buf->allocator, buf->ptr);
+    for (size_t i = 0; i < buf->segments.len; i++) {
+        openrtl_free(buf->allocator, buf->segments.ptr[i]);
+    }
+    openrtl_free(buf->allocator, buf->segments.ptr);
+    openrtl_free(buf->allocator, buf->index.ptr);
+    openrtl_del_matrix(&buf->matrix);
+    openrtl_free(buf->allocator, buf->linker.ptr);
+    openrtl_del_table(&buf->local);
+    if (buf->own_strings) {
+        openrtl_del_strings(buf->strings);
+        openrtl_free(buf->allocator, buf->strings);
+    }
+}
+
+// empties a buffer but keeps every allocation at its grown capacity
+void openrtl_reset_buffer(OpenrtlBuffer *buf) {
+    buf->params = 0;
+    buf->len = 0;
+    // only the first segment is kept
+    for (size_t i = 1; i < buf->segments.len; i++) {
+        openrtl_free(buf->allocator, buf->segments.ptr[i]);
+    }
+    if (buf->segments.len) {
+        buf->segments.len = 1;
+    }
+    openrtl_drop_index(buf);
+    openrtl_reset_matrix(&buf->matrix);
+    buf->linker.len = 0;
+    buf->local.len = 0;
+    memset(buf->local.index, 0, (buf->local.mask + 1) * sizeof(size_t));
+    if (buf->own_strings) {
+        openrtl_del_strings(buf->strings);
+        openrtl_free(buf->allocator, buf->strings);
+    }
+    buf->strings = NULL;
+    buf->own_strings = 0;
+    buf->name = NULL;
+    buf->pcrel = 0;
+    buf->record = 1;
+}
+
+void openrtl_buffer_pool(OpenrtlBufferPool *pool) {
+    openrtl_buffer_pool_with(pool, NULL);
 }
 
+void openrtl_buffer_pool_with(OpenrtlBufferPool *pool, const OpenrtlAllocator *allocator) {
+    pool->allocator = allocator;
+    pool->cap = DEFAULT_POOL_CAP;
+    pool->len = 0;
+    pool->ptr = openrtl_malloc(allocator, pool->cap * sizeof(OpenrtlBuffer));
+}
+
+void openrtl_del_buffer_pool(OpenrtlBufferPool *pool) {
+    for (size_t i = 0; i < pool->len; i++) {
+        openrtl_del_buffer(pool->ptr + i);
+    }
+    openrtl_free(pool->allocator, pool->ptr);
+}
+
+// hands out the most recently released buffer, or a new one
+void openrtl_acquire_buffer(OpenrtlBufferPool *pool, OpenrtlBuffer *buf) {
+    if (pool->len) {
+        *buf = pool->ptr[--pool->len];
+    } else {
+        openrtl_buffer_with(buf, pool->allocator);
+    }
+}
+
+// the buffer must not also be owned by a context
+void openrtl_release_buffer(OpenrtlBufferPool *pool, OpenrtlBuffer *buf) {
+    if (pool->len == pool->cap) {
+        pool->cap *= 2;
+        pool->ptr = openrtl_realloc(pool->allocator, pool->ptr, pool->len * sizeof(OpenrtlBuffer), pool->cap * sizeof(OpenrtlBuffer));
+    }
+
+    openrtl_reset_buffer(buf);
+    pool->ptr[pool->len++] = *buf;
+}
+
+// makes room for `len` contiguous bytes at the end of the buffer
+int openrtl_buffer_reserve(OpenrtlBuffer *buf, size_t len) {
+    if (buf->segments.size) {
+        struct OpenrtlSegment *tail = buf->segments.len ? buf->segments.ptr[buf->segments.len - 1] : NULL;
+        if (!tail || buf->len - tail->offset + len > tail->cap) {
+            return openrtl_add_segment(buf, len);
+        }
+        return 0;
+    }
+    if (buf->len + len > buf->cap) {
+        size_t cap = buf->cap ? buf->cap : DEFAULT_BUFFER_CAP;
+        while (buf->len + len > cap) {
+            cap *= 2;
+        }
+        void *ptr = openrtl_realloc(buf->allocator, buf->ptr, buf->cap, cap);
+        if (!ptr) {
+            return 1;
+        }
+        buf->ptr = ptr;
+        buf->cap = cap;
+    }
+    return 0;
+}
+
+static int openrtl_add_segment(OpenrtlBuffer *buf, size_t len) {
+    if (buf->segments.len == buf->segments.cap) {
+        size_t cap = buf->segments.cap ? 2 * buf->segments.cap : DEFAULT_SEGMENTS_CAP;
+        void *ptr = openrtl_realloc(buf->allocator, buf->segments.ptr, buf->segments.cap * sizeof(struct OpenrtlSegment *), cap * sizeof(struct OpenrtlSegment *));
+        if (!ptr) {
+            return 1;
+        }
+        buf->segments.ptr = ptr;
+        buf->segments.cap = cap;
+    }
+
+    size_t cap = len > buf->segments.size ? len : buf->segments.size;
+    struct OpenrtlSegment *seg = openrtl_malloc(buf->allocator, sizeof(struct OpenrtlSegment) + cap);
+    if (!seg) {
+        return 1;
+    }
+    seg->offset = buf->len;
+    seg->cap = cap;
+    buf->segments.ptr[buf->segments.len++] = seg;
+    return 0;
+}
+
+// switches an empty buffer to appending code to segments of `size`
+// bytes, so it never has to be copied while it grows
+int openrtl_buffer_segmented(OpenrtlBuffer *buf, size_t size) {
+    if (buf->len || !size) {
+        return 1;
+    }
+    for (size_t i = 0; i < buf->segments.len; i++) {
+        openrtl_free(buf->allocator, buf->segments.ptr[i]);
+    }
+    buf->segments.len = 0;
+    buf->segments.size = size;
+    openrtl_free(buf->allocator, buf->ptr);
+    buf->ptr = NULL;
+    buf->cap = 0;
+    return 0;
+}
+
+// copies the segments into a single allocation and makes the buffer
+// contiguous again
+int openrtl_coalesce(OpenrtlBuffer *buf) {
+    if (!buf->segments.size) {
+        return 0;
+    }
+    size_t cap = buf->len > DEFAULT_BUFFER_CAP ? buf->len : DEFAULT_BUFFER_CAP;
+    char *ptr = openrtl_malloc(buf->allocator, cap);
+    if (!ptr) {
+        return 1;
+    }
+    for (size_t i = 0; i < buf->segments.len; i++) {
+        struct OpenrtlSegment *seg = buf->segments.ptr[i];
+        size_t end = i + 1 < buf->segments.len ? buf->segments.ptr[i + 1]->offset : buf->len;
+        memcpy(ptr + seg->offset, seg->ptr, end - seg->offset);
+        openrtl_free(buf->allocator, seg);
+    }
+    buf->segments.len = 0;
+    buf->segments.size = 0;
+    buf->ptr = ptr;
+    buf->cap = cap;
+    return 0;
+}
+
+// the code at `offset` and, if `len` is not NULL, how many bytes of it
+// are contiguous. iterating the spans up to `buf->len` walks the code
+// of a segmented buffer without coalescing it
+void *openrtl_buffer_span(const OpenrtlBuffer *buf, size_t offset, size_t *len) {
+    if (!buf->segments.len) {
+        if (len) {
+            *len = buf->len - offset;
+        }
+        return (char *) buf->ptr + offset;
+    }
+    size_t lo = 0;
+    size_t hi = buf->segments.len;
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (buf->segments.ptr[mid]->offset <= offset) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    struct OpenrtlSegment *seg = buf->segments.ptr[lo];
+    if (len) {
+        size_t end = lo + 1 < buf->segments.len ? buf->segments.ptr[lo + 1]->offset : buf->len;
+        *len = end - offset;
+    }
+    return seg->ptr + (offset - seg->offset);
+}
+
+// emits `n` instructions with a single capacity check. `operands` holds
+// the operand of every relative instruction at the same index and may be
+// NULL if there are none, nothing is emitted when it is NULL but one is
+// needed. branches and calls honour `buf->pcrel`. a segmented buffer
+// still checks every instruction against its segment
+int openrtl_emit_batch(OpenrtlBuffer *buf, const OpenrtlInst *insts, const uint64_t *operands, size_t n) {
+    if (!operands) {
+        for (size_t i = 0; i < n; i++) {
+            if (openrtl_is_rel(insts[i].opcode)) {
+                return 1;
+            }
+        }
+    }
+    if ((!buf->segments.size && openrtl_buffer_reserve(buf, 12 * n)) || (buf->record && openrtl_matrix_reserve(&buf->matrix, n))) {
+        return 1;
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        if (buf->segments.size && openrtl_buffer_reserve(buf, 12)) {
+            return 1;
+        }
+        OpenrtlInst inst = insts[i];
+        uint64_t value = 0;
+        size_t len = 0;
+        if (openrtl_is_rel(inst.opcode)) {
+            value = operands[i];
+            if (openrtl_is_jump(inst.opcode)) {
+                openrtl_jump_operand(buf, &inst, &value);
+            }
+            len = openrtl_rel_slot(buf, &inst, value);
+        }
+        char *ptr = openrtl_buffer_end(buf);
+        memcpy(ptr, &inst, 4);
+        memcpy(ptr + 4, &value, len);
+        buf->len += 4 + len;
+        openrtl_record(buf, &inst, value);
+    }
+    return 0;
+}
+
+// binds `name` to an address that does not move with the code
 void openrtl_local(OpenrtlBuffer *buf, const char *name, uint64_t addr) {
-    if (buf->local.len == buf->local.cap) {
-        buf->local.cap *= 2;
-        buf->local.ptr = realloc(buf->local.ptr, buf->local.cap);
+    name = openrtl_intern(openrtl_buffer_strings(buf), name);
+    if (name) {
+        openrtl_table_insert(&buf->local, name, addr);
     }
+}
 
-    buf->local.ptr[buf->local.len].name = malloc(strlen(name) + 1);
-    strcpy((char *) buf->local.ptr[buf->local.len].name, name);
-    buf->local.ptr[buf->local.len++].addr = addr;
+// binds `name` to the end of the buffer, where the next instruction goes.
+// passes and `openrtl_relax` keep a label on the instruction it names
+void openrtl_label(OpenrtlBuffer *buf, const char *name) {
+    name = openrtl_intern(openrtl_buffer_strings(buf), name);
+    struct OpenrtlEntry *ent = name ? openrtl_table_insert(&buf->local, name, buf->len) : NULL;
+    if (ent) {
+        ent->label = 1;
+    }
 }
 
 void openrtl_symbol(OpenrtlBuffer *buf, int type, const char *name) {
     if (buf->linker.len == buf->linker.cap) {
         buf->linker.cap *= 2;
-        buf->linker.ptr = realloc(buf->linker.ptr, buf->linker.cap);
+        buf->linker.ptr = openrtl_realloc(buf->allocator, buf->linker.ptr, buf->linker.len * sizeof(struct OpenrtlSymbol), buf->linker.cap * sizeof(struct OpenrtlSymbol));
     }
 
     buf->linker.ptr[buf->linker.len].type = type;
-    buf->linker.ptr[buf->linker.len].name = malloc(strlen(name) + 1);
-    strcpy((char *) buf->linker.ptr[buf->linker.len].name, name);
+    buf->linker.ptr[buf->linker.len].relative = 0;
+    buf->linker.ptr[buf->linker.len].name = openrtl_intern(openrtl_buffer_strings(buf), name);
     buf->linker.ptr[buf->linker.len].mask = 0xffffffffffffffff;
     buf->linker.ptr[buf->linker.len].offset = buf->len + 4;
     buf->linker.ptr[buf->linker.len].address = 0;
@@ -153,47 +997,47 @@ int openrtl_leave(OpenrtlBuffer *buf, uint32_t imm) {
 }
 
 int openrtl_call(OpenrtlBuffer *buf, uint64_t addr) {
-    return openrtl_rel(buf, OPENRTL_OP_CALL, 0, 0, addr);
+    return openrtl_jump(buf, OPENRTL_OP_CALL, addr);
 }
 
 int openrtl_call_indirect(OpenrtlBuffer *buf, uint8_t dest) {
-    return openrtl_rel(buf, OPENRTL_OP_CALL_INDIRECT, dest, OPENRTL_ISIZE_64, 0);
+    return openrtl_rel(buf, OPENRTL_OP_CALL_INDIRECT, OPENRTL_ISIZE_64, dest, 0);
 }
 
 int openrtl_branch(OpenrtlBuffer *buf, uint64_t addr) {
-    return openrtl_rel(buf, OPENRTL_OP_BRANCH, 0, 0, addr);
+    return openrtl_jump(buf, OPENRTL_OP_BRANCH, addr);
 }
 
 int openrtl_branch_carry(OpenrtlBuffer *buf, uint64_t addr) {
-    return openrtl_rel(buf, OPENRTL_OP_BRANCH_CARRY, 0, 0, addr);
+    return openrtl_jump(buf, OPENRTL_OP_BRANCH_CARRY, addr);
 }
 
 int openrtl_branch_overflow(OpenrtlBuffer *buf, uint64_t addr) {
-    return openrtl_rel(buf, OPENRTL_OP_BRANCH_OVERFLOW, 0, 0, addr);
+    return openrtl_jump(buf, OPENRTL_OP_BRANCH_OVERFLOW, addr);
 }
 
 int openrtl_branch_equal(OpenrtlBuffer *buf, uint64_t addr) {
-    return openrtl_rel(buf, OPENRTL_OP_BRANCH_EQUAL, 0, 0, addr);
+    return openrtl_jump(buf, OPENRTL_OP_BRANCH_EQUAL, addr);
 }
 
 int openrtl_branch_not_equal(OpenrtlBuffer *buf, uint64_t addr) {
-    return openrtl_rel(buf, OPENRTL_OP_BRANCH_NOT_EQUAL, 0, 0, addr);
+    return openrtl_jump(buf, OPENRTL_OP_BRANCH_NOT_EQUAL, addr);
 }
 
 int openrtl_branch_less(OpenrtlBuffer *buf, uint64_t addr) {
-    return openrtl_rel(buf, OPENRTL_OP_BRANCH_LESS, 0, 0, addr);
+    return openrtl_jump(buf, OPENRTL_OP_BRANCH_LESS, addr);
 }
 
 int openrtl_branch_less_eq(OpenrtlBuffer *buf, uint64_t addr) {
-    return openrtl_rel(buf, OPENRTL_OP_BRANCH_LESS_EQ, 0, 0, addr);
+    return openrtl_jump(buf, OPENRTL_OP_BRANCH_LESS_EQ, addr);
 }
 
 int openrtl_branch_greater(OpenrtlBuffer *buf, uint64_t addr) {
-    return openrtl_rel(buf, OPENRTL_OP_BRANCH_GREATER, 0, 0, addr);
+    return openrtl_jump(buf, OPENRTL_OP_BRANCH_GREATER, addr);
 }
 
 int openrtl_branch_greater_eq(OpenrtlBuffer *buf, uint64_t addr) {
-    return openrtl_rel(buf, OPENRTL_OP_BRANCH_GREATER_EQ, 0, 0, addr);
+    return openrtl_jump(buf, OPENRTL_OP_BRANCH_GREATER_EQ, addr);
 }
 
 
@@ -250,123 +1094,71 @@ int openrtl_imodulo_signed(OpenrtlBuffer *buf, uint8_t size, uint8_t dest, uint8
 }
 
 int openrtl_imove_immediate(OpenrtlBuffer *buf, uint8_t size, uint8_t dest, uint64_t imm) {
-    int status = 0;
-    status |= openrtl_rel(buf, OPENRTL_OP_IMOVE_IMMEDIATE, size, dest, imm);
-
-    struct OpenrtlElement elem;
-    elem.offset = buf->len;
-    elem.place = OPENRTL_GP_REGISTER;
-    elem.value = OPENRTL_IMMEDIATE;
-    elem.v1.general.reg = dest;
-    elem.v1.general.size = size;
-    elem.v2.immediate = imm;
-    status |= openrtl_append(buf, &elem);
-
-    return status;
+    return openrtl_rel(buf, OPENRTL_OP_IMOVE_IMMEDIATE, size, dest, imm);
 }
 
 int openrtl_imove_unsigned(OpenrtlBuffer *buf, uint8_t size, uint8_t dest, uint8_t src, uint8_t size2) {
-    int status = 0;
-    status |= openrtl_arith_b(buf, OPENRTL_OP_IMOVE_UNSIGNED, size, dest, src, size2);
-
-    struct OpenrtlElement elem;
-    elem.offset = buf->len;
-    elem.place = OPENRTL_GP_REGISTER;
-    elem.value = OPENRTL_GP_REGISTER;
-    elem.v1.general.reg = dest;
-    elem.v1.general.size = size;
-    elem.v2.general.reg = src;
-    elem.v2.general.size = size2;
-    elem.v2.general.ext = 0;
-    status |= openrtl_append(buf, &elem);
-
-    return status;
+    return openrtl_arith_b(buf, OPENRTL_OP_IMOVE_UNSIGNED, size, dest, src, size2);
 }
 
 int openrtl_imove_signed(OpenrtlBuffer *buf, uint8_t size, uint8_t dest, uint8_t src, uint8_t size2) {
-    int status = 0;
-    status |= openrtl_arith_b(buf, OPENRTL_OP_IMOVE_SIGNED, size, dest, src, size2);
+    return openrtl_arith_b(buf, OPENRTL_OP_IMOVE_SIGNED, size, dest, src, size2);
+}
 
-    struct OpenrtlElement elem;
-    elem.offset = buf->len;
-    elem.place = OPENRTL_GP_REGISTER;
-    elem.value = OPENRTL_GP_REGISTER;
-    elem.v1.general.reg = dest;
-    elem.v1.general.size = size;
-    elem.v2.general.reg = src;
-    elem.v2.general.size = size2;
-    elem.v2.general.ext = 1;
-    status |= openrtl_append(buf, &elem);
+int openrtl_iload(OpenrtlBuffer *buf, uint8_t size, uint8_t dest, uint8_t src1, uint8_t src2) {
+    return openrtl_arith(buf, OPENRTL_OP_ILOAD, size, dest, src1, src2);
+}
 
-    return status;
+int openrtl_istore(OpenrtlBuffer *buf, uint8_t size, uint8_t dest, uint8_t src1, uint8_t src2) {
+    return openrtl_arith(buf, OPENRTL_OP_ISTORE, size, dest, src1, src2);
 }
 
-int openrtl_iload(OpenrtlBuffer *buf, uint8_t size, uint8_t dest, uint8_t src1, uint8_t src2) {
-    int status = 0;
-    status |= openrtl_arith(buf, OPENRTL_OP_ILOAD, size, dest, src1, src2);
+int openrtl_ipop(OpenrtlBuffer *buf, uint8_t dest) {
+    return openrtl_arith(buf, OPENRTL_OP_IPOP, OPENRTL_ISIZE_64, dest, 0, 0);
+}
 
-    struct OpenrtlElement elem;
-    elem.offset = buf->len;
-    elem.place = OPENRTL_GP_REGISTER;
-    elem.value = OPENRTL_MEMORY_INDIRECT;
-    elem.v1.general.reg = dest;
-    elem.v1.general.size = size;
-    elem.v2.addri.base = src1;
-    elem.v2.addri.offset = src2;
-    status |= openrtl_append(buf, &elem);
+int openrtl_ipush(OpenrtlBuffer *buf, uint8_t src) {
+    return openrtl_arith(buf, OPENRTL_OP_IPUSH, OPENRTL_ISIZE_64, src, 0, 0);
+}
 
-    return status;
+int openrtl_ishift_left(OpenrtlBuffer *buf, uint8_t size, uint8_t dest, uint8_t src, uint8_t count) {
+    return openrtl_shift(buf, size, dest, src, OPENRTL_SHIFT_LEFT, count);
 }
 
-int openrtl_istore(OpenrtlBuffer *buf, uint8_t size, uint8_t dest, uint8_t src1, uint8_t src2) {
-    int status = 0;
-    status |= openrtl_arith(buf, OPENRTL_OP_ISTORE, size, dest, src1, src2);
+int openrtl_ishift_right(OpenrtlBuffer *buf, uint8_t size, uint8_t dest, uint8_t src, uint8_t count) {
+    return openrtl_shift(buf, size, dest, src, OPENRTL_SHIFT_RIGHT, count);
+}
 
-    struct OpenrtlElement elem;
-    elem.offset = buf->len;
-    elem.place = OPENRTL_MEMORY_INDIRECT;
-    elem.value = OPENRTL_GP_REGISTER;
-    elem.v1.addri.base = src1;
-    elem.v1.addri.offset = src2;
-    elem.v2.general.reg = dest;
-    elem.v2.general.size = size;
-    status |= openrtl_append(buf, &elem);
+int openrtl_ishift_right_signed(OpenrtlBuffer *buf, uint8_t size, uint8_t dest, uint8_t src, uint8_t count) {
+    return openrtl_shift(buf, size, dest, src, OPENRTL_SHIFT_RIGHT_SIGNED, count);
+}
 
-    return status;
+int openrtl_irotate_left(OpenrtlBuffer *buf, uint8_t size, uint8_t dest, uint8_t src, uint8_t count) {
+    return openrtl_shift(buf, size, dest, src, OPENRTL_ROTATE_LEFT, count);
 }
 
-int openrtl_ipop(OpenrtlBuffer *buf, uint8_t dest) {
-    int status = 0;
-    status |= openrtl_arith(buf, OPENRTL_OP_IPOP, OPENRTL_ISIZE_64, dest, 0, 0);
+int openrtl_irotate_right(OpenrtlBuffer *buf, uint8_t size, uint8_t dest, uint8_t src, uint8_t count) {
+    return openrtl_shift(buf, size, dest, src, OPENRTL_ROTATE_LEFT, (8 << size) - count);
+}
 
-    struct OpenrtlElement elem;
-    elem.offset = buf->len;
-    elem.place = OPENRTL_GP_REGISTER;
-    elem.value = OPENRTL_MEMORY_BASE;
-    elem.v1.general.reg = dest;
-    elem.v1.general.size = OPENRTL_ISIZE_64;
-    elem.v2.addr.base = OPENRTL_RSP;
-    elem.v2.addr.offset = -8;
-    status |= openrtl_append(buf, &elem);
+int openrtl_ishift_variable(OpenrtlBuffer *buf, uint8_t size, uint8_t dest, uint8_t src, uint8_t kind) {
+    return openrtl_arith(buf, OPENRTL_OP_ISHIFT_VARIABLE, size, dest, src, kind);
+}
 
-    return status;
+int openrtl_ipopcount(OpenrtlBuffer *buf, uint8_t size, uint8_t dest, uint8_t src) {
+    return openrtl_arith(buf, OPENRTL_OP_IBITS, size, dest, src, OPENRTL_BITS_POPCOUNT);
 }
 
-int openrtl_ipush(OpenrtlBuffer *buf, uint8_t src) {
-    int status = 0;
-    status |= openrtl_arith(buf, OPENRTL_OP_IPUSH, OPENRTL_ISIZE_64, src, 0, 0);
+int openrtl_ileading_zeros(OpenrtlBuffer *buf, uint8_t size, uint8_t dest, uint8_t src) {
+    return openrtl_arith(buf, OPENRTL_OP_IBITS, size, dest, src, OPENRTL_BITS_LEADING_ZEROS);
+}
 
-    struct OpenrtlElement elem;
-    elem.offset = buf->len;
-    elem.place = OPENRTL_MEMORY_INDIRECT;
-    elem.value = OPENRTL_GP_REGISTER;
-    elem.v1.addr.base = OPENRTL_RSP;
-    elem.v1.addr.offset = 0;
-    elem.v2.general.reg = src;
-    elem.v2.general.size = OPENRTL_ISIZE_64;
-    status |= openrtl_append(buf, &elem);
+int openrtl_itrailing_zeros(OpenrtlBuffer *buf, uint8_t size, uint8_t dest, uint8_t src) {
+    return openrtl_arith(buf, OPENRTL_OP_IBITS, size, dest, src, OPENRTL_BITS_TRAILING_ZEROS);
+}
 
-    return status;
+int openrtl_ibyte_swap(OpenrtlBuffer *buf, uint8_t size, uint8_t dest, uint8_t src) {
+    return openrtl_arith(buf, OPENRTL_OP_IBITS, size, dest, src, OPENRTL_BITS_SWAP);
 }
 
 
@@ -391,89 +1183,23 @@ int openrtl_fdivide(OpenrtlBuffer *buf, uint8_t size, uint8_t dest, uint8_t src1
 }
 
 int openrtl_fmove(OpenrtlBuffer *buf, uint8_t size, uint8_t dest, uint8_t src) {
-    int status = 0;
-    status |= openrtl_arith(buf, OPENRTL_OP_FMOVE, size, dest, src, 0);
-
-    struct OpenrtlElement elem;
-    elem.offset = buf->len;
-    elem.place = OPENRTL_FP_REGISTER;
-    elem.value = OPENRTL_FP_REGISTER;
-    elem.v1.general.reg = dest;
-    elem.v1.general.size = size;
-    elem.v2.general.reg = src;
-    elem.v2.general.size = size;
-    elem.v2.general.ext = 1;
-    status |= openrtl_append(buf, &elem);
-
-    return status;
+    return openrtl_arith(buf, OPENRTL_OP_FMOVE, size, dest, src, 0);
 }
 
 int openrtl_fload(OpenrtlBuffer *buf, uint8_t size, uint8_t dest, uint8_t src1, uint8_t src2) {
-    int status = 0;
-    status |= openrtl_arith(buf, OPENRTL_OP_FLOAD, size, dest, src1, src2);
-
-    struct OpenrtlElement elem;
-    elem.offset = buf->len;
-    elem.place = OPENRTL_FP_REGISTER;
-    elem.value = OPENRTL_MEMORY_INDIRECT;
-    elem.v1.general.reg = dest;
-    elem.v1.general.size = size;
-    elem.v2.addri.base = src1;
-    elem.v2.addri.offset = src2;
-    status |= openrtl_append(buf, &elem);
-
-    return status;
+    return openrtl_arith(buf, OPENRTL_OP_FLOAD, size, dest, src1, src2);
 }
 
 int openrtl_fstore(OpenrtlBuffer *buf, uint8_t size, uint8_t dest, uint8_t src1, uint8_t src2) {
-    int status = 0;
-    status |= openrtl_arith(buf, OPENRTL_OP_FSTORE, size, dest, src1, src2);
-
-    struct OpenrtlElement elem;
-    elem.offset = buf->len;
-    elem.place = OPENRTL_MEMORY_INDIRECT;
-    elem.value = OPENRTL_FP_REGISTER;
-    elem.v1.addri.base = src1;
-    elem.v1.addri.offset = src2;
-    elem.v2.general.reg = dest;
-    elem.v2.general.size = size;
-    status |= openrtl_append(buf, &elem);
-
-    return status;
+    return openrtl_arith(buf, OPENRTL_OP_FSTORE, size, dest, src1, src2);
 }
 
 int openrtl_fpop(OpenrtlBuffer *buf, uint8_t dest) {
-    int status = 0;
-    status |= openrtl_arith(buf, OPENRTL_OP_FPOP, OPENRTL_FSIZE_64, dest, 0, 0);
-
-    struct OpenrtlElement elem;
-    elem.offset = buf->len;
-    elem.place = OPENRTL_FP_REGISTER;
-    elem.value = OPENRTL_MEMORY_BASE;
-    elem.v1.general.reg = dest;
-    elem.v1.general.size = OPENRTL_FSIZE_64;
-    elem.v2.addr.base = OPENRTL_RSP;
-    elem.v2.addr.offset = -8;
-    status |= openrtl_append(buf, &elem);
-
-    return status;
+    return openrtl_arith(buf, OPENRTL_OP_FPOP, OPENRTL_FSIZE_64, dest, 0, 0);
 }
 
 int openrtl_fpush(OpenrtlBuffer *buf, uint8_t src) {
-    int status = 0;
-    status |= openrtl_arith(buf, OPENRTL_OP_FPUSH, OPENRTL_FSIZE_64, src, 0, 0);
-
-    struct OpenrtlElement elem;
-    elem.offset = buf->len;
-    elem.place = OPENRTL_MEMORY_INDIRECT;
-    elem.value = OPENRTL_FP_REGISTER;
-    elem.v1.addr.base = OPENRTL_RSP;
-    elem.v1.addr.offset = 0;
-    elem.v2.general.reg = src;
-    elem.v2.general.size = OPENRTL_FSIZE_64;
-    status |= openrtl_append(buf, &elem);
-
-    return status;
+    return openrtl_arith(buf, OPENRTL_OP_FPUSH, OPENRTL_FSIZE_64, src, 0, 0);
 }
 
 int openrtl_f2i(OpenrtlBuffer *buf, uint8_t size, uint8_t dest, uint8_t src, uint8_t size2) {
@@ -534,37 +1260,11 @@ int openrtl_vcross(OpenrtlBuffer *buf, uint8_t size, uint8_t dest, uint8_t src1,
 }
 
 int openrtl_vload(OpenrtlBuffer *buf, uint8_t size, uint8_t dest, uint8_t src1, uint8_t src2) {
-    int status = 0;
-    status |= openrtl_arith(buf, OPENRTL_OP_VLOAD, size, dest, src1, src2);
-
-    struct OpenrtlElement elem;
-    elem.offset = buf->len;
-    elem.place = OPENRTL_V_REGISTER;
-    elem.value = OPENRTL_MEMORY_INDIRECT;
-    elem.v1.general.reg = dest;
-    elem.v1.general.size = size;
-    elem.v2.addri.base = src1;
-    elem.v2.addri.offset = src2;
-    status |= openrtl_append(buf, &elem);
-
-    return status;
+    return openrtl_arith(buf, OPENRTL_OP_VLOAD, size, dest, src1, src2);
 }
 
 int openrtl_vstore(OpenrtlBuffer *buf, uint8_t size, uint8_t dest, uint8_t src1, uint8_t src2) {
-    int status = 0;
-    status |= openrtl_arith(buf, OPENRTL_OP_VSTORE, size, dest, src1, src2);
-
-    struct OpenrtlElement elem;
-    elem.offset = buf->len;
-    elem.place = OPENRTL_MEMORY_INDIRECT;
-    elem.value = OPENRTL_V_REGISTER;
-    elem.v1.addri.base = src1;
-    elem.v1.addri.offset = src2;
-    elem.v2.general.reg = dest;
-    elem.v2.general.size = size;
-    status |= openrtl_append(buf, &elem);
-
-    return status;
+    return openrtl_arith(buf, OPENRTL_OP_VSTORE, size, dest, src1, src2);
 }
 
 int openrtl_vextend(OpenrtlBuffer *buf, uint8_t size, uint8_t dest, uint8_t src) {
@@ -576,22 +1276,20 @@ int openrtl_vtruncate(OpenrtlBuffer *buf, uint8_t size, uint8_t dest) {
 }
 
 static int openrtl_none(OpenrtlBuffer *buf, uint8_t opcode) {
-    if (buf->len + 4 > buf->cap) {
-        buf->cap *= 2;
-        buf->ptr = realloc(buf->ptr, buf->cap);
+    if (openrtl_buffer_reserve(buf, 4)) {
+        return 1;
     }
     int status = 0;
     OpenrtlInst inst = {0};
     inst.opcode = opcode;
-    memcpy((char *) buf->ptr + buf->len, &inst, 4);
+    memcpy(openrtl_buffer_end(buf), &inst, 4);
     buf->len += 4;
     return status;
 }
 
 static int openrtl_arith(OpenrtlBuffer *buf, uint8_t opcode, uint8_t size, uint8_t dest, uint8_t src1, uint8_t src2) {
-    if (buf->len + 4 > buf->cap) {
-        buf->cap *= 2;
-        buf->ptr = realloc(buf->ptr, buf->cap);
+    if (openrtl_buffer_reserve(buf, 4)) {
+        return 1;
     }
     int status = 0;
     OpenrtlInst inst = {0};
@@ -600,15 +1298,20 @@ static int openrtl_arith(OpenrtlBuffer *buf, uint8_t opcode, uint8_t size, uint8
     inst.arith.dest = dest;
     inst.arith.src1 = src1;
     inst.arith.src2 = src2;
-    memcpy((char *) buf->ptr + buf->len, &inst, 4);
+    memcpy(openrtl_buffer_end(buf), &inst, 4);
     buf->len += 4;
+    status |= openrtl_record(buf, &inst, 0);
     return status;
 }
 
+// a shift by a constant keeps its count below the width of `size`
+static int openrtl_shift(OpenrtlBuffer *buf, uint8_t size, uint8_t dest, uint8_t src, uint8_t kind, uint8_t count) {
+    return openrtl_arith(buf, OPENRTL_OP_ISHIFT, size, dest, src, kind << 6 | (count & ((8 << size) - 1)));
+}
+
 static int openrtl_arith_b(OpenrtlBuffer *buf, uint8_t opcode, uint8_t size, uint8_t dest, uint8_t src, uint8_t size2) {
-    if (buf->len + 4 > buf->cap) {
-        buf->cap *= 2;
-        buf->ptr = realloc(buf->ptr, buf->cap);
+    if (openrtl_buffer_reserve(buf, 4)) {
+        return 1;
     }
     int status = 0;
     OpenrtlInst inst = {0};
@@ -617,61 +1320,227 @@ static int openrtl_arith_b(OpenrtlBuffer *buf, uint8_t opcode, uint8_t size, uin
     inst.arith_b.dest = dest;
     inst.arith_b.src = src;
     inst.arith_b.size = size2;
-    memcpy((char *) buf->ptr + buf->len, &inst, 4);
+    memcpy(openrtl_buffer_end(buf), &inst, 4);
     buf->len += 4;
+    status |= openrtl_record(buf, &inst, 0);
     return status;
 }
 
 static int openrtl_imm(OpenrtlBuffer *buf, uint8_t opcode, uint32_t value) {
-    if (buf->len + 4 > buf->cap) {
-        buf->cap *= 2;
-        buf->ptr = realloc(buf->ptr, buf->cap);
+    if (openrtl_buffer_reserve(buf, 4)) {
+        return 1;
     }
     int status = 0;
     OpenrtlInst inst = {0};
     inst.opcode = opcode;
     inst.imm.value = value;
-    memcpy((char *) buf->ptr + buf->len, &inst, 4);
+    memcpy(openrtl_buffer_end(buf), &inst, 4);
     buf->len += 4;
     return status;
 }
 
 static int openrtl_rel(OpenrtlBuffer *buf, uint8_t opcode, uint8_t size, uint8_t dest, uint64_t value) {
-    if (buf->len + 12 > buf->cap) {
-        buf->cap *= 2;
-        buf->ptr = realloc(buf->ptr, buf->cap);
+    if (openrtl_buffer_reserve(buf, 12)) {
+        return 1;
     }
     int status = 0;
-    size_t len;
-    if (value == 0) {
-        len = 0;
-    } else if (value <= 0xff) {
-        len = 1;
-    } else if (value <= 0xffff) {
-        len = 2;
-    } else if (value <= 0xffffffff) {
-        len = 4;
-    } else {
-        len = 8;
-    }
     OpenrtlInst inst = {0};
     inst.opcode = opcode;
     inst.size = size;
     inst.rel.dest = dest;
-    inst.rel.len = len;
-    memcpy((char *) buf->ptr + buf->len, &inst, 4);
-    buf->len += 4;
-    memcpy((char *) buf->ptr + buf->len, &value, len);
-    buf->len += len;
+    size_t len = openrtl_rel_slot(buf, &inst, value);
+    char *ptr = openrtl_buffer_end(buf);
+    memcpy(ptr, &inst, 4);
+    memcpy(ptr + 4, &value, len);
+    buf->len += 4 + len;
+    status |= openrtl_record(buf, &inst, value);
     return status;
 }
 
-static int openrtl_append(OpenrtlBuffer *buf, struct OpenrtlElement *elem) {
-    if (buf->matrix.len + 1 > buf->matrix.cap) {
-        buf->matrix.cap *= 2;
-        buf->matrix.ptr = realloc(buf->matrix.ptr, buf->matrix.cap);
+static int openrtl_jump(OpenrtlBuffer *buf, uint8_t opcode, uint64_t addr) {
+    OpenrtlInst inst = {0};
+    inst.opcode = opcode;
+    openrtl_jump_operand(buf, &inst, &addr);
+    return openrtl_rel(buf, opcode, inst.size, 0, addr);
+}
+
+// in pc-relative mode only a reference to a local symbol, which is
+// expected to name a label, is encoded as a displacement. a literal
+// operand is an address and global addresses do not live in the buffer
+static void openrtl_jump_operand(OpenrtlBuffer *buf, OpenrtlInst *inst, uint64_t *addr) {
+    struct OpenrtlSymbol *sym = openrtl_pending(buf);
+    if (buf->pcrel && sym && sym->type == OPENRTL_SYMBOL_LOCAL) {
+        inst->size = OPENRTL_REL_PC;
+        *addr -= buf->len;
+    } else {
+        inst->size = OPENRTL_REL_ABSOLUTE;
     }
+}
 
-    buf->matrix.ptr[buf->matrix.len++] = *elem;
+// sets the operand width of `inst` for `value` at the end of the buffer.
+// an operand that the linker patches later gets a full slot, which
+// `openrtl_relax` narrows for local symbols only
+static size_t openrtl_rel_slot(OpenrtlBuffer *buf, OpenrtlInst *inst, uint64_t value) {
+    size_t len = openrtl_inst_rel_len(inst, value);
+    struct OpenrtlSymbol *sym = openrtl_pending(buf);
+    if (sym) {
+        sym->relative = openrtl_is_pcrel(inst);
+        len = 8;
+    }
+    inst->rel.len = len;
+    return len;
+}
+
+// the symbol declared for the operand of the next instruction, if any
+static struct OpenrtlSymbol *openrtl_pending(OpenrtlBuffer *buf) {
+    if (buf->linker.len && buf->linker.ptr[buf->linker.len - 1].offset == buf->len + 4) {
+        return buf->linker.ptr + buf->linker.len - 1;
+    }
+    return NULL;
+}
+
+// the matrix element the single emitters record for `inst`
+static int openrtl_element(const OpenrtlInst *inst, uint64_t value, struct OpenrtlElement *elem) {
+    memset(elem, 0, sizeof(struct OpenrtlElement));
+    switch (inst->opcode) {
+    case OPENRTL_OP_IMOVE_IMMEDIATE:
+        elem->place = OPENRTL_GP_REGISTER;
+        elem->value = OPENRTL_IMMEDIATE;
+        elem->v1.general.reg = inst->rel.dest;
+        elem->v1.general.size = inst->size;
+        elem->v2.immediate = value;
+        return 1;
+    case OPENRTL_OP_IMOVE_UNSIGNED:
+    case OPENRTL_OP_IMOVE_SIGNED:
+        elem->place = OPENRTL_GP_REGISTER;
+        elem->value = OPENRTL_GP_REGISTER;
+        elem->v1.general.reg = inst->arith_b.dest;
+        elem->v1.general.size = inst->size;
+        elem->v2.general.reg = inst->arith_b.src;
+        elem->v2.general.size = inst->arith_b.size;
+        elem->v2.general.ext = inst->opcode == OPENRTL_OP_IMOVE_SIGNED;
+        return 1;
+    case OPENRTL_OP_FMOVE:
+        elem->place = OPENRTL_FP_REGISTER;
+        elem->value = OPENRTL_FP_REGISTER;
+        elem->v1.general.reg = inst->arith.dest;
+        elem->v1.general.size = inst->size;
+        elem->v2.general.reg = inst->arith.src1;
+        elem->v2.general.size = inst->size;
+        elem->v2.general.ext = 1;
+        return 1;
+    case OPENRTL_OP_ILOAD:
+    case OPENRTL_OP_FLOAD:
+    case OPENRTL_OP_VLOAD:
+        elem->place = inst->opcode == OPENRTL_OP_ILOAD ? OPENRTL_GP_REGISTER
+            : inst->opcode == OPENRTL_OP_FLOAD ? OPENRTL_FP_REGISTER
+            : OPENRTL_V_REGISTER;
+        elem->value = OPENRTL_MEMORY_INDIRECT;
+        elem->v1.general.reg = inst->arith.dest;
+        elem->v1.general.size = inst->size;
+        elem->v2.addri.base = inst->arith.src1;
+        elem->v2.addri.offset = inst->arith.src2;
+        return 1;
+    case OPENRTL_OP_ISTORE:
+    case OPENRTL_OP_FSTORE:
+    case OPENRTL_OP_VSTORE:
+        elem->place = OPENRTL_MEMORY_INDIRECT;
+        elem->value = inst->opcode == OPENRTL_OP_ISTORE ? OPENRTL_GP_REGISTER
+            : inst->opcode == OPENRTL_OP_FSTORE ? OPENRTL_FP_REGISTER
+            : OPENRTL_V_REGISTER;
+        elem->v1.addri.base = inst->arith.src1;
+        elem->v1.addri.offset = inst->arith.src2;
+        elem->v2.general.reg = inst->arith.dest;
+        elem->v2.general.size = inst->size;
+        return 1;
+    case OPENRTL_OP_IPOP:
+    case OPENRTL_OP_FPOP:
+        elem->place = inst->opcode == OPENRTL_OP_IPOP ? OPENRTL_GP_REGISTER : OPENRTL_FP_REGISTER;
+        elem->value = OPENRTL_MEMORY_BASE;
+        elem->v1.general.reg = inst->arith.dest;
+        elem->v1.general.size = inst->size;
+        elem->v2.addr.base = OPENRTL_RSP;
+        elem->v2.addr.offset = -8;
+        return 1;
+    case OPENRTL_OP_IPUSH:
+    case OPENRTL_OP_FPUSH:
+        elem->place = OPENRTL_MEMORY_INDIRECT;
+        elem->value = inst->opcode == OPENRTL_OP_IPUSH ? OPENRTL_GP_REGISTER : OPENRTL_FP_REGISTER;
+        elem->v1.addr.base = OPENRTL_RSP;
+        elem->v1.addr.offset = 0;
+        elem->v2.general.reg = inst->arith.dest;
+        elem->v2.general.size = inst->size;
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+// records the element of the instruction that was just emitted, unless
+// recording is turned off for the buffer
+static int openrtl_record(OpenrtlBuffer *buf, const OpenrtlInst *inst, uint64_t value) {
+    struct OpenrtlElement elem;
+    if (!buf->record || !openrtl_element(inst, value, &elem)) {
+        return 0;
+    }
+    elem.offset = buf->len;
+    return openrtl_matrix_append(&buf->matrix, &elem);
+}
+
+// rebuilds the matrix from the code, for buffers emitted without
+// recording or rewritten since
+int openrtl_matrix_build(OpenrtlBuffer *buf) {
+    openrtl_reset_matrix(&buf->matrix);
+    OpenrtlIter it;
+    openrtl_iter(&it, buf);
+    while (openrtl_iter_next(&it)) {
+        struct OpenrtlElement elem;
+        if (openrtl_element(&it.inst, it.operand, &elem)) {
+            elem.offset = it.next;
+            if (openrtl_matrix_append(&buf->matrix, &elem)) {
+                return 1;
+            }
+        }
+    }
     return 0;
 }
+
+// the old index is kept when the new one cannot be allocated, it still
+// holds every entry
+static int openrtl_table_rehash(OpenrtlTable *table) {
+    size_t *index = openrtl_calloc(table->allocator, 2 * table->cap, sizeof(size_t));
+    if (!index) {
+        return 1;
+    }
+    openrtl_free(table->allocator, table->index);
+    table->index = index;
+    table->mask = 2 * table->cap - 1;
+    openrtl_table_fill(table);
+    return 0;
+}
+
+static void openrtl_strings_rehash(OpenrtlStrings *strings) {
+    size_t mask = strings->cap - 1;
+    const char **index = openrtl_calloc(strings->allocator, strings->cap, sizeof(const char *));
+    for (size_t i = 0; i < strings->cap / 2; i++) {
+        const char *name = strings->index[i];
+        if (name) {
+            size_t slot = openrtl_hash(name) & mask;
+            while (index[slot]) {
+                slot = (slot + 1) & mask;
+            }
+            index[slot] = name;
+        }
+    }
+    openrtl_free(strings->allocator, strings->index);
+    strings->index = index;
+}
+
+static OpenrtlStrings *openrtl_buffer_strings(OpenrtlBuffer *buf) {
+    if (!buf->strings) {
+        buf->strings = openrtl_malloc(buf->allocator, sizeof(OpenrtlStrings));
+        openrtl_strings(buf->strings, buf->allocator);
+        buf->own_strings = 1;
+    }
+    return buf->strings;
+}
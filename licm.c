@@ -0,0 +1,302 @@
+#include <string.h>
+#include "include/openrtl.h"
+#include "internal.h"
+
+static int openrtl_licm_round(OpenrtlBuffer *buf, int *hoisted);
+static int openrtl_licm_live(const struct OpenrtlRewrite *rw, const OpenrtlCfg *cfg, struct OpenrtlRegSet *in);
+static void openrtl_licm_block(const struct OpenrtlRewrite *rw, const OpenrtlCfg *cfg, const struct OpenrtlRegSet *in, size_t b, struct OpenrtlRegSet *live);
+static int openrtl_licm_loop(struct OpenrtlRewrite *rw, const OpenrtlCfg *cfg, const struct OpenrtlRegSet *in, const uint8_t *entry, uint8_t *inloop, size_t l, size_t *hoisted);
+static size_t openrtl_licm_preheader(const struct OpenrtlRewrite *rw, const OpenrtlCfg *cfg, const uint8_t *inloop, size_t h);
+
+// instructions that are cheap to run once more than the loop would have,
+// loads only when nothing in the loop writes memory
+static int openrtl_licm_pure(unsigned int opcode) {
+    switch (opcode) {
+    case OPENRTL_OP_IADD:
+    case OPENRTL_OP_IAND:
+    case OPENRTL_OP_IOR:
+    case OPENRTL_OP_IXOR:
+    case OPENRTL_OP_ISUBTRACT:
+    case OPENRTL_OP_IMULTIPLY_UNSIGNED:
+    case OPENRTL_OP_IMULTIPLY_SIGNED:
+    case OPENRTL_OP_IMOVE_IMMEDIATE:
+    case OPENRTL_OP_IMOVE_UNSIGNED:
+    case OPENRTL_OP_IMOVE_SIGNED:
+    case OPENRTL_OP_ISHIFT:
+    case OPENRTL_OP_IBITS:
+    case OPENRTL_OP_FADD:
+    case OPENRTL_OP_FSUBTRACT:
+    case OPENRTL_OP_FMULTIPLY:
+    case OPENRTL_OP_FMOVE:
+    case OPENRTL_OP_ILOAD:
+    case OPENRTL_OP_FLOAD:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+// moves invariant instructions out of loops into the code that enters
+// them, inner loops first. a loop is left alone when it calls out, when
+// it can be entered other than through its header or when its header is
+// entered from outside by more than one edge
+int openrtl_hoist_invariants(OpenrtlBuffer *buf) {
+    int hoisted;
+    do {
+        if (openrtl_licm_round(buf, &hoisted)) {
+            return 1;
+        }
+    } while (hoisted);
+    return 0;
+}
+
+// hoists out of the first loop that has anything to hoist, the graph is
+// built again for the next
+static int openrtl_licm_round(OpenrtlBuffer *buf, int *hoisted) {
+    *hoisted = 0;
+    struct OpenrtlRewrite rw;
+    OpenrtlCfg cfg;
+    if (openrtl_rewrite(&rw, buf)) {
+        openrtl_del_rewrite(&rw);
+        return 1;
+    }
+    if (openrtl_cfg(&cfg, buf)) {
+        openrtl_del_cfg(&cfg);
+        openrtl_del_rewrite(&rw);
+        return 1;
+    }
+    if (!cfg.loops.len) {
+        openrtl_del_cfg(&cfg);
+        openrtl_del_rewrite(&rw);
+        return 0;
+    }
+
+    struct OpenrtlRegSet *in = openrtl_calloc(rw.allocator, cfg.len, sizeof(struct OpenrtlRegSet));
+    uint8_t *inloop = openrtl_malloc(rw.allocator, cfg.len);
+    uint8_t *entry = openrtl_rewrite_entries(&rw, buf);
+    int status = !in || !inloop || !entry || openrtl_licm_live(&rw, &cfg, in);
+    size_t count = 0;
+    for (size_t l = cfg.loops.len; l-- > 0 && !status && !count;) {
+        status = openrtl_licm_loop(&rw, &cfg, in, entry, inloop, l, &count);
+    }
+
+    openrtl_free(rw.allocator, in);
+    openrtl_free(rw.allocator, inloop);
+    openrtl_free(rw.allocator, entry);
+    openrtl_del_cfg(&cfg);
+    if (!status && count) {
+        status = openrtl_rewrite_commit(&rw, buf);
+        *hoisted = 1;
+    }
+    openrtl_del_rewrite(&rw);
+    return status;
+}
+
+// registers live on entry to every block. every register is taken to be
+// read where control leaves the buffer or calls out
+static int openrtl_licm_live(const struct OpenrtlRewrite *rw, const OpenrtlCfg *cfg, struct OpenrtlRegSet *in) {
+    int changed;
+    do {
+        changed = 0;
+        for (size_t b = cfg->len; b-- > 0;) {
+            struct OpenrtlRegSet live;
+            openrtl_licm_block(rw, cfg, in, b, &live);
+            if (memcmp(&live, in + b, sizeof(live))) {
+                in[b] = live;
+                changed = 1;
+            }
+        }
+    } while (changed);
+    return 0;
+}
+
+static void openrtl_licm_block(const struct OpenrtlRewrite *rw, const OpenrtlCfg *cfg, const struct OpenrtlRegSet *in, size_t b, struct OpenrtlRegSet *live) {
+    const struct OpenrtlBlock *block = cfg->blocks + b;
+    memset(live, block->exit ? 0xff : 0, sizeof(*live));
+    for (size_t s = 0; s < block->nsucc; s++) {
+        for (size_t w = 0; w < OPENRTL_REGSET_WORDS; w++) {
+            live->bits[w] |= in[block->succ[s]].bits[w];
+        }
+    }
+    for (size_t at = block->last; at-- > block->first;) {
+        const OpenrtlInst *inst = &rw->ptr[at].inst;
+        if (inst->opcode == OPENRTL_OP_CALL || inst->opcode == OPENRTL_OP_CALL_INDIRECT || inst->opcode == OPENRTL_OP_RETURN) {
+            memset(live, 0xff, sizeof(*live));
+            continue;
+        }
+        struct OpenrtlInstRegs regs;
+        openrtl_inst_regs(inst, &regs);
+        if (regs.ndef) {
+            openrtl_regset_del(live, regs.def_file, regs.def);
+        }
+        for (size_t i = 0; i < regs.nuse; i++) {
+            openrtl_regset_add(live, regs.use_file[i], regs.use[i]);
+        }
+    }
+}
+
+// hoists what is invariant in loop `l` and leaves the number of
+// instructions that were in `hoisted`
+static int openrtl_licm_loop(struct OpenrtlRewrite *rw, const OpenrtlCfg *cfg, const struct OpenrtlRegSet *in, const uint8_t *entry, uint8_t *inloop, size_t l, size_t *hoisted) {
+    size_t h = cfg->loops.ptr[l].header;
+    for (size_t b = 0; b < cfg->len; b++) {
+        size_t loop = cfg->blocks[b].loop;
+        while (loop && loop != l + 1) {
+            loop = cfg->loops.ptr[loop - 1].parent;
+        }
+        inloop[b] = loop == l + 1;
+        if (inloop[b] && entry[cfg->blocks[b].first]) {
+            return 0;
+        }
+    }
+    size_t at = openrtl_licm_preheader(rw, cfg, inloop, h);
+    if (at == rw->len) {
+        return 0;
+    }
+
+    // definitions in the loop of every register, and what may be read
+    // once the loop is left
+    uint16_t defs[OPENRTL_REG_SLOTS] = {0};
+    struct OpenrtlRegSet out = { { 0 } };
+    int memory = 0;
+    for (size_t b = 0; b < cfg->len; b++) {
+        const struct OpenrtlBlock *block = cfg->blocks + b;
+        if (!inloop[b]) {
+            continue;
+        }
+        for (size_t i = block->first; i < block->last; i++) {
+            unsigned int opcode = rw->ptr[i].inst.opcode;
+            if (opcode == OPENRTL_OP_CALL || opcode == OPENRTL_OP_CALL_INDIRECT) {
+                return 0;
+            }
+            memory |= opcode == OPENRTL_OP_ISTORE || opcode == OPENRTL_OP_FSTORE || opcode == OPENRTL_OP_VSTORE
+                || opcode == OPENRTL_OP_IPUSH || opcode == OPENRTL_OP_FPUSH || opcode == OPENRTL_OP_IPOP || opcode == OPENRTL_OP_FPOP;
+            struct OpenrtlInstRegs regs;
+            openrtl_inst_regs(&rw->ptr[i].inst, &regs);
+            size_t d = openrtl_reg_slot(regs.def_file, regs.def);
+            if (regs.ndef && defs[d] < UINT16_MAX) {
+                defs[d]++;
+            }
+        }
+        if (block->exit) {
+            memset(&out, 0xff, sizeof(out));
+        }
+        for (size_t s = 0; s < block->nsucc; s++) {
+            if (!inloop[block->succ[s]]) {
+                for (size_t w = 0; w < OPENRTL_REGSET_WORDS; w++) {
+                    out.bits[w] |= in[block->succ[s]].bits[w];
+                }
+            }
+        }
+    }
+    // the header may test flags set before the loop, which hoisted
+    // arithmetic would overwrite. an unconditional branch to the header
+    // leaves them as they are
+    int flags = openrtl_rewrite_flags(rw, cfg->blocks[h].first - 1);
+
+    size_t *moved = openrtl_malloc(rw->allocator, rw->len * sizeof(size_t));
+    if (!moved) {
+        return 1;
+    }
+    size_t len = 0;
+    int changed;
+    do {
+        changed = 0;
+        for (size_t b = 0; b < cfg->len; b++) {
+            const struct OpenrtlBlock *block = cfg->blocks + b;
+            if (!inloop[b]) {
+                continue;
+            }
+            // whether the block runs on every iteration that leaves the
+            // loop, so hoisting cannot change what is seen after it
+            int always = 1;
+            for (size_t e = 0; e < cfg->len && always; e++) {
+                const struct OpenrtlBlock *exit = cfg->blocks + e;
+                int leaves = inloop[e] && exit->exit;
+                for (size_t s = 0; s < exit->nsucc && inloop[e]; s++) {
+                    leaves |= !inloop[exit->succ[s]];
+                }
+                always = !leaves || openrtl_cfg_dominates(cfg, b, e);
+            }
+
+            for (size_t i = block->first; i < block->last; i++) {
+                struct OpenrtlRewriteInst *it = rw->ptr + i;
+                unsigned int opcode = it->inst.opcode;
+                if (it->dead || it->symbol || !openrtl_licm_pure(opcode)) {
+                    continue;
+                }
+                int load = opcode == OPENRTL_OP_ILOAD || opcode == OPENRTL_OP_FLOAD;
+                if (load && (memory || !always)) {
+                    continue;
+                }
+                struct OpenrtlInstRegs regs;
+                openrtl_inst_regs(&it->inst, &regs);
+                size_t d = openrtl_reg_slot(regs.def_file, regs.def);
+                int invariant = defs[d] == 1 && !openrtl_regset_has(in + h, regs.def_file, regs.def)
+                    && (always || !openrtl_regset_has(&out, regs.def_file, regs.def));
+                for (size_t u = 0; u < regs.nuse && invariant; u++) {
+                    invariant = defs[openrtl_reg_slot(regs.use_file[u], regs.use[u])] == 0;
+                }
+                if (invariant && openrtl_sets_flags(opcode)) {
+                    invariant = !flags && !openrtl_rewrite_flags(rw, i);
+                }
+                if (!invariant) {
+                    continue;
+                }
+                it->dead = 1;
+                defs[d] = 0;
+                moved[len++] = i;
+                changed = 1;
+            }
+        }
+    } while (changed);
+
+    // in the order they were found, which is an order their operands
+    // are defined in
+    int status = 0;
+    for (size_t i = 0; i < len && !status; i++) {
+        size_t from = moved[i] + (moved[i] >= at ? i : 0);
+        OpenrtlInst inst = rw->ptr[from].inst;
+        uint64_t operand = rw->ptr[from].operand;
+        status = openrtl_rewrite_insert(rw, at + i, &inst, operand);
+    }
+    openrtl_free(rw->allocator, moved);
+    *hoisted = len;
+    return status;
+}
+
+// where hoisted instructions go so that they run once before the loop of
+// header `h` is entered, the number of instructions when there is no
+// such place. that is before the header when it is only entered from
+// outside by falling into it, or before an unconditional branch to it
+static size_t openrtl_licm_preheader(const struct OpenrtlRewrite *rw, const OpenrtlCfg *cfg, const uint8_t *inloop, size_t h) {
+    const struct OpenrtlBlock *header = cfg->blocks + h;
+    size_t outside = cfg->len;
+    for (size_t p = 0; p < header->npred; p++) {
+        size_t pred = cfg->preds[header->pred + p];
+        if (inloop[pred]) {
+            continue;
+        }
+        if (outside != cfg->len) {
+            return rw->len;
+        }
+        outside = pred;
+    }
+    if (outside == cfg->len || cfg->blocks[outside].rpo >= cfg->reachable || header->first == 0) {
+        return rw->len;
+    }
+
+    const struct OpenrtlBlock *pred = cfg->blocks + outside;
+    unsigned int last = rw->ptr[pred->last - 1].inst.opcode;
+    // branches to the block would land after what is inserted before
+    // its branch, so it must hold something else
+    if (last == OPENRTL_OP_BRANCH) {
+        return pred->nsucc == 1 && pred->last - 1 > pred->first ? pred->last - 1 : rw->len;
+    }
+    // a conditional branch that falls into the header must go elsewhere
+    // when taken
+    if (outside + 1 == h && (!openrtl_is_branch(last) || (pred->nsucc == 2 && pred->succ[0] != pred->succ[1]))) {
+        return header->first;
+    }
+    return rw->len;
+}
@@ -0,0 +1,94 @@
+#include <string.h>
+#include "include/openrtl.h"
+#include "internal.h"
+
+// recomputes the sets of block `b`, returns whether its live-in changed
+static int openrtl_liveness_block(OpenrtlLiveness *live, const OpenrtlCfg *cfg, const struct OpenrtlRegSet *use, const struct OpenrtlRegSet *def, size_t b) {
+    const struct OpenrtlBlock *block = cfg->blocks + b;
+    struct OpenrtlRegSet out = { { 0 } };
+    for (size_t s = 0; s < block->nsucc; s++) {
+        for (size_t w = 0; w < OPENRTL_REGSET_WORDS; w++) {
+            out.bits[w] |= live->in[block->succ[s]].bits[w];
+        }
+    }
+    live->out[b] = out;
+    int changed = 0;
+    for (size_t w = 0; w < OPENRTL_REGSET_WORDS; w++) {
+        uint64_t in = use[b].bits[w] | (out.bits[w] & ~def[b].bits[w]);
+        if (in != live->in[b].bits[w]) {
+            live->in[b].bits[w] = in;
+            changed = 1;
+        }
+    }
+    return changed;
+}
+
+int openrtl_regset_has(const struct OpenrtlRegSet *set, int file, uint8_t reg) {
+    size_t slot = openrtl_reg_slot(file, reg);
+    return (set->bits[slot >> 6] >> (slot & 63)) & 1;
+}
+
+// registers live on entry to and on exit from every block of `cfg`,
+// which was built from `buf`. nothing is live once control leaves the
+// buffer
+int openrtl_liveness(OpenrtlLiveness *live, const OpenrtlCfg *cfg, const OpenrtlBuffer *buf) {
+    live->allocator = cfg->allocator;
+    live->len = cfg->len;
+    live->in = openrtl_calloc(live->allocator, cfg->len ? cfg->len : 1, sizeof(struct OpenrtlRegSet));
+    live->out = openrtl_calloc(live->allocator, cfg->len ? cfg->len : 1, sizeof(struct OpenrtlRegSet));
+    // registers a block reads before it writes them, and those it writes
+    struct OpenrtlRegSet *use = openrtl_calloc(live->allocator, cfg->len ? cfg->len : 1, sizeof(struct OpenrtlRegSet));
+    struct OpenrtlRegSet *def = openrtl_calloc(live->allocator, cfg->len ? cfg->len : 1, sizeof(struct OpenrtlRegSet));
+    if (!live->in || !live->out || !use || !def) {
+        openrtl_free(live->allocator, live->in);
+        openrtl_free(live->allocator, live->out);
+        openrtl_free(live->allocator, use);
+        openrtl_free(live->allocator, def);
+        live->in = NULL;
+        live->out = NULL;
+        return 1;
+    }
+
+    for (size_t b = 0; b < cfg->len; b++) {
+        const struct OpenrtlBlock *block = cfg->blocks + b;
+        OpenrtlIter iter;
+        openrtl_iter(&iter, buf);
+        iter.next = block->start;
+        while (iter.next < block->end && openrtl_iter_next(&iter)) {
+            struct OpenrtlInstRegs regs;
+            openrtl_inst_regs(&iter.inst, &regs);
+            for (size_t i = 0; i < regs.nuse; i++) {
+                if (!openrtl_regset_has(def + b, regs.use_file[i], regs.use[i])) {
+                    openrtl_regset_add(use + b, regs.use_file[i], regs.use[i]);
+                }
+            }
+            if (regs.ndef) {
+                openrtl_regset_add(def + b, regs.def_file, regs.def);
+            }
+        }
+    }
+
+    // a backward problem, so reachable blocks are visited in postorder,
+    // which converges in a few passes on reducible code
+    int changed;
+    do {
+        changed = 0;
+        for (size_t i = cfg->reachable; i-- > 0;) {
+            changed |= openrtl_liveness_block(live, cfg, use, def, cfg->order[i]);
+        }
+        for (size_t b = cfg->len; b-- > 0;) {
+            if (cfg->blocks[b].rpo >= cfg->reachable) {
+                changed |= openrtl_liveness_block(live, cfg, use, def, b);
+            }
+        }
+    } while (changed);
+
+    openrtl_free(live->allocator, use);
+    openrtl_free(live->allocator, def);
+    return 0;
+}
+
+void openrtl_del_liveness(OpenrtlLiveness *live) {
+    openrtl_free(live->allocator, live->in);
+    openrtl_free(live->allocator, live->out);
+}
@@ -0,0 +1,275 @@
+#include <string.h>
+#include "include/openrtl.h"
+#include "internal.h"
+
+#define DEFAULT_MATRIX_CAP 256
+#define DEFAULT_WIDE_CAP 16
+#define MATRIX_REGS 256
+// an operand column holding an index into `wide`
+#define MATRIX_WIDE 0x80000000u
+
+static int openrtl_matrix_chain(OpenrtlMatrix *matrix);
+static uint32_t openrtl_matrix_pack(int kind, const union OpenrtlOperand *op);
+static void openrtl_matrix_unpack(const OpenrtlMatrix *matrix, int kind, uint32_t packed, union OpenrtlOperand *op);
+static int openrtl_matrix_operand(OpenrtlMatrix *matrix, int kind, const union OpenrtlOperand *op, uint32_t *packed);
+
+// register file defined by an element placed in `place`, or -1
+static int openrtl_matrix_file(int place) {
+    switch (place) {
+    case OPENRTL_GP_REGISTER:
+        return 0;
+    case OPENRTL_FP_REGISTER:
+        return 1;
+    case OPENRTL_V_REGISTER:
+        return 2;
+    default:
+        return -1;
+    }
+}
+
+// nothing is allocated until the first element is appended
+void openrtl_matrix(OpenrtlMatrix *matrix, const OpenrtlAllocator *allocator) {
+    matrix->allocator = allocator;
+    matrix->cap = 0;
+    matrix->len = 0;
+    matrix->offset = NULL;
+    matrix->v1 = NULL;
+    matrix->v2 = NULL;
+    matrix->place = NULL;
+    matrix->value = NULL;
+    matrix->wide.cap = 0;
+    matrix->wide.len = 0;
+    matrix->wide.ptr = NULL;
+    matrix->prev = NULL;
+    matrix->next = NULL;
+    matrix->last = NULL;
+}
+
+void openrtl_del_matrix(OpenrtlMatrix *matrix) {
+    openrtl_free(matrix->allocator, matrix->offset);
+    openrtl_free(matrix->allocator, matrix->wide.ptr);
+    openrtl_free(matrix->allocator, matrix->prev);
+    openrtl_free(matrix->allocator, matrix->last);
+}
+
+void openrtl_reset_matrix(OpenrtlMatrix *matrix) {
+    matrix->len = 0;
+    matrix->wide.len = 0;
+    if (matrix->last) {
+        memset(matrix->last, 0, 3 * MATRIX_REGS * sizeof(uint32_t));
+    }
+}
+
+// bytes of every column of an element
+#define MATRIX_ROW (3 * sizeof(uint32_t) + 2 * sizeof(uint8_t))
+
+// the columns share one allocation, widest first so that every column
+// stays aligned. links are 32 bits, so is the number of elements
+int openrtl_matrix_reserve(OpenrtlMatrix *matrix, size_t len) {
+    if (matrix->len + len <= matrix->cap) {
+        return 0;
+    }
+    if (len > UINT32_MAX - matrix->len) {
+        return 1;
+    }
+    size_t cap = matrix->cap ? matrix->cap : DEFAULT_MATRIX_CAP;
+    while (matrix->len + len > cap) {
+        cap *= 2;
+    }
+    char *ptr = openrtl_malloc(matrix->allocator, cap * MATRIX_ROW);
+    if (!ptr) {
+        return 1;
+    }
+    uint32_t *chain = NULL;
+    if (matrix->last) {
+        chain = openrtl_realloc(matrix->allocator, matrix->prev, 2 * matrix->cap * sizeof(uint32_t), 2 * cap * sizeof(uint32_t));
+        if (!chain) {
+            openrtl_free(matrix->allocator, ptr);
+            return 1;
+        }
+        memmove(chain + cap, chain + matrix->cap, matrix->len * sizeof(uint32_t));
+    }
+
+    OpenrtlMatrix next = *matrix;
+    next.offset = (uint32_t *) ptr;
+    next.v1 = next.offset + cap;
+    next.v2 = next.v1 + cap;
+    next.place = (uint8_t *) (next.v2 + cap);
+    next.value = next.place + cap;
+    if (matrix->len) {
+        memcpy(next.offset, matrix->offset, matrix->len * sizeof(uint32_t));
+        memcpy(next.v1, matrix->v1, matrix->len * sizeof(uint32_t));
+        memcpy(next.v2, matrix->v2, matrix->len * sizeof(uint32_t));
+        memcpy(next.place, matrix->place, matrix->len);
+        memcpy(next.value, matrix->value, matrix->len);
+    }
+    if (chain) {
+        next.prev = chain;
+        next.next = chain + cap;
+    }
+    openrtl_free(matrix->allocator, matrix->offset);
+    next.cap = cap;
+    *matrix = next;
+    return 0;
+}
+
+// fails for an element past the first 4 GiB of code, whose offset does
+// not fit its column
+int openrtl_matrix_append(OpenrtlMatrix *matrix, const struct OpenrtlElement *elem) {
+    if (elem->offset > UINT32_MAX || openrtl_matrix_reserve(matrix, 1)) {
+        return 1;
+    }
+
+    size_t i = matrix->len;
+    if (openrtl_matrix_operand(matrix, elem->place, &elem->v1, matrix->v1 + i)
+        || openrtl_matrix_operand(matrix, elem->value, &elem->v2, matrix->v2 + i)) {
+        return 1;
+    }
+    matrix->offset[i] = elem->offset;
+    matrix->place[i] = elem->place;
+    matrix->value[i] = elem->value;
+    matrix->len++;
+    if (matrix->last) {
+        openrtl_matrix_links(matrix, i, matrix->prev, matrix->next, matrix->last);
+    }
+    return 0;
+}
+
+void openrtl_matrix_get(const OpenrtlMatrix *matrix, size_t i, struct OpenrtlElement *elem) {
+    elem->offset = matrix->offset[i];
+    elem->place = matrix->place[i];
+    elem->value = matrix->value[i];
+    openrtl_matrix_unpack(matrix, elem->place, matrix->v1[i], &elem->v1);
+    openrtl_matrix_unpack(matrix, elem->value, matrix->v2[i], &elem->v2);
+}
+
+// chains the elements from `from` on into `prev`, `next` and `last`
+void openrtl_matrix_links(const OpenrtlMatrix *matrix, size_t from, uint32_t *prev, uint32_t *next, uint32_t *last) {
+    for (size_t i = from; i < matrix->len; i++) {
+        prev[i] = 0;
+        next[i] = 0;
+        int file = openrtl_matrix_file(matrix->place[i]);
+        if (file < 0) {
+            continue;
+        }
+        union OpenrtlOperand v1;
+        openrtl_matrix_unpack(matrix, matrix->place[i], matrix->v1[i], &v1);
+        uint32_t *at = last + file * MATRIX_REGS + v1.general.reg;
+        if (*at) {
+            next[*at - 1] = i + 1;
+        }
+        prev[i] = *at;
+        *at = i + 1;
+    }
+}
+
+// index plus one of the latest element that defines `reg`, or zero. the
+// chains are built by the first query, zero is also returned when that
+// fails
+size_t openrtl_matrix_last_def(OpenrtlMatrix *matrix, int place, uint8_t reg) {
+    int file = openrtl_matrix_file(place);
+    return file >= 0 && !openrtl_matrix_chain(matrix) ? matrix->last[file * MATRIX_REGS + reg] : 0;
+}
+
+size_t openrtl_matrix_prev_def(OpenrtlMatrix *matrix, size_t i) {
+    return openrtl_matrix_chain(matrix) ? 0 : matrix->prev[i];
+}
+
+size_t openrtl_matrix_next_def(OpenrtlMatrix *matrix, size_t i) {
+    return openrtl_matrix_chain(matrix) ? 0 : matrix->next[i];
+}
+
+// builds the chains, which appending keeps up to date from then on
+static int openrtl_matrix_chain(OpenrtlMatrix *matrix) {
+    if (matrix->last) {
+        return 0;
+    }
+    if (!matrix->cap && openrtl_matrix_reserve(matrix, 1)) {
+        return 1;
+    }
+    uint32_t *chain = openrtl_malloc(matrix->allocator, 2 * matrix->cap * sizeof(uint32_t));
+    uint32_t *last = openrtl_calloc(matrix->allocator, 3 * MATRIX_REGS, sizeof(uint32_t));
+    if (!chain || !last) {
+        openrtl_free(matrix->allocator, chain);
+        openrtl_free(matrix->allocator, last);
+        return 1;
+    }
+    matrix->prev = chain;
+    matrix->next = chain + matrix->cap;
+    matrix->last = last;
+    openrtl_matrix_links(matrix, 0, matrix->prev, matrix->next, matrix->last);
+    return 0;
+}
+
+// the operand in 31 bits as `kind` uses it, registers take their number,
+// size and extension, memory its base and a short offset and immediates
+// their low bits
+static uint32_t openrtl_matrix_pack(int kind, const union OpenrtlOperand *op) {
+    switch (kind) {
+    case OPENRTL_GP_REGISTER:
+    case OPENRTL_FP_REGISTER:
+    case OPENRTL_V_REGISTER:
+        return op->general.reg | (uint32_t) op->general.size << 8 | (uint32_t) op->general.ext << 16;
+    case OPENRTL_MEMORY_INDIRECT:
+        return op->addri.base | (uint32_t) op->addri.offset << 8;
+    case OPENRTL_MEMORY_BASE:
+        return op->addr.base | ((uint32_t) op->addr.offset & 0x7fffff) << 8;
+    default:
+        return op->immediate & ~MATRIX_WIDE;
+    }
+}
+
+static void openrtl_matrix_unpack(const OpenrtlMatrix *matrix, int kind, uint32_t packed, union OpenrtlOperand *op) {
+    if (packed & MATRIX_WIDE) {
+        *op = matrix->wide.ptr[packed & ~MATRIX_WIDE];
+        return;
+    }
+    memset(op, 0, sizeof(union OpenrtlOperand));
+    switch (kind) {
+    case OPENRTL_GP_REGISTER:
+    case OPENRTL_FP_REGISTER:
+    case OPENRTL_V_REGISTER:
+        op->general.reg = packed;
+        op->general.size = packed >> 8;
+        op->general.ext = packed >> 16;
+        break;
+    case OPENRTL_MEMORY_INDIRECT:
+        op->addri.base = packed;
+        op->addri.offset = packed >> 8;
+        break;
+    case OPENRTL_MEMORY_BASE:
+        op->addr.base = packed;
+        op->addr.offset = (int32_t) (packed << 1) >> 9;
+        break;
+    default:
+        op->immediate = packed;
+        break;
+    }
+}
+
+// packs an operand, or moves it to `wide` when the packed form does not
+// give back every byte of it
+static int openrtl_matrix_operand(OpenrtlMatrix *matrix, int kind, const union OpenrtlOperand *op, uint32_t *packed) {
+    union OpenrtlOperand back;
+    *packed = openrtl_matrix_pack(kind, op);
+    openrtl_matrix_unpack(matrix, kind, *packed, &back);
+    if (!memcmp(&back, op, sizeof(union OpenrtlOperand))) {
+        return 0;
+    }
+
+    if (matrix->wide.len == matrix->wide.cap) {
+        size_t cap = matrix->wide.cap ? 2 * matrix->wide.cap : DEFAULT_WIDE_CAP;
+        if (cap > MATRIX_WIDE) {
+            return 1;
+        }
+        void *ptr = openrtl_realloc(matrix->allocator, matrix->wide.ptr, matrix->wide.cap * sizeof(union OpenrtlOperand), cap * sizeof(union OpenrtlOperand));
+        if (!ptr) {
+            return 1;
+        }
+        matrix->wide.ptr = ptr;
+        matrix->wide.cap = cap;
+    }
+    matrix->wide.ptr[matrix->wide.len] = *op;
+    *packed = MATRIX_WIDE | matrix->wide.len++;
+    return 0;
+}
@@ -0,0 +1,416 @@
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "include/openrtl.h"
+#include "internal.h"
+
+#define DEFAULT_IMAGE_CAP 4096
+#define DEFAULT_RELOCS_CAP 256
+#define DEFAULT_NAMES_CAP 64
+#define MATRIX_REGS 256
+
+static const char openrtl_module_magic[8] = "OPENRTL";
+
+// a module is the image of a context in which every pointer is stored
+// as an offset from the start of the file. `relocs` lists where those
+// offsets are, so mapping the file and adding its address to each of
+// them is all it takes to load it, apart from the name tables which
+// hash the addresses of names and are reindexed
+struct OpenrtlModuleHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;
+    uint32_t layout[8];
+    uint64_t size;
+    uint64_t context;
+    uint64_t relocs;
+    uint64_t nrelocs;
+};
+
+struct OpenrtlImage {
+    const OpenrtlAllocator *allocator;
+    size_t cap;
+    size_t len;
+    char *ptr;
+    struct {
+        size_t cap;
+        size_t len;
+        uint64_t *ptr;
+    } relocs;
+    // maps an interned name to its offset in the image
+    OpenrtlTable names;
+    int status;
+};
+
+// identifies the build a module was written by, a module is only ever
+// loaded by the same struct layout
+static void openrtl_module_layout(uint32_t *layout) {
+    layout[0] = 0x01020304;
+    layout[1] = sizeof(void *);
+    layout[2] = sizeof(OpenrtlContext);
+    layout[3] = sizeof(OpenrtlBuffer);
+    layout[4] = sizeof(struct OpenrtlEntry);
+    layout[5] = sizeof(struct OpenrtlSymbol);
+    layout[6] = sizeof(struct OpenrtlSite);
+    layout[7] = sizeof(union OpenrtlOperand);
+}
+
+// appends `size` zeroed bytes aligned to 8 and returns their offset.
+// nothing is appended once an allocation has failed
+static size_t openrtl_image_alloc(struct OpenrtlImage *img, size_t size) {
+    if (img->status) {
+        return 0;
+    }
+    size_t at = (img->len + 7) & ~(size_t) 7;
+    if (at + size > img->cap) {
+        size_t cap = img->cap;
+        while (at + size > cap) {
+            cap *= 2;
+        }
+        char *ptr = openrtl_realloc(img->allocator, img->ptr, img->cap, cap);
+        if (!ptr) {
+            img->status = 1;
+            return 0;
+        }
+        img->ptr = ptr;
+        img->cap = cap;
+    }
+    memset(img->ptr + img->len, 0, at + size - img->len);
+    img->len = at + size;
+    return at;
+}
+
+static size_t openrtl_image_copy(struct OpenrtlImage *img, const void *ptr, size_t size) {
+    size_t at = openrtl_image_alloc(img, size);
+    if (!img->status && size) {
+        memcpy(img->ptr + at, ptr, size);
+    }
+    return at;
+}
+
+// stores a pointer to `target` at `at`
+static void openrtl_image_reloc(struct OpenrtlImage *img, size_t at, size_t target) {
+    if (img->status) {
+        return;
+    }
+    if (img->relocs.len == img->relocs.cap) {
+        size_t cap = 2 * img->relocs.cap;
+        uint64_t *ptr = openrtl_realloc(img->allocator, img->relocs.ptr, img->relocs.cap * sizeof(uint64_t), cap * sizeof(uint64_t));
+        if (!ptr) {
+            img->status = 1;
+            return;
+        }
+        img->relocs.ptr = ptr;
+        img->relocs.cap = cap;
+    }
+    uint64_t value = target;
+    memcpy(img->ptr + at, &value, 8);
+    img->relocs.ptr[img->relocs.len++] = at;
+}
+
+// names that were not interned into the context cannot be written
+static void openrtl_image_name(struct OpenrtlImage *img, size_t at, const char *name) {
+    if (!name) {
+        return;
+    }
+    struct OpenrtlEntry *ent = openrtl_table_find(&img->names, name);
+    if (!ent) {
+        img->status = 1;
+        return;
+    }
+    openrtl_image_reloc(img, at, ent->addr);
+}
+
+// writes the entries and index of `table` and points the table image at
+// `at` to them
+static void openrtl_image_table(struct OpenrtlImage *img, size_t at, const OpenrtlTable *table) {
+    OpenrtlTable copy = *table;
+    copy.allocator = NULL;
+    copy.cap = table->len ? table->len : 1;
+    copy.ptr = NULL;
+    copy.index = NULL;
+    memcpy(img->ptr + at, &copy, sizeof(OpenrtlTable));
+
+    size_t entries = openrtl_image_copy(img, table->ptr, table->len * sizeof(struct OpenrtlEntry));
+    for (size_t i = 0; i < table->len; i++) {
+        size_t entry = entries + i * sizeof(struct OpenrtlEntry);
+        openrtl_image_name(img, entry + offsetof(struct OpenrtlEntry, name), table->ptr[i].name);
+    }
+    size_t index = openrtl_image_copy(img, table->index, (table->mask + 1) * sizeof(size_t));
+    openrtl_image_reloc(img, at + offsetof(OpenrtlTable, ptr), entries);
+    openrtl_image_reloc(img, at + offsetof(OpenrtlTable, index), index);
+}
+
+// copies every interned name into a single chunk
+static void openrtl_image_strings(struct OpenrtlImage *img, size_t at, const OpenrtlStrings *strings) {
+    size_t total = 0;
+    for (size_t i = 0; i < strings->cap; i++) {
+        if (strings->index[i]) {
+            total += strlen(strings->index[i]) + 1;
+        }
+    }
+
+    size_t chunk = openrtl_image_alloc(img, sizeof(struct OpenrtlChunk) + total);
+    size_t index = openrtl_image_alloc(img, strings->cap * sizeof(const char *));
+    if (img->status) {
+        return;
+    }
+    struct OpenrtlChunk head = { .next = NULL, .cap = total, .len = total };
+    memcpy(img->ptr + chunk, &head, sizeof(struct OpenrtlChunk));
+    size_t name = chunk + sizeof(struct OpenrtlChunk);
+    for (size_t i = 0; i < strings->cap; i++) {
+        const char *ptr = strings->index[i];
+        if (!ptr) {
+            continue;
+        }
+        size_t len = strlen(ptr) + 1;
+        memcpy(img->ptr + name, ptr, len);
+        if (!openrtl_table_insert(&img->names, ptr, name)) {
+            img->status = 1;
+            return;
+        }
+        openrtl_image_reloc(img, index + i * sizeof(const char *), name);
+        name += len;
+    }
+
+    OpenrtlStrings copy = *strings;
+    copy.allocator = NULL;
+    copy.mapped = 1;
+    copy.index = NULL;
+    copy.chunk = NULL;
+    memcpy(img->ptr + at, &copy, sizeof(OpenrtlStrings));
+    openrtl_image_reloc(img, at + offsetof(OpenrtlStrings, index), index);
+    openrtl_image_reloc(img, at + offsetof(OpenrtlStrings, chunk), chunk);
+}
+
+// lays the columns out as `openrtl_matrix_reserve` does, with `cap`
+// equal to the number of elements. the chains are always written, as a
+// read-only matrix cannot build them when first queried
+static void openrtl_image_matrix(struct OpenrtlImage *img, size_t at, const OpenrtlMatrix *matrix, int flags) {
+    size_t len = flags & OPENRTL_MODULE_MATRIX ? matrix->len : 0;
+    size_t wide = len ? matrix->wide.len : 0;
+    OpenrtlMatrix copy = { .allocator = NULL, .cap = len, .len = len };
+    copy.wide.cap = wide;
+    copy.wide.len = wide;
+    memcpy(img->ptr + at, &copy, sizeof(OpenrtlMatrix));
+
+    size_t offset = openrtl_image_copy(img, matrix->offset, len * sizeof(uint32_t));
+    size_t v1 = openrtl_image_copy(img, matrix->v1, len * sizeof(uint32_t));
+    size_t v2 = openrtl_image_copy(img, matrix->v2, len * sizeof(uint32_t));
+    size_t place = openrtl_image_copy(img, matrix->place, len);
+    size_t value = openrtl_image_copy(img, matrix->value, len);
+    size_t ops = openrtl_image_copy(img, matrix->wide.ptr, wide * sizeof(union OpenrtlOperand));
+    size_t prev = openrtl_image_alloc(img, 2 * len * sizeof(uint32_t));
+    size_t last = openrtl_image_alloc(img, 3 * MATRIX_REGS * sizeof(uint32_t));
+    if (len && !img->status) {
+        uint32_t *chain = (uint32_t *) (img->ptr + prev);
+        OpenrtlMatrix view = *matrix;
+        view.len = len;
+        openrtl_matrix_links(&view, 0, chain, chain + len, (uint32_t *) (img->ptr + last));
+    }
+    openrtl_image_reloc(img, at + offsetof(OpenrtlMatrix, offset), offset);
+    openrtl_image_reloc(img, at + offsetof(OpenrtlMatrix, v1), v1);
+    openrtl_image_reloc(img, at + offsetof(OpenrtlMatrix, v2), v2);
+    openrtl_image_reloc(img, at + offsetof(OpenrtlMatrix, place), place);
+    openrtl_image_reloc(img, at + offsetof(OpenrtlMatrix, value), value);
+    openrtl_image_reloc(img, at + offsetof(OpenrtlMatrix, wide) + offsetof(struct OpenrtlWide, ptr), ops);
+    openrtl_image_reloc(img, at + offsetof(OpenrtlMatrix, prev), prev);
+    openrtl_image_reloc(img, at + offsetof(OpenrtlMatrix, next), prev + len * sizeof(uint32_t));
+    openrtl_image_reloc(img, at + offsetof(OpenrtlMatrix, last), last);
+}
+
+static void openrtl_image_buffer(struct OpenrtlImage *img, size_t at, size_t strings, const OpenrtlBuffer *buf, int flags) {
+    OpenrtlBuffer copy = *buf;
+    copy.allocator = NULL;
+    copy.cap = buf->len;
+    copy.ptr = NULL;
+    memset(&copy.segments, 0, sizeof(copy.segments));
+    memset(&copy.index, 0, sizeof(copy.index));
+    memset(&copy.matrix, 0, sizeof(copy.matrix));
+    memset(&copy.linker, 0, sizeof(copy.linker));
+    memset(&copy.local, 0, sizeof(copy.local));
+    copy.strings = NULL;
+    copy.own_strings = 0;
+    copy.name = NULL;
+    memcpy(img->ptr + at, &copy, sizeof(OpenrtlBuffer));
+
+    // segmented code is written out contiguously
+    size_t code = openrtl_image_alloc(img, buf->len);
+    size_t n;
+    for (size_t i = 0; i < buf->len && !img->status; i += n) {
+        const void *ptr = openrtl_buffer_span(buf, i, &n);
+        memcpy(img->ptr + code + i, ptr, n);
+    }
+    openrtl_image_reloc(img, at + offsetof(OpenrtlBuffer, ptr), code);
+
+    size_t linker = openrtl_image_copy(img, buf->linker.ptr, buf->linker.len * sizeof(struct OpenrtlSymbol));
+    for (size_t i = 0; i < buf->linker.len; i++) {
+        size_t sym = linker + i * sizeof(struct OpenrtlSymbol);
+        openrtl_image_name(img, sym + offsetof(struct OpenrtlSymbol, name), buf->linker.ptr[i].name);
+    }
+    OpenrtlLinker head = { .cap = buf->linker.len, .len = buf->linker.len, .ptr = NULL };
+    memcpy(img->ptr + at + offsetof(OpenrtlBuffer, linker), &head, sizeof(OpenrtlLinker));
+    openrtl_image_reloc(img, at + offsetof(OpenrtlBuffer, linker) + offsetof(OpenrtlLinker, ptr), linker);
+
+    openrtl_image_table(img, at + offsetof(OpenrtlBuffer, local), &buf->local);
+    openrtl_image_matrix(img, at + offsetof(OpenrtlBuffer, matrix), &buf->matrix, flags);
+    openrtl_image_reloc(img, at + offsetof(OpenrtlBuffer, strings), strings);
+    openrtl_image_name(img, at + offsetof(OpenrtlBuffer, name), buf->name);
+}
+
+// writes a linked context to `path`. every buffer must already be part
+// of the context, and `OPENRTL_MODULE_MATRIX` keeps the matrices
+int openrtl_module_save(const OpenrtlContext *ctx, const char *path, int flags) {
+    if (sizeof(void *) != 8) {
+        return 1;
+    }
+
+    struct OpenrtlImage img;
+    img.allocator = ctx->allocator;
+    img.cap = DEFAULT_IMAGE_CAP;
+    img.len = 0;
+    img.ptr = openrtl_malloc(img.allocator, img.cap);
+    img.relocs.cap = DEFAULT_RELOCS_CAP;
+    img.relocs.len = 0;
+    img.relocs.ptr = openrtl_malloc(img.allocator, img.relocs.cap * sizeof(uint64_t));
+    openrtl_table(&img.names, img.allocator, DEFAULT_NAMES_CAP);
+    img.status = !img.ptr || !img.relocs.ptr || !img.names.ptr || !img.names.index;
+
+    size_t header = openrtl_image_alloc(&img, sizeof(struct OpenrtlModuleHeader));
+    size_t at = openrtl_image_alloc(&img, sizeof(OpenrtlContext));
+    if (!img.status) {
+        OpenrtlContext copy = *ctx;
+        copy.allocator = NULL;
+        copy.cap = ctx->len;
+        copy.ptr = NULL;
+        copy.mapped = 1;
+        memcpy(img.ptr + at, &copy, sizeof(OpenrtlContext));
+    }
+
+    if (!img.status) {
+        openrtl_image_strings(&img, at + offsetof(OpenrtlContext, strings), &ctx->strings);
+    }
+    if (!img.status) {
+        openrtl_image_table(&img, at + offsetof(OpenrtlContext, global), &ctx->global);
+    }
+    if (!img.status) {
+        size_t sites = openrtl_image_copy(&img, ctx->sites.ptr, ctx->sites.len * sizeof(struct OpenrtlSite));
+        size_t head = at + offsetof(OpenrtlContext, sites);
+        memcpy(img.ptr + head + offsetof(struct OpenrtlSites, cap), &ctx->sites.len, sizeof(size_t));
+        openrtl_image_reloc(&img, head + offsetof(struct OpenrtlSites, ptr), sites);
+        openrtl_image_table(&img, head + offsetof(struct OpenrtlSites, head), &ctx->sites.head);
+    }
+    size_t buffers = openrtl_image_alloc(&img, ctx->len * sizeof(OpenrtlBuffer));
+    openrtl_image_reloc(&img, at + offsetof(OpenrtlContext, ptr), buffers);
+    for (size_t i = 0; i < ctx->len && !img.status; i++) {
+        openrtl_image_buffer(&img, buffers + i * sizeof(OpenrtlBuffer), at + offsetof(OpenrtlContext, strings), ctx->ptr + i, flags);
+    }
+
+    size_t relocs = openrtl_image_copy(&img, img.relocs.ptr, img.relocs.len * sizeof(uint64_t));
+    if (!img.status) {
+        struct OpenrtlModuleHeader head = {
+            .version = OPENRTL_MODULE_VERSION,
+            .flags = flags,
+            .size = img.len,
+            .context = at,
+            .relocs = relocs,
+            .nrelocs = img.relocs.len,
+        };
+        memcpy(head.magic, openrtl_module_magic, sizeof(head.magic));
+        openrtl_module_layout(head.layout);
+        memcpy(img.ptr + header, &head, sizeof(head));
+
+        FILE *file = fopen(path, "wb");
+        if (!file) {
+            img.status = 1;
+        } else {
+            if (fwrite(img.ptr, 1, img.len, file) != img.len) {
+                img.status = 1;
+            }
+            if (fclose(file)) {
+                img.status = 1;
+            }
+        }
+    }
+
+    openrtl_del_table(&img.names);
+    openrtl_free(img.allocator, img.relocs.ptr);
+    openrtl_free(img.allocator, img.ptr);
+    return img.status;
+}
+
+static void openrtl_module_reindex(OpenrtlTable *table) {
+    memset(table->index, 0, (table->mask + 1) * sizeof(size_t));
+    openrtl_table_fill(table);
+}
+
+// maps a module written by `openrtl_module_save`. the context it holds
+// is read-only and lives until `openrtl_module_close`
+int openrtl_module_load(OpenrtlModule *mod, const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return 1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) || (size_t) st.st_size < sizeof(struct OpenrtlModuleHeader)) {
+        close(fd);
+        return 1;
+    }
+    size_t size = st.st_size;
+    // private, so the fixups below never reach the file
+    char *base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        return 1;
+    }
+
+    struct OpenrtlModuleHeader head;
+    uint32_t layout[8];
+    memcpy(&head, base, sizeof(head));
+    openrtl_module_layout(layout);
+    if (memcmp(head.magic, openrtl_module_magic, sizeof(head.magic))
+        || head.version != OPENRTL_MODULE_VERSION
+        || memcmp(head.layout, layout, sizeof(layout))
+        || head.size != size
+        || head.relocs > size
+        || head.nrelocs > (size - head.relocs) / sizeof(uint64_t)
+        || head.context + sizeof(OpenrtlContext) > size) {
+        munmap(base, size);
+        return 1;
+    }
+
+    const uint64_t *relocs = (const uint64_t *) (base + head.relocs);
+    for (size_t i = 0; i < head.nrelocs; i++) {
+        uint64_t value;
+        if (relocs[i] + 8 > size) {
+            munmap(base, size);
+            return 1;
+        }
+        memcpy(&value, base + relocs[i], 8);
+        value += (uintptr_t) base;
+        memcpy(base + relocs[i], &value, 8);
+    }
+    OpenrtlContext *ctx = (OpenrtlContext *) (base + head.context);
+    openrtl_module_reindex(&ctx->global);
+    openrtl_module_reindex(&ctx->sites.head);
+    for (size_t i = 0; i < ctx->len; i++) {
+        openrtl_module_reindex(&ctx->ptr[i].local);
+    }
+    if (mprotect(base, size, PROT_READ)) {
+        munmap(base, size);
+        return 1;
+    }
+
+    mod->base = base;
+    mod->size = size;
+    mod->ctx = ctx;
+    return 0;
+}
+
+void openrtl_module_close(OpenrtlModule *mod) {
+    munmap(mod->base, mod->size);
+}
@@ -0,0 +1,194 @@
+#include <string.h>
+#include "include/openrtl.h"
+#include "internal.h"
+
+static int openrtl_peephole_self_move(struct OpenrtlRewrite *rw, struct OpenrtlRewriteInst *prev, struct OpenrtlRewriteInst *it);
+static int openrtl_peephole_store_load(struct OpenrtlRewrite *rw, struct OpenrtlRewriteInst *prev, struct OpenrtlRewriteInst *it);
+static int openrtl_peephole_zero(struct OpenrtlRewrite *rw, struct OpenrtlRewriteInst *prev, struct OpenrtlRewriteInst *it);
+static int openrtl_peephole_extend(struct OpenrtlRewrite *rw, struct OpenrtlRewriteInst *prev, struct OpenrtlRewriteInst *it);
+
+// `second` is `OPENRTL_OP_COUNT` for a pattern of a single instruction.
+// `apply` edits the last instruction of the pattern and returns whether
+// it did
+struct OpenrtlPattern {
+    uint8_t first;
+    uint8_t second;
+    int (*apply)(struct OpenrtlRewrite *rw, struct OpenrtlRewriteInst *prev, struct OpenrtlRewriteInst *it);
+};
+
+static const struct OpenrtlPattern openrtl_patterns[] = {
+    { OPENRTL_OP_IMOVE_UNSIGNED, OPENRTL_OP_COUNT, openrtl_peephole_self_move },
+    { OPENRTL_OP_IMOVE_SIGNED, OPENRTL_OP_COUNT, openrtl_peephole_self_move },
+    { OPENRTL_OP_FMOVE, OPENRTL_OP_COUNT, openrtl_peephole_self_move },
+    { OPENRTL_OP_ISTORE, OPENRTL_OP_ILOAD, openrtl_peephole_store_load },
+    { OPENRTL_OP_FSTORE, OPENRTL_OP_FLOAD, openrtl_peephole_store_load },
+    { OPENRTL_OP_VSTORE, OPENRTL_OP_VLOAD, openrtl_peephole_store_load },
+    { OPENRTL_OP_IMOVE_IMMEDIATE, OPENRTL_OP_IADD, openrtl_peephole_zero },
+    { OPENRTL_OP_IMOVE_IMMEDIATE, OPENRTL_OP_IOR, openrtl_peephole_zero },
+    { OPENRTL_OP_IMOVE_IMMEDIATE, OPENRTL_OP_IXOR, openrtl_peephole_zero },
+    { OPENRTL_OP_IMOVE_IMMEDIATE, OPENRTL_OP_ISUBTRACT, openrtl_peephole_zero },
+    { OPENRTL_OP_IMOVE_IMMEDIATE, OPENRTL_OP_IAND, openrtl_peephole_zero },
+    { OPENRTL_OP_IMOVE_IMMEDIATE, OPENRTL_OP_IMULTIPLY_UNSIGNED, openrtl_peephole_zero },
+    { OPENRTL_OP_IMOVE_IMMEDIATE, OPENRTL_OP_IMULTIPLY_SIGNED, openrtl_peephole_zero },
+    { OPENRTL_OP_IMOVE_UNSIGNED, OPENRTL_OP_IMOVE_UNSIGNED, openrtl_peephole_extend },
+    { OPENRTL_OP_IMOVE_SIGNED, OPENRTL_OP_IMOVE_SIGNED, openrtl_peephole_extend },
+};
+
+// rewrites wasteful pairs of adjacent instructions in `buf`. the second
+// instruction of a pair is left alone when it can be reached other than
+// through the first, and instructions that carry a symbol are never
+// matched
+int openrtl_peephole(OpenrtlBuffer *buf) {
+    struct OpenrtlRewrite rw;
+    uint8_t *leader = NULL;
+    if (openrtl_rewrite(&rw, buf) || !(leader = openrtl_rewrite_leaders(&rw, buf))) {
+        openrtl_del_rewrite(&rw);
+        return 1;
+    }
+
+    int changed;
+    int edited = 0;
+    do {
+        changed = 0;
+        struct OpenrtlRewriteInst *prev = NULL;
+        int joined = 1;
+        for (size_t i = 0; i < rw.len; i++) {
+            struct OpenrtlRewriteInst *it = rw.ptr + i;
+            // a deleted leader passes control on to the next instruction
+            joined &= !leader[i];
+            if (it->dead) {
+                continue;
+            }
+            int applied = 0;
+            if (!it->symbol) {
+                for (size_t p = 0; p < sizeof(openrtl_patterns) / sizeof(openrtl_patterns[0]) && !applied; p++) {
+                    const struct OpenrtlPattern *pat = openrtl_patterns + p;
+                    if (pat->second == OPENRTL_OP_COUNT) {
+                        if (it->inst.opcode == pat->first) {
+                            applied = pat->apply(&rw, prev, it);
+                        }
+                    } else if (prev && joined && !prev->symbol && prev->inst.opcode == pat->first && it->inst.opcode == pat->second) {
+                        applied = pat->apply(&rw, prev, it);
+                    }
+                }
+            }
+            changed |= applied;
+            if (!it->dead) {
+                prev = it;
+                joined = 1;
+            }
+        }
+        edited |= changed;
+    } while (changed);
+
+    openrtl_free(rw.allocator, leader);
+    int status = edited ? openrtl_rewrite_commit(&rw, buf) : 0;
+    openrtl_del_rewrite(&rw);
+    return status;
+}
+
+static int openrtl_peephole_self_move(struct OpenrtlRewrite *rw, struct OpenrtlRewriteInst *prev, struct OpenrtlRewriteInst *it) {
+    (void) rw;
+    (void) prev;
+    const OpenrtlInst *inst = &it->inst;
+    if (inst->opcode == OPENRTL_OP_FMOVE) {
+        it->dead = inst->arith.dest == inst->arith.src1;
+    } else {
+        it->dead = inst->arith_b.dest == inst->arith_b.src && inst->arith_b.size == inst->size;
+    }
+    return it->dead;
+}
+
+// a load of what was just stored becomes a move of the stored register
+static int openrtl_peephole_store_load(struct OpenrtlRewrite *rw, struct OpenrtlRewriteInst *prev, struct OpenrtlRewriteInst *it) {
+    (void) rw;
+    const OpenrtlInst *store = &prev->inst;
+    OpenrtlInst *load = &it->inst;
+    if (store->size != load->size || store->arith.src1 != load->arith.src1 || store->arith.src2 != load->arith.src2) {
+        return 0;
+    }
+    uint8_t value = store->arith.dest;
+    // the load may overwrite the base or offset the store used, but not
+    // the value before it is moved
+    if (load->arith.dest == value) {
+        it->dead = 1;
+        return 1;
+    }
+    switch (load->opcode) {
+    case OPENRTL_OP_ILOAD:
+        load->opcode = OPENRTL_OP_IMOVE_UNSIGNED;
+        load->arith_b.src = value;
+        load->arith_b.size = load->size;
+        return 1;
+    case OPENRTL_OP_FLOAD:
+        load->opcode = OPENRTL_OP_FMOVE;
+        load->arith.src1 = value;
+        load->arith.src2 = 0;
+        return 1;
+    default:
+        // there is no vector move
+        return 0;
+    }
+}
+
+// arithmetic with a register just cleared is a move or a clear itself
+static int openrtl_peephole_zero(struct OpenrtlRewrite *rw, struct OpenrtlRewriteInst *prev, struct OpenrtlRewriteInst *it) {
+    const OpenrtlInst *zero = &prev->inst;
+    OpenrtlInst *inst = &it->inst;
+    if (prev->operand != 0 || zero->size != inst->size || openrtl_rewrite_flags(rw, it - rw->ptr)) {
+        return 0;
+    }
+    uint8_t reg = zero->rel.dest;
+    uint8_t dest = inst->arith.dest;
+    uint8_t src1 = inst->arith.src1;
+    uint8_t src2 = inst->arith.src2;
+    if (src1 != reg && src2 != reg) {
+        return 0;
+    }
+
+    switch (inst->opcode) {
+    case OPENRTL_OP_IAND:
+    case OPENRTL_OP_IMULTIPLY_UNSIGNED:
+    case OPENRTL_OP_IMULTIPLY_SIGNED:
+        *inst = (OpenrtlInst) {0};
+        inst->opcode = OPENRTL_OP_IMOVE_IMMEDIATE;
+        inst->size = zero->size;
+        inst->rel.dest = dest;
+        it->operand = 0;
+        return 1;
+    case OPENRTL_OP_ISUBTRACT:
+        if (src2 != reg) {
+            return 0;
+        }
+        break;
+    default:
+        if (src2 != reg) {
+            src1 = src2;
+            src2 = reg;
+        }
+        break;
+    }
+    // `src1` is what is left once the cleared `src2` is dropped
+    if (dest == src1) {
+        it->dead = 1;
+        return 1;
+    }
+    inst->opcode = OPENRTL_OP_IMOVE_UNSIGNED;
+    inst->arith_b.dest = dest;
+    inst->arith_b.src = src1;
+    inst->arith_b.size = inst->size;
+    return 1;
+}
+
+// a register extended twice the same way keeps the first extension when
+// the second one reads at least as many bytes
+static int openrtl_peephole_extend(struct OpenrtlRewrite *rw, struct OpenrtlRewriteInst *prev, struct OpenrtlRewriteInst *it) {
+    (void) rw;
+    const OpenrtlInst *first = &prev->inst;
+    const OpenrtlInst *second = &it->inst;
+    it->dead = first->size == second->size
+        && second->arith_b.dest == first->arith_b.dest
+        && second->arith_b.src == first->arith_b.dest
+        && second->arith_b.size >= first->arith_b.size;
+    return it->dead;
+}
@@ -3,6 +3,32 @@
 #include <string.h>
 #include <limits.h>
 #include "include/openrtl.h"
+#include "internal.h"
+
+// where a register is live within a single block, from instruction
+// `start` to `end`. `entry` and `exit` tell whether it is live on the
+// way in and out of the block, segments of a register joined by an edge
+// hold the same value and are merged into one interval
+struct OpenrtlAllocSegment {
+    size_t start;
+    size_t end;
+    size_t parent;
+    uint8_t reg;
+    uint8_t file;
+    uint8_t entry;
+    uint8_t exit;
+    uint8_t def;
+    uint8_t size;
+};
+
+// `base` holds where the segments of every block begin
+struct OpenrtlAllocSegments {
+    const OpenrtlAllocator *allocator;
+    size_t len;
+    size_t cap;
+    struct OpenrtlAllocSegment *ptr;
+    size_t *base;
+};
 
 static void openrtl_alloc_sort_live(struct OpenrtlInterval *intervals, size_t lo, size_t hi);
 static size_t openrtl_alloc_partition_live(struct OpenrtlInterval *intervals, size_t lo, size_t hi);
@@ -15,6 +41,17 @@ static void openrtl_alloc_memswap(void *a, void *b, size_t size, void *temp);
 static void openrtl_alloc_fn(OpenrtlRegalloc *alloc, OpenrtlContext *ctx, OpenrtlBuffer *buf);
 static void openrtl_alloc_inst(OpenrtlRegalloc *alloc, OpenrtlContext *ctx, OpenrtlBuffer *buf, OpenrtlInst *inst, void *arg, size_t idx);
 
+static void openrtl_alloc_use(OpenrtlRegalloc *alloc, int file, uint8_t reg, size_t idx);
+static int openrtl_alloc_webs(OpenrtlRegalloc *alloc, OpenrtlBuffer *buf);
+static int openrtl_alloc_segments(struct OpenrtlAllocSegments *segs, const OpenrtlCfg *cfg, const OpenrtlLiveness *live, const OpenrtlBuffer *buf);
+static size_t openrtl_alloc_root(struct OpenrtlAllocSegment *segs, size_t i);
+static int openrtl_alloc_compare_segment(const void *a, const void *b);
+static struct OpenrtlRange openrtl_alloc_range(const OpenrtlRegalloc *alloc, const struct OpenrtlInterval *interval, size_t k);
+static int openrtl_alloc_overlap(const OpenrtlRegalloc *alloc, const struct OpenrtlInterval *a, const struct OpenrtlInterval *b);
+static size_t openrtl_alloc_hole(const OpenrtlRegalloc *alloc, const struct OpenrtlInterval *interval);
+static void openrtl_alloc_push_range(OpenrtlRegalloc *alloc, OpenrtlLifetime start, OpenrtlLifetime end);
+static int openrtl_alloc_regtable_push(struct OpenrtlRegisterTable *dest, OpenrtlLifetime start, OpenrtlLifetime end, uint64_t key, struct OpenrtlPurpose purpose);
+
 static inline int log2ll(unsigned long long val) {
     if (val == 0) return INT_MIN;
     if (val == 1) return 0;
@@ -29,11 +66,16 @@ struct OpenrtlPurposePair {
 };
 
 void openrtl_alloc_linscan(OpenrtlRegalloc *alloc, size_t regc, size_t paramc, struct OpenrtlGmReg *params) {
+    openrtl_alloc_linscan_with(alloc, NULL, regc, paramc, params);
+}
+
+void openrtl_alloc_linscan_with(OpenrtlRegalloc *alloc, const OpenrtlAllocator *allocator, size_t regc, size_t paramc, struct OpenrtlGmReg *params) {
+    alloc->allocator = allocator;
     alloc->counter = 0;
     
     alloc->registers.len = regc;
     alloc->registers.cap = regc;
-    alloc->registers.registers = malloc(sizeof(struct OpenrtlGmReg) * regc);
+    alloc->registers.registers = openrtl_malloc(alloc->allocator, sizeof(struct OpenrtlGmReg) * regc);
 
     for (size_t i = 0; i < regc; i++) {
         alloc->registers.registers[i].number = i;
@@ -41,7 +83,7 @@ void openrtl_alloc_linscan(OpenrtlRegalloc *alloc, size_t regc, size_t paramc, s
     
     alloc->parameters.len = paramc;
     alloc->parameters.cap = paramc;
-    alloc->parameters.registers = malloc(sizeof(struct OpenrtlGmReg) * alloc->parameters.cap);
+    alloc->parameters.registers = openrtl_malloc(alloc->allocator, sizeof(struct OpenrtlGmReg) * alloc->parameters.cap);
 
     for (size_t i = 0; i < paramc; i++) {
         alloc->parameters.registers[i] = params[i];
@@ -49,31 +91,47 @@ void openrtl_alloc_linscan(OpenrtlRegalloc *alloc, size_t regc, size_t paramc, s
     
     alloc->stack.len = 0;
     alloc->stack.cap = 32;
-    alloc->stack.intervals = malloc(sizeof(struct OpenrtlInterval) * alloc->stack.cap);
+    alloc->stack.intervals = openrtl_malloc(alloc->allocator, sizeof(struct OpenrtlInterval) * alloc->stack.cap);
     
     alloc->live.len = 0;
     alloc->live.cap = 32;
-    alloc->live.intervals = malloc(sizeof(struct OpenrtlInterval) * alloc->live.cap);
+    alloc->live.intervals = openrtl_malloc(alloc->allocator, sizeof(struct OpenrtlInterval) * alloc->live.cap);
     
     alloc->active.len = 0;
     alloc->active.cap = 32;
-    alloc->active.actives = malloc(sizeof(struct OpenrtlActive) * alloc->active.cap);
+    alloc->active.actives = openrtl_malloc(alloc->allocator, sizeof(struct OpenrtlActive) * alloc->active.cap);
     
+    alloc->ranges.len = 0;
+    alloc->ranges.cap = 32;
+    alloc->ranges.ranges = openrtl_malloc(alloc->allocator, sizeof(struct OpenrtlRange) * alloc->ranges.cap);
+
     alloc->offset = 0;
+    for (size_t i = 0; i < OPENRTL_REG_SLOTS; i++) {
+        alloc->variables[i] = -1;
+    }
+}
+
+void openrtl_del_alloc(OpenrtlRegalloc *alloc) {
+    openrtl_free(alloc->allocator, alloc->registers.registers);
+    openrtl_free(alloc->allocator, alloc->parameters.registers);
+    openrtl_free(alloc->allocator, alloc->stack.intervals);
+    openrtl_free(alloc->allocator, alloc->live.intervals);
+    openrtl_free(alloc->allocator, alloc->active.actives);
+    openrtl_free(alloc->allocator, alloc->ranges.ranges);
 }
 
 void openrtl_alloc_add(OpenrtlRegalloc *alloc, struct OpenrtlInterval *interval) {
     if (interval->stack || interval->ti.size > 8) {
         if (alloc->stack.len == alloc->stack.cap) {
             alloc->stack.cap *= 2;
-            alloc->stack.intervals = realloc(alloc->stack.intervals, alloc->stack.cap * sizeof(struct OpenrtlInterval));
+            alloc->stack.intervals = openrtl_realloc(alloc->allocator, alloc->stack.intervals, alloc->stack.len * sizeof(struct OpenrtlInterval), alloc->stack.cap * sizeof(struct OpenrtlInterval));
         }
 
         alloc->stack.intervals[alloc->stack.len++] = *interval;
     } else {
         if (alloc->live.len == alloc->live.cap) {
             alloc->live.cap *= 2;
-            alloc->live.intervals = realloc(alloc->live.intervals, alloc->live.cap * sizeof(struct OpenrtlInterval));
+            alloc->live.intervals = openrtl_realloc(alloc->allocator, alloc->live.intervals, alloc->live.len * sizeof(struct OpenrtlInterval), alloc->live.cap * sizeof(struct OpenrtlInterval));
         }
 
         alloc->live.intervals[alloc->live.len++] = *interval;
@@ -84,14 +142,14 @@ void openrtl_alloc_param(OpenrtlRegalloc *alloc, struct OpenrtlInterval *interva
     if (interval->stack || interval->ti.size > 8) {
         if (alloc->stack.len == alloc->stack.cap) {
             alloc->stack.cap *= 2;
-            alloc->stack.intervals = realloc(alloc->stack.intervals, alloc->stack.cap * sizeof(struct OpenrtlInterval));
+            alloc->stack.intervals = openrtl_realloc(alloc->allocator, alloc->stack.intervals, alloc->stack.len * sizeof(struct OpenrtlInterval), alloc->stack.cap * sizeof(struct OpenrtlInterval));
         }
 
         alloc->stack.intervals[alloc->stack.len++] = *interval;
     } else {
         if (alloc->live.len == alloc->live.cap) {
             alloc->live.cap *= 2;
-            alloc->live.intervals = realloc(alloc->live.intervals, alloc->live.cap * sizeof(struct OpenrtlInterval));
+            alloc->live.intervals = openrtl_realloc(alloc->allocator, alloc->live.intervals, alloc->live.len * sizeof(struct OpenrtlInterval), alloc->live.cap * sizeof(struct OpenrtlInterval));
         }
 
         if (param < alloc->parameters.len) {
@@ -106,35 +164,42 @@ void openrtl_alloc_find(OpenrtlRegalloc *alloc, OpenrtlContext *ctx, OpenrtlBuff
     openrtl_alloc_fn(alloc, ctx, buf);
 }
 
-void openrtl_alloc_regtable(struct OpenrtlRegisterTable *dest, OpenrtlRegalloc *alloc) {
+// the table is left empty when out of memory, `openrtl_del_regtable`
+// may still be called on it
+int openrtl_alloc_regtable(struct OpenrtlRegisterTable *dest, OpenrtlRegalloc *alloc) {
     size_t cap = 32;
+    dest->allocator = alloc->allocator;
     dest->len = 0;
     dest->cap = cap;
-    dest->entries = malloc(cap * sizeof(struct OpenrtlRegEntry));
+    dest->entries = openrtl_malloc(dest->allocator, cap * sizeof(struct OpenrtlRegEntry));
+    if (!dest->entries) {
+        dest->cap = 0;
+        return 1;
+    }
 
+    // an interval with holes has an entry for every range
     for (size_t i = 0; i < alloc->live.len; i++) {
-        if (dest->len == dest->cap) {
-            dest->cap *= 2;
-            dest->entries = realloc(dest->entries, dest->cap * sizeof(struct OpenrtlRegEntry));
+        struct OpenrtlInterval *interval = alloc->live.intervals + i;
+        size_t n = interval->nranges ? interval->nranges : 1;
+        for (size_t k = 0; k < n; k++) {
+            struct OpenrtlRange range = openrtl_alloc_range(alloc, interval, k);
+            if (openrtl_alloc_regtable_push(dest, range.start, range.end, interval->name, interval->purpose)) {
+                return 1;
+            }
         }
-
-        dest->entries[dest->len].start = alloc->live.intervals[i].start;
-        dest->entries[dest->len].end = alloc->live.intervals[i].end;
-        dest->entries[dest->len].key = alloc->live.intervals[i].name;
-        dest->entries[dest->len++].purpose = alloc->live.intervals[i].purpose;
     }
 
     for (size_t i = 0; i < alloc->stack.len; i++) {
-        if (dest->len == dest->cap) {
-            dest->cap *= 2;
-            dest->entries = realloc(dest->entries, dest->cap * sizeof(struct OpenrtlRegEntry));
+        struct OpenrtlInterval *interval = alloc->stack.intervals + i;
+        if (openrtl_alloc_regtable_push(dest, interval->start, interval->end, interval->name, interval->purpose)) {
+            return 1;
         }
-
-        dest->entries[dest->len].start = alloc->live.intervals[i].start;
-        dest->entries[dest->len].end = alloc->live.intervals[i].end;
-        dest->entries[dest->len].key = alloc->stack.intervals[i].name;
-        dest->entries[dest->len++].purpose = alloc->stack.intervals[i].purpose;
     }
+    return 0;
+}
+
+void openrtl_del_regtable(struct OpenrtlRegisterTable *table) {
+    openrtl_free(table->allocator, table->entries);
 }
 
 static void openrtl_alloc_fn(OpenrtlRegalloc *alloc, OpenrtlContext *ctx, OpenrtlBuffer *buf) {
@@ -169,34 +234,300 @@ static void openrtl_alloc_fn(OpenrtlRegalloc *alloc, OpenrtlContext *ctx, Openrt
         openrtl_alloc_param(alloc, &interval, i);
     }
     alloc->counter = buf->params;
-    for (size_t i = 0; i < buf->len;) {
-        OpenrtlInst *inst = (void *) ((char *) buf->ptr + i);
-        openrtl_alloc_inst(alloc, ctx, buf, inst, (char *) buf->ptr + 4, i);
-        i += 4;
-        switch (inst->opcode) {
-        case OPENRTL_OP_CALL:
-        case OPENRTL_OP_BRANCH:
-        case OPENRTL_OP_BRANCH_CARRY:
-        case OPENRTL_OP_BRANCH_OVERFLOW:
-        case OPENRTL_OP_BRANCH_EQUAL:
-        case OPENRTL_OP_BRANCH_NOT_EQUAL:
-        case OPENRTL_OP_BRANCH_LESS:
-        case OPENRTL_OP_BRANCH_LESS_EQ:
-        case OPENRTL_OP_BRANCH_GREATER:
-        case OPENRTL_OP_BRANCH_GREATER_EQ:
-        case OPENRTL_OP_IMOVE_IMMEDIATE:
-            i += inst->rel.len;
-            break;
-        default:
-            break;
+    if (!openrtl_alloc_webs(alloc, buf)) {
+        return;
+    }
+
+    // without a graph intervals run from a definition to the last use
+    // that follows it in the code
+    OpenrtlIter it;
+    openrtl_iter(&it, buf);
+    while (openrtl_iter_next(&it)) {
+        openrtl_alloc_inst(alloc, ctx, buf, &it.inst, &it.operand, it.offset);
+    }
+}
+
+// builds an interval for every web of segments, the blocks a value of a
+// register flows through from its definitions to its uses according to
+// the liveness of the buffer. what lies between the ranges of a web are
+// lifetime holes, which another interval can use the same register in.
+// webs that are never defined in the buffer get no interval
+static int openrtl_alloc_webs(OpenrtlRegalloc *alloc, OpenrtlBuffer *buf) {
+    OpenrtlCfg cfg;
+    if (openrtl_cfg(&cfg, buf)) {
+        openrtl_del_cfg(&cfg);
+        return 1;
+    }
+    OpenrtlLiveness live;
+    if (openrtl_liveness(&live, &cfg, buf)) {
+        openrtl_del_cfg(&cfg);
+        return 1;
+    }
+    struct OpenrtlAllocSegments segs;
+    int status = openrtl_alloc_segments(&segs, &cfg, &live, buf);
+    openrtl_del_liveness(&live);
+    if (status) {
+        openrtl_del_cfg(&cfg);
+        return 1;
+    }
+
+    // a value that is live out of a block is live into every successor
+    // it is live in, both ends are the same web
+    size_t in[OPENRTL_REG_SLOTS] = { 0 };
+    for (size_t b = 0; b < cfg.len; b++) {
+        const struct OpenrtlBlock *block = cfg.blocks + b;
+        for (size_t s = segs.base[b]; s < segs.base[b + 1]; s++) {
+            if (segs.ptr[s].entry) {
+                in[openrtl_reg_slot(segs.ptr[s].file, segs.ptr[s].reg)] = s + 1;
+            }
+        }
+        for (size_t p = 0; p < block->npred; p++) {
+            size_t pred = cfg.preds[block->pred + p];
+            for (size_t s = segs.base[pred]; s < segs.base[pred + 1]; s++) {
+                size_t slot = openrtl_reg_slot(segs.ptr[s].file, segs.ptr[s].reg);
+                if (segs.ptr[s].exit && in[slot]) {
+                    size_t a = openrtl_alloc_root(segs.ptr, s);
+                    size_t c = openrtl_alloc_root(segs.ptr, in[slot] - 1);
+                    segs.ptr[a > c ? a : c].parent = a > c ? c : a;
+                }
+            }
+        }
+        for (size_t s = segs.base[b]; s < segs.base[b + 1]; s++) {
+            in[openrtl_reg_slot(segs.ptr[s].file, segs.ptr[s].reg)] = 0;
+        }
+    }
+    openrtl_del_cfg(&cfg);
+
+    for (size_t s = 0; s < segs.len; s++) {
+        segs.ptr[s].parent = openrtl_alloc_root(segs.ptr, s);
+    }
+    qsort(segs.ptr, segs.len, sizeof(struct OpenrtlAllocSegment), openrtl_alloc_compare_segment);
+
+    for (size_t lo = 0, hi; lo < segs.len; lo = hi) {
+        int def = 0;
+        uint8_t size = 0;
+        for (hi = lo; hi < segs.len && segs.ptr[hi].parent == segs.ptr[lo].parent; hi++) {
+            if (segs.ptr[hi].def && !def) {
+                def = 1;
+                size = segs.ptr[hi].size;
+            }
+        }
+        if (!def) {
+            continue;
+        }
+
+        // ranges that touch are merged, positions become offsets
+        size_t ranges = alloc->ranges.len;
+        size_t start = segs.ptr[lo].start;
+        size_t end = segs.ptr[lo].end;
+        for (size_t s = lo + 1; s <= hi; s++) {
+            if (s < hi && segs.ptr[s].start <= end + 1) {
+                if (segs.ptr[s].end > end) {
+                    end = segs.ptr[s].end;
+                }
+                continue;
+            }
+            openrtl_alloc_push_range(alloc, buf->index.ptr[start], buf->index.ptr[end]);
+            if (s < hi) {
+                start = segs.ptr[s].start;
+                end = segs.ptr[s].end;
+            }
+        }
+        size_t nranges = alloc->ranges.len - ranges;
+
+        if (alloc->live.len == alloc->live.cap) {
+            alloc->live.cap *= 2;
+            alloc->live.intervals = openrtl_realloc(alloc->allocator, alloc->live.intervals, alloc->live.len * sizeof(struct OpenrtlInterval), alloc->live.cap * sizeof(struct OpenrtlInterval));
+        }
+        struct OpenrtlInterval *interval = alloc->live.intervals + alloc->live.len++;
+        memset(interval, 0, sizeof(struct OpenrtlInterval));
+        interval->name = alloc->counter++ << 8 | segs.ptr[lo].reg;
+        interval->file = segs.ptr[lo].file;
+        interval->ti.size = 1 << size;
+        interval->ti.align = 1 << size;
+        interval->purpose.tag = OPENRTL_REG_SPILLED;
+        interval->purpose.stack.size = size;
+        interval->purpose.stack.align = size;
+        interval->start = alloc->ranges.ranges[ranges].start;
+        interval->end = alloc->ranges.ranges[alloc->ranges.len - 1].end;
+        if (nranges > 1) {
+            interval->ranges = ranges;
+            interval->nranges = nranges;
+        } else {
+            alloc->ranges.len = ranges;
+        }
+    }
+
+    openrtl_free(segs.allocator, segs.ptr);
+    openrtl_free(segs.allocator, segs.base);
+    return 0;
+}
+
+// scans every block backwards from the registers live out of it
+static int openrtl_alloc_segments(struct OpenrtlAllocSegments *segs, const OpenrtlCfg *cfg, const OpenrtlLiveness *live, const OpenrtlBuffer *buf) {
+    segs->allocator = cfg->allocator;
+    segs->len = 0;
+    segs->cap = 64;
+    segs->ptr = openrtl_malloc(segs->allocator, segs->cap * sizeof(struct OpenrtlAllocSegment));
+    segs->base = openrtl_malloc(segs->allocator, (cfg->len + 1) * sizeof(size_t));
+    if (!segs->ptr || !segs->base) {
+        openrtl_free(segs->allocator, segs->ptr);
+        openrtl_free(segs->allocator, segs->base);
+        return 1;
+    }
+
+    // segment of every register that is open at the current instruction
+    // plus one
+    size_t open[OPENRTL_REG_SLOTS];
+    for (size_t b = 0; b < cfg->len; b++) {
+        const struct OpenrtlBlock *block = cfg->blocks + b;
+        segs->base[b] = segs->len;
+        memset(open, 0, sizeof(open));
+
+        // a block holds at most one segment for every register live out
+        // of it and two for every instruction
+        size_t need = segs->len + OPENRTL_REG_SLOTS + 4 * (block->last - block->first);
+        if (need > segs->cap) {
+            size_t cap = segs->cap;
+            while (cap < need) {
+                cap *= 2;
+            }
+            void *ptr = openrtl_realloc(segs->allocator, segs->ptr, segs->cap * sizeof(struct OpenrtlAllocSegment), cap * sizeof(struct OpenrtlAllocSegment));
+            if (!ptr) {
+                openrtl_free(segs->allocator, segs->ptr);
+                openrtl_free(segs->allocator, segs->base);
+                return 1;
+            }
+            segs->ptr = ptr;
+            segs->cap = cap;
+        }
+
+        for (size_t r = 0; r < OPENRTL_REG_SLOTS; r++) {
+            if (openrtl_regset_has(live->out + b, r >> 8, r & 255)) {
+                struct OpenrtlAllocSegment seg = { .end = block->last - 1, .parent = segs->len, .reg = r & 255, .file = r >> 8, .exit = 1 };
+                segs->ptr[segs->len++] = seg;
+                open[r] = segs->len;
+            }
+        }
+        for (size_t i = block->last; i-- > block->first;) {
+            OpenrtlInst inst;
+            struct OpenrtlInstRegs regs;
+            openrtl_decode(buf, buf->index.ptr[i], &inst, NULL);
+            openrtl_inst_regs(&inst, &regs);
+            if (regs.ndef) {
+                size_t d = openrtl_reg_slot(regs.def_file, regs.def);
+                if (!open[d]) {
+                    struct OpenrtlAllocSegment seg = { .end = i, .parent = segs->len, .reg = regs.def, .file = regs.def_file };
+                    segs->ptr[segs->len++] = seg;
+                    open[d] = segs->len;
+                }
+                struct OpenrtlAllocSegment *seg = segs->ptr + open[d] - 1;
+                seg->start = i;
+                seg->def = 1;
+                seg->size = inst.size;
+                open[d] = 0;
+            }
+            for (size_t u = 0; u < regs.nuse; u++) {
+                size_t s = openrtl_reg_slot(regs.use_file[u], regs.use[u]);
+                if (!open[s]) {
+                    struct OpenrtlAllocSegment seg = { .end = i, .parent = segs->len, .reg = regs.use[u], .file = regs.use_file[u] };
+                    segs->ptr[segs->len++] = seg;
+                    open[s] = segs->len;
+                }
+            }
+        }
+        for (size_t r = 0; r < OPENRTL_REG_SLOTS; r++) {
+            if (open[r]) {
+                segs->ptr[open[r] - 1].start = block->first;
+                segs->ptr[open[r] - 1].entry = 1;
+            }
+        }
+    }
+    segs->base[cfg->len] = segs->len;
+    return 0;
+}
+
+static size_t openrtl_alloc_root(struct OpenrtlAllocSegment *segs, size_t i) {
+    while (segs[i].parent != i) {
+        segs[i].parent = segs[segs[i].parent].parent;
+        i = segs[i].parent;
+    }
+    return i;
+}
+
+// groups segments by web and orders every web by position
+static int openrtl_alloc_compare_segment(const void *a, const void *b) {
+    const struct OpenrtlAllocSegment *x = a;
+    const struct OpenrtlAllocSegment *y = b;
+    if (x->parent != y->parent) {
+        return x->parent < y->parent ? -1 : 1;
+    }
+    return (x->start > y->start) - (x->start < y->start);
+}
+
+static void openrtl_alloc_push_range(OpenrtlRegalloc *alloc, OpenrtlLifetime start, OpenrtlLifetime end) {
+    if (alloc->ranges.len == alloc->ranges.cap) {
+        alloc->ranges.cap *= 2;
+        alloc->ranges.ranges = openrtl_realloc(alloc->allocator, alloc->ranges.ranges, alloc->ranges.len * sizeof(struct OpenrtlRange), alloc->ranges.cap * sizeof(struct OpenrtlRange));
+    }
+    alloc->ranges.ranges[alloc->ranges.len].start = start;
+    alloc->ranges.ranges[alloc->ranges.len++].end = end;
+}
+
+// the `k`th range of `interval`
+static struct OpenrtlRange openrtl_alloc_range(const OpenrtlRegalloc *alloc, const struct OpenrtlInterval *interval, size_t k) {
+    if (interval->nranges) {
+        return alloc->ranges.ranges[interval->ranges + k];
+    }
+    struct OpenrtlRange range = { interval->start, interval->end };
+    return range;
+}
+
+static int openrtl_alloc_overlap(const OpenrtlRegalloc *alloc, const struct OpenrtlInterval *a, const struct OpenrtlInterval *b) {
+    size_t na = a->nranges ? a->nranges : 1;
+    size_t nb = b->nranges ? b->nranges : 1;
+    size_t i = 0;
+    size_t j = 0;
+    while (i < na && j < nb) {
+        struct OpenrtlRange x = openrtl_alloc_range(alloc, a, i);
+        struct OpenrtlRange y = openrtl_alloc_range(alloc, b, j);
+        if (x.end < y.start) {
+            i++;
+        } else if (y.end < x.start) {
+            j++;
+        } else {
+            return 1;
         }
     }
+    return 0;
+}
+
+// an active interval whose register `interval` fits in the holes of
+// every interval holding it, or the number of active intervals. only a
+// register held by intervals of its own file is shared
+static size_t openrtl_alloc_hole(const OpenrtlRegalloc *alloc, const struct OpenrtlInterval *interval) {
+    for (size_t k = 0; k < alloc->active.len; k++) {
+        uint32_t number = alloc->active.actives[k].reg.number;
+        size_t j;
+        for (j = 0; j < alloc->active.len; j++) {
+            const struct OpenrtlInterval *holder = alloc->live.intervals + alloc->active.actives[j].index;
+            if (alloc->active.actives[j].reg.number == number && (holder->file != interval->file || openrtl_alloc_overlap(alloc, interval, holder))) {
+                break;
+            }
+        }
+        if (j == alloc->active.len) {
+            return k;
+        }
+    }
+    return alloc->active.len;
 }
 
 static void openrtl_alloc_inst(OpenrtlRegalloc *alloc, OpenrtlContext *ctx, OpenrtlBuffer *buf, OpenrtlInst *inst, void *arg, size_t idx) {
     (void) ctx;
     (void) buf;
     (void) arg;
+    uint8_t files[3];
+    openrtl_inst_files(inst->opcode, files);
     switch (inst->opcode) {
     // 1
     case OPENRTL_OP_CALL_INDIRECT:
@@ -207,7 +538,7 @@ static void openrtl_alloc_inst(OpenrtlRegalloc *alloc, OpenrtlContext *ctx, Open
     case OPENRTL_OP_FPUSH:
     case OPENRTL_OP_EXTEND:
     case OPENRTL_OP_VTRUNCATE:
-        alloc->live.intervals[alloc->variables[inst->arith.dest]].end = idx;
+        openrtl_alloc_use(alloc, files[0], inst->arith.dest, idx);
         break;
     // 2
     case OPENRTL_OP_IMOVE_UNSIGNED:
@@ -218,8 +549,11 @@ static void openrtl_alloc_inst(OpenrtlRegalloc *alloc, OpenrtlContext *ctx, Open
     case OPENRTL_OP_F2BITS:
     case OPENRTL_OP_BITS2F:
     case OPENRTL_OP_VEXTEND:
-        alloc->live.intervals[alloc->variables[inst->arith.dest]].end = idx;
-        alloc->live.intervals[alloc->variables[inst->arith.src1]].end = idx;
+    case OPENRTL_OP_ISHIFT:
+    case OPENRTL_OP_ISHIFT_VARIABLE:
+    case OPENRTL_OP_IBITS:
+        openrtl_alloc_use(alloc, files[0], inst->arith.dest, idx);
+        openrtl_alloc_use(alloc, files[1], inst->arith.src1, idx);
         break;
     // 3
     case OPENRTL_OP_IADD:
@@ -254,9 +588,9 @@ static void openrtl_alloc_inst(OpenrtlRegalloc *alloc, OpenrtlContext *ctx, Open
     case OPENRTL_OP_VCROSS:
     case OPENRTL_OP_VLOAD:
     case OPENRTL_OP_VSTORE:
-        alloc->live.intervals[alloc->variables[inst->arith.dest]].end = idx;
-        alloc->live.intervals[alloc->variables[inst->arith.src1]].end = idx;
-        alloc->live.intervals[alloc->variables[inst->arith.src2]].end = idx;
+        openrtl_alloc_use(alloc, files[0], inst->arith.dest, idx);
+        openrtl_alloc_use(alloc, files[1], inst->arith.src1, idx);
+        openrtl_alloc_use(alloc, files[2], inst->arith.src2, idx);
         break;
     default:
         break;
@@ -276,6 +610,9 @@ static void openrtl_alloc_inst(OpenrtlRegalloc *alloc, OpenrtlContext *ctx, Open
     case OPENRTL_OP_F2BITS:
     case OPENRTL_OP_BITS2F:
     case OPENRTL_OP_VEXTEND:
+    case OPENRTL_OP_ISHIFT:
+    case OPENRTL_OP_ISHIFT_VARIABLE:
+    case OPENRTL_OP_IBITS:
     case OPENRTL_OP_IADD:
     case OPENRTL_OP_IADD_CARRY:
     case OPENRTL_OP_IAND:
@@ -310,10 +647,11 @@ static void openrtl_alloc_inst(OpenrtlRegalloc *alloc, OpenrtlContext *ctx, Open
     case OPENRTL_OP_VSTORE:
         if (alloc->live.len == alloc->live.cap) {
             alloc->live.cap *= 2;
-            alloc->live.intervals = realloc(alloc->live.intervals, alloc->live.cap * sizeof(struct OpenrtlInterval));
+            alloc->live.intervals = openrtl_realloc(alloc->allocator, alloc->live.intervals, alloc->live.len * sizeof(struct OpenrtlInterval), alloc->live.cap * sizeof(struct OpenrtlInterval));
         }
 
         alloc->live.intervals[alloc->live.len].name = alloc->counter++ << 8 | inst->arith.dest;
+        alloc->live.intervals[alloc->live.len].file = files[0];
         alloc->live.intervals[alloc->live.len].ti.size = 1 << inst->size;
         alloc->live.intervals[alloc->live.len].ti.align = 1 << inst->size;
         alloc->live.intervals[alloc->live.len].purpose.tag = OPENRTL_REG_SPILLED;
@@ -324,7 +662,8 @@ static void openrtl_alloc_inst(OpenrtlRegalloc *alloc, OpenrtlContext *ctx, Open
         alloc->live.intervals[alloc->live.len].end = idx;
         alloc->live.intervals[alloc->live.len].stack = 0;
         alloc->live.intervals[alloc->live.len].reserved = 0;
-        alloc->variables[inst->arith.dest] = alloc->live.len;
+        alloc->live.intervals[alloc->live.len].nranges = 0;
+        alloc->variables[openrtl_reg_slot(files[0], inst->arith.dest)] = alloc->live.len;
         ++alloc->live.len;
         break;
     default:
@@ -332,17 +671,26 @@ static void openrtl_alloc_inst(OpenrtlRegalloc *alloc, OpenrtlContext *ctx, Open
     }
 }
 
+// extends the interval of the current definition of `reg`, if any
+static void openrtl_alloc_use(OpenrtlRegalloc *alloc, int file, uint8_t reg, size_t idx) {
+    size_t slot = openrtl_reg_slot(file, reg);
+    if (alloc->variables[slot] >= 0) {
+        alloc->live.intervals[alloc->variables[slot]].end = idx;
+    }
+}
+
 int openrtl_alloc_allocate(OpenrtlRegalloc *alloc) {
     openrtl_alloc_sort_live(alloc->live.intervals, 0, alloc->live.len - 1);
 
     size_t expire_len = 0;
-    size_t *expire = malloc(sizeof(size_t) * alloc->live.len);
+    size_t *expire = openrtl_malloc(alloc->allocator, sizeof(size_t) * alloc->live.len);
 
     size_t delta_len = 0;
-    struct OpenrtlPurposePair *delta = malloc(sizeof(struct OpenrtlPurposePair) * alloc->registers.len);
+    struct OpenrtlPurposePair *delta = openrtl_malloc(alloc->allocator, sizeof(struct OpenrtlPurposePair) * alloc->registers.len);
 
     for (size_t idx = 0; idx < alloc->live.len; idx++) {
         struct OpenrtlInterval *i = alloc->live.intervals + idx;
+        size_t hole;
 
         openrtl_alloc_sort_active(alloc->live.intervals, alloc->active.actives, 0, alloc->active.len - 1);
         for (size_t idx0 = 0; idx0 < alloc->active.len; idx0++) {
@@ -366,9 +714,20 @@ int openrtl_alloc_allocate(OpenrtlRegalloc *alloc) {
                     --expire[i];
                 }
             }
+            // a register shared through a lifetime hole is free once the
+            // last interval holding it expires
+            size_t k;
+            for (k = 0; k < alloc->active.len; k++) {
+                if (alloc->active.actives[k].reg.number == active.reg.number) {
+                    break;
+                }
+            }
+            if (k < alloc->active.len) {
+                continue;
+            }
             if (alloc->registers.len == alloc->registers.cap) {
                 alloc->registers.cap *= 2;
-                alloc->registers.registers = realloc(alloc->registers.registers, sizeof(struct OpenrtlGmReg) * alloc->registers.cap);
+                alloc->registers.registers = openrtl_realloc(alloc->allocator, alloc->registers.registers, sizeof(struct OpenrtlGmReg) * alloc->registers.len, sizeof(struct OpenrtlGmReg) * alloc->registers.cap);
             }
             alloc->registers.registers[alloc->registers.len++] = active.reg;
         }
@@ -396,6 +755,20 @@ int openrtl_alloc_allocate(OpenrtlRegalloc *alloc) {
 
             --alloc->registers.len;
             memmove(alloc->registers.registers + j, alloc->registers.registers + j + 1, (alloc->registers.len - j) * sizeof(struct OpenrtlGmReg));
+        } else if (!alloc->registers.len && (hole = openrtl_alloc_hole(alloc, i)) < alloc->active.len) {
+            struct OpenrtlGmReg reg = alloc->active.actives[hole].reg;
+            delta[delta_len].index = idx;
+            delta[delta_len].purpose.tag = OPENRTL_REG_ALLOCATED;
+            delta[delta_len].purpose.reg.number = reg.number;
+            delta[delta_len++].purpose.reg.size = log2ll(i->ti.size);
+
+            if (alloc->active.len == alloc->active.cap) {
+                alloc->active.cap *= 2;
+                alloc->active.actives = openrtl_realloc(alloc->allocator, alloc->active.actives, sizeof(struct OpenrtlActive) * alloc->active.len, sizeof(struct OpenrtlActive) * alloc->active.cap);
+            }
+
+            alloc->active.actives[alloc->active.len].index = idx;
+            alloc->active.actives[alloc->active.len++].reg = reg;
         } else if (!alloc->registers.len) {
             alloc->offset += 8;
             delta[delta_len].index = idx;
@@ -410,7 +783,7 @@ int openrtl_alloc_allocate(OpenrtlRegalloc *alloc) {
                 
             if (alloc->active.len == alloc->active.cap) {
                 alloc->active.cap *= 2;
-                alloc->active.actives = realloc(alloc->active.actives, sizeof(struct OpenrtlActive) * alloc->active.cap);
+                alloc->active.actives = openrtl_realloc(alloc->allocator, alloc->active.actives, sizeof(struct OpenrtlActive) * alloc->active.len, sizeof(struct OpenrtlActive) * alloc->active.cap);
             }
             
             alloc->active.actives[alloc->active.len].index = idx;
@@ -423,8 +796,8 @@ int openrtl_alloc_allocate(OpenrtlRegalloc *alloc) {
         delta_len = 0;
     }
 
-    free(expire);
-    free(delta);
+    openrtl_free(alloc->allocator, expire);
+    openrtl_free(alloc->allocator, delta);
 
     return 0;
 }
@@ -485,3 +858,23 @@ static void openrtl_alloc_memswap(void *a, void *b, size_t size, void *temp) {
     memcpy(a, b, size);
     memcpy(b, temp, size);
 }
+
+static int openrtl_alloc_regtable_push(struct OpenrtlRegisterTable *dest, OpenrtlLifetime start, OpenrtlLifetime end, uint64_t key, struct OpenrtlPurpose purpose) {
+    if (dest->len == dest->cap) {
+        struct OpenrtlRegEntry *entries = openrtl_realloc(dest->allocator, dest->entries, dest->len * sizeof(struct OpenrtlRegEntry), 2 * dest->cap * sizeof(struct OpenrtlRegEntry));
+        if (!entries) {
+            openrtl_free(dest->allocator, dest->entries);
+            dest->entries = NULL;
+            dest->len = 0;
+            dest->cap = 0;
+            return 1;
+        }
+        dest->entries = entries;
+        dest->cap *= 2;
+    }
+    dest->entries[dest->len].start = start;
+    dest->entries[dest->len].end = end;
+    dest->entries[dest->len].key = key;
+    dest->entries[dest->len++].purpose = purpose;
+    return 0;
+}
@@ -0,0 +1,346 @@
+#include <string.h>
+#include "include/openrtl.h"
+#include "internal.h"
+
+#define DEFAULT_REWRITE_CAP 64
+
+static size_t openrtl_rewrite_find(const struct OpenrtlRewrite *rw, size_t offset);
+static size_t openrtl_rewrite_after(const struct OpenrtlRewrite *rw, size_t offset);
+static size_t openrtl_rewrite_map(const struct OpenrtlRewrite *rw, const size_t *anchors, size_t len, size_t end, size_t offset);
+static uint64_t openrtl_rewrite_operand(const struct OpenrtlRewrite *rw, const OpenrtlBuffer *buf, const size_t *anchors, size_t len, size_t end, const struct OpenrtlRewriteInst *it);
+static const struct OpenrtlEntry *openrtl_rewrite_label(const OpenrtlBuffer *buf, const struct OpenrtlSymbol *sym);
+
+// decodes `buf` for a pass to edit, a segmented buffer is finalized
+// first. only pc-relative operands refer to the buffer, see
+// `openrtl_jump_operand`, they hold the offset of their target. a
+// literal operand is an address that does not move
+int openrtl_rewrite(struct OpenrtlRewrite *rw, OpenrtlBuffer *buf) {
+    rw->allocator = buf->allocator;
+    rw->len = 0;
+    rw->cap = 0;
+    rw->ptr = NULL;
+    rw->end = buf->len;
+    if (openrtl_coalesce(buf)) {
+        return 1;
+    }
+
+    size_t len = openrtl_inst_count(buf);
+    rw->cap = len > DEFAULT_REWRITE_CAP ? len : DEFAULT_REWRITE_CAP;
+    rw->ptr = openrtl_malloc(rw->allocator, rw->cap * sizeof(struct OpenrtlRewriteInst));
+    if (!rw->ptr) {
+        return 1;
+    }
+    OpenrtlIter iter;
+    openrtl_iter(&iter, buf);
+    while (openrtl_iter_next(&iter)) {
+        struct OpenrtlRewriteInst *it = rw->ptr + rw->len++;
+        memset(it, 0, sizeof(struct OpenrtlRewriteInst));
+        it->offset = iter.offset;
+        it->inst = iter.inst;
+        it->operand = iter.operand;
+    }
+
+    for (size_t i = 0; i < buf->linker.len; i++) {
+        size_t at = openrtl_rewrite_find(rw, buf->linker.ptr[i].offset - 4);
+        if (at < rw->len && openrtl_is_rel(rw->ptr[at].inst.opcode)) {
+            rw->ptr[at].symbol = i + 1;
+        }
+    }
+    for (size_t i = 0; i < rw->len; i++) {
+        struct OpenrtlRewriteInst *it = rw->ptr + i;
+        if (it->symbol) {
+            continue;
+        }
+        if (openrtl_is_pcrel(&it->inst)) {
+            it->operand += it->offset;
+            it->target = 1;
+        }
+    }
+    return 0;
+}
+
+void openrtl_del_rewrite(struct OpenrtlRewrite *rw) {
+    openrtl_free(rw->allocator, rw->ptr);
+}
+
+// inserts an instruction before the `at`th. an inserted instruction is
+// never the target of a branch or label, those go to the instruction
+// that follows
+int openrtl_rewrite_insert(struct OpenrtlRewrite *rw, size_t at, const OpenrtlInst *inst, uint64_t operand) {
+    if (rw->len == rw->cap) {
+        size_t cap = rw->cap ? 2 * rw->cap : DEFAULT_REWRITE_CAP;
+        void *ptr = openrtl_realloc(rw->allocator, rw->ptr, rw->cap * sizeof(struct OpenrtlRewriteInst), cap * sizeof(struct OpenrtlRewriteInst));
+        if (!ptr) {
+            return 1;
+        }
+        rw->ptr = ptr;
+        rw->cap = cap;
+    }
+    memmove(rw->ptr + at + 1, rw->ptr + at, (rw->len - at) * sizeof(struct OpenrtlRewriteInst));
+    ++rw->len;
+    struct OpenrtlRewriteInst *it = rw->ptr + at;
+    memset(it, 0, sizeof(struct OpenrtlRewriteInst));
+    it->offset = at + 1 < rw->len ? rw->ptr[at + 1].offset : rw->end;
+    it->inst = *inst;
+    it->operand = operand;
+    it->inserted = 1;
+    return 0;
+}
+
+// flags the instructions that local labels and branches lead to, which
+// may be reached other than from the instruction before them. NULL when
+// out of memory
+uint8_t *openrtl_rewrite_leaders(const struct OpenrtlRewrite *rw, const OpenrtlBuffer *buf) {
+    uint8_t *leader = openrtl_calloc(rw->allocator, rw->len ? rw->len : 1, 1);
+    if (!leader) {
+        return NULL;
+    }
+    for (size_t i = 0; i < buf->local.len; i++) {
+        if (!buf->local.ptr[i].label) {
+            continue;
+        }
+        size_t at = openrtl_rewrite_after(rw, buf->local.ptr[i].addr);
+        if (at < rw->len) {
+            leader[at] = 1;
+        }
+    }
+    for (size_t i = 0; i < rw->len; i++) {
+        if (rw->ptr[i].target) {
+            size_t at = openrtl_rewrite_after(rw, rw->ptr[i].operand);
+            if (at < rw->len) {
+                leader[at] = 1;
+            }
+        }
+    }
+    return leader;
+}
+
+// flags the instructions control may enter the buffer at other than
+// through a branch: the start, calls into the buffer and local labels
+// whose address is taken. NULL when out of memory
+uint8_t *openrtl_rewrite_entries(const struct OpenrtlRewrite *rw, const OpenrtlBuffer *buf) {
+    uint8_t *entry = openrtl_calloc(rw->allocator, rw->len ? rw->len : 1, 1);
+    if (!entry) {
+        return NULL;
+    }
+    entry[0] = 1;
+    for (size_t i = 0; i < rw->len; i++) {
+        const struct OpenrtlRewriteInst *it = rw->ptr + i;
+        size_t at = rw->len;
+        if (it->symbol && !openrtl_is_branch(it->inst.opcode)) {
+            const struct OpenrtlEntry *ent = openrtl_rewrite_label(buf, buf->linker.ptr + it->symbol - 1);
+            if (ent) {
+                at = openrtl_rewrite_after(rw, ent->addr);
+            }
+        } else if (it->target && it->inst.opcode == OPENRTL_OP_CALL) {
+            at = openrtl_rewrite_after(rw, it->operand);
+        }
+        if (at < rw->len) {
+            entry[at] = 1;
+        }
+    }
+    return entry;
+}
+
+// whether the flags the `at`th instruction sets may still be read.
+// control that leaves the straight line of code is assumed to read them,
+// an add with carry reads them before it sets its own
+int openrtl_rewrite_flags(const struct OpenrtlRewrite *rw, size_t at) {
+    for (size_t i = at + 1; i < rw->len; i++) {
+        unsigned int opcode = rw->ptr[i].inst.opcode;
+        if (rw->ptr[i].dead) {
+            continue;
+        }
+        if (openrtl_is_jump(opcode) || opcode == OPENRTL_OP_CALL_INDIRECT || opcode == OPENRTL_OP_RETURN || opcode == OPENRTL_OP_IADD_CARRY) {
+            return 1;
+        }
+        if (openrtl_sets_flags(opcode)) {
+            return 0;
+        }
+    }
+    return 0;
+}
+
+// encodes the edited instructions back into `buf`. labels, symbols and
+// branches follow the instructions they refer to, those of a deleted
+// instruction go to the next one that is kept. symbols of deleted
+// instructions are dropped, so passes run before `openrtl_add_buffer`.
+// the matrix is rebuilt and the index dropped
+int openrtl_rewrite_commit(struct OpenrtlRewrite *rw, OpenrtlBuffer *buf) {
+    // instructions that were decoded, in their original order
+    size_t len = 0;
+    size_t *anchors = openrtl_malloc(rw->allocator, (rw->len ? rw->len : 1) * sizeof(size_t));
+    if (!anchors) {
+        return 1;
+    }
+    for (size_t i = 0; i < rw->len; i++) {
+        struct OpenrtlRewriteInst *it = rw->ptr + i;
+        if (!it->inserted) {
+            anchors[len++] = i;
+        }
+        if (it->symbol && openrtl_is_pcrel(&it->inst)) {
+            // see `openrtl_relax_buffer`, an address is never encoded
+            // pc-relative
+            struct OpenrtlSymbol *sym = buf->linker.ptr + it->symbol - 1;
+            const struct OpenrtlEntry *ent = sym->type == OPENRTL_SYMBOL_LOCAL ? openrtl_table_find(&buf->local, sym->name) : NULL;
+            if (ent && !ent->label) {
+                it->inst.size = OPENRTL_REL_ABSOLUTE;
+                sym->relative = 0;
+            }
+        }
+        if (!it->symbol && !it->target && openrtl_is_rel(it->inst.opcode)) {
+            it->inst.rel.len = openrtl_inst_rel_len(&it->inst, openrtl_is_pcrel(&it->inst) ? it->operand - it->offset : it->operand);
+        }
+    }
+
+    // code only shrinks when instructions are deleted, but moved ones may
+    // need wider branches, which are grown until nothing changes
+    size_t end;
+    int grown;
+    do {
+        end = 0;
+        for (size_t i = 0; i < rw->len; i++) {
+            rw->ptr[i].at = end;
+            if (!rw->ptr[i].dead) {
+                end += openrtl_inst_len(&rw->ptr[i].inst);
+            }
+        }
+        grown = 0;
+        for (size_t i = 0; i < rw->len; i++) {
+            struct OpenrtlRewriteInst *it = rw->ptr + i;
+            if (it->dead || !it->target) {
+                continue;
+            }
+            size_t rel = openrtl_inst_rel_len(&it->inst, openrtl_rewrite_operand(rw, buf, anchors, len, end, it));
+            if (rel > it->inst.rel.len) {
+                it->inst.rel.len = rel;
+                grown = 1;
+            }
+        }
+    } while (grown);
+
+    char *ptr = openrtl_malloc(buf->allocator, end > buf->cap ? end : buf->cap);
+    if (!ptr) {
+        openrtl_free(rw->allocator, anchors);
+        return 1;
+    }
+    for (size_t i = 0; i < rw->len; i++) {
+        struct OpenrtlRewriteInst *it = rw->ptr + i;
+        if (it->dead) {
+            continue;
+        }
+        memcpy(ptr + it->at, &it->inst, 4);
+        if (openrtl_is_rel(it->inst.opcode)) {
+            uint64_t value = openrtl_rewrite_operand(rw, buf, anchors, len, end, it);
+            memcpy(ptr + it->at + 4, &value, it->inst.rel.len);
+        }
+    }
+
+    size_t symbols = 0;
+    for (size_t i = 0; i < buf->linker.len; i++) {
+        struct OpenrtlSymbol *sym = buf->linker.ptr + i;
+        size_t at = openrtl_rewrite_find(rw, sym->offset - 4);
+        if (at < rw->len && rw->ptr[at].symbol == i + 1) {
+            if (rw->ptr[at].dead) {
+                continue;
+            }
+            sym->offset = rw->ptr[at].at + 4;
+        } else {
+            sym->offset = openrtl_rewrite_map(rw, anchors, len, end, sym->offset - 4) + 4;
+        }
+        if (openrtl_rewrite_label(buf, sym)) {
+            sym->address = openrtl_rewrite_map(rw, anchors, len, end, sym->address);
+        }
+        buf->linker.ptr[symbols++] = *sym;
+    }
+    buf->linker.len = symbols;
+    for (size_t i = 0; i < buf->local.len; i++) {
+        struct OpenrtlEntry *ent = buf->local.ptr + i;
+        if (ent->label) {
+            ent->addr = openrtl_rewrite_map(rw, anchors, len, end, ent->addr);
+        }
+    }
+    openrtl_free(rw->allocator, anchors);
+
+    openrtl_free(buf->allocator, buf->ptr);
+    buf->ptr = ptr;
+    buf->len = end;
+    if (end > buf->cap) {
+        buf->cap = end;
+    }
+    rw->end = end;
+    openrtl_drop_index(buf);
+    if (buf->record || buf->matrix.len) {
+        return openrtl_matrix_build(buf);
+    }
+    return 0;
+}
+
+// instruction decoded at `offset`, or the number of instructions. only
+// valid before anything is inserted
+static size_t openrtl_rewrite_find(const struct OpenrtlRewrite *rw, size_t offset) {
+    size_t at = openrtl_rewrite_after(rw, offset);
+    return at < rw->len && rw->ptr[at].offset == offset && !rw->ptr[at].inserted ? at : rw->len;
+}
+
+// first instruction decoded at or after `offset`
+static size_t openrtl_rewrite_after(const struct OpenrtlRewrite *rw, size_t offset) {
+    size_t lo = 0;
+    size_t hi = rw->len;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (rw->ptr[mid].offset < offset) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// new offset of what was at or after `offset`
+static size_t openrtl_rewrite_map(const struct OpenrtlRewrite *rw, const size_t *anchors, size_t len, size_t end, size_t offset) {
+    size_t lo = 0;
+    size_t hi = len;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (rw->ptr[anchors[mid]].offset < offset) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo < len ? rw->ptr[anchors[lo]].at : end;
+}
+
+// operand as encoded at the current position of `it`
+static uint64_t openrtl_rewrite_operand(const struct OpenrtlRewrite *rw, const OpenrtlBuffer *buf, const size_t *anchors, size_t len, size_t end, const struct OpenrtlRewriteInst *it) {
+    uint64_t value = it->operand;
+    if (it->symbol) {
+        // local symbols are patched right away, labels at their new
+        // offset, anything else is left to the linker
+        const struct OpenrtlSymbol *sym = buf->linker.ptr + it->symbol - 1;
+        const struct OpenrtlEntry *ent = sym->type == OPENRTL_SYMBOL_LOCAL ? openrtl_table_find(&buf->local, sym->name) : NULL;
+        if (!ent) {
+            return value;
+        }
+        value = ent->label ? openrtl_rewrite_map(rw, anchors, len, end, ent->addr) : ent->addr;
+        if (sym->relative) {
+            value -= it->at;
+        }
+        return value & sym->mask;
+    }
+    if (it->target) {
+        value = openrtl_rewrite_map(rw, anchors, len, end, value);
+    }
+    if (openrtl_is_pcrel(&it->inst)) {
+        value -= it->at;
+    }
+    return value;
+}
+
+// local label the operand of `sym` refers to, or NULL for an address
+static const struct OpenrtlEntry *openrtl_rewrite_label(const OpenrtlBuffer *buf, const struct OpenrtlSymbol *sym) {
+    const struct OpenrtlEntry *ent = sym->type == OPENRTL_SYMBOL_LOCAL ? openrtl_table_find(&buf->local, sym->name) : NULL;
+    return ent && ent->label ? ent : NULL;
+}
@@ -0,0 +1,415 @@
+#include <string.h>
+#include "include/openrtl.h"
+#include "internal.h"
+
+#define STRENGTH_MAX 8
+
+// what replaces an instruction, nothing when it is deleted
+struct OpenrtlStrength {
+    int reduced;
+    size_t len;
+    OpenrtlInst inst[STRENGTH_MAX];
+    uint64_t operand[STRENGTH_MAX];
+};
+
+static void openrtl_strength_block(const struct OpenrtlRewrite *rw, const OpenrtlCfg *cfg, const struct OpenrtlRegSet *in, size_t b, struct OpenrtlRegSet *live, struct OpenrtlRegSet *after);
+static void openrtl_strength_reduce(struct OpenrtlStrength *seq, const struct OpenrtlConsts *state, const struct OpenrtlRegSet *after, const OpenrtlInst *inst);
+static void openrtl_strength_multiply(struct OpenrtlStrength *seq, unsigned int size, uint8_t dest, uint8_t x, uint64_t c);
+static void openrtl_strength_unsigned(struct OpenrtlStrength *seq, const struct OpenrtlRegSet *after, const OpenrtlInst *inst, uint64_t c);
+static void openrtl_strength_signed(struct OpenrtlStrength *seq, const struct OpenrtlRegSet *after, const OpenrtlInst *inst, int64_t c);
+static size_t openrtl_strength_temps(const struct OpenrtlRegSet *after, const OpenrtlInst *inst, int keep, uint8_t *temps, size_t n);
+static void openrtl_strength_arith(struct OpenrtlStrength *seq, unsigned int opcode, unsigned int size, uint8_t dest, uint8_t src1, uint8_t src2);
+static void openrtl_strength_move(struct OpenrtlStrength *seq, unsigned int opcode, unsigned int size, uint8_t dest, uint8_t src, unsigned int from);
+static void openrtl_strength_imm(struct OpenrtlStrength *seq, unsigned int size, uint8_t dest, uint64_t value);
+
+static inline void openrtl_strength_shift(struct OpenrtlStrength *seq, unsigned int size, uint8_t dest, uint8_t src, unsigned int kind, unsigned int count) {
+    openrtl_strength_arith(seq, OPENRTL_OP_ISHIFT, size, dest, src, kind << 6 | count);
+}
+
+// the exponent of `c` when it is a power of two, -1 otherwise
+static inline int openrtl_strength_log2(uint64_t c) {
+    if (!c || (c & (c - 1))) {
+        return -1;
+    }
+    int k = 0;
+    while (c >>= 1) {
+        ++k;
+    }
+    return k;
+}
+
+// replaces multiplies by powers of two with shifts and divisions and
+// remainders by constants with shifts, masks and multiplies by a
+// reciprocal. the reciprocal is multiplied at 64 bits, which holds the
+// whole product for sizes up to 32 bits, so 64 bit division is only
+// reduced for powers of two. the temporaries a sequence needs are
+// registers nothing reads before they are written again, taking every
+// register to be read wherever control leaves the buffer or calls out
+int openrtl_reduce_strength(OpenrtlBuffer *buf) {
+    if (!openrtl_const_moved(buf)) {
+        return 0;
+    }
+    struct OpenrtlRewrite rw;
+    OpenrtlCfg cfg;
+    if (openrtl_rewrite(&rw, buf)) {
+        openrtl_del_rewrite(&rw);
+        return 1;
+    }
+    if (openrtl_cfg(&cfg, buf)) {
+        openrtl_del_cfg(&cfg);
+        openrtl_del_rewrite(&rw);
+        return 1;
+    }
+    struct OpenrtlConsts *out = openrtl_malloc(rw.allocator, (cfg.len ? cfg.len : 1) * sizeof(struct OpenrtlConsts));
+    uint8_t *seen = openrtl_calloc(rw.allocator, cfg.len ? cfg.len : 1, 1);
+    uint8_t *entry = openrtl_rewrite_entries(&rw, buf);
+    struct OpenrtlConsts *state = openrtl_malloc(rw.allocator, sizeof(struct OpenrtlConsts));
+    struct OpenrtlRegSet *in = openrtl_calloc(rw.allocator, cfg.len ? cfg.len : 1, sizeof(struct OpenrtlRegSet));
+    struct OpenrtlRegSet *after = openrtl_malloc(rw.allocator, (rw.len ? rw.len : 1) * sizeof(struct OpenrtlRegSet));
+    struct OpenrtlStrength *seqs = openrtl_calloc(rw.allocator, rw.len ? rw.len : 1, sizeof(struct OpenrtlStrength));
+    int status = !out || !seen || !entry || !state || !in || !after || !seqs;
+
+    if (!status) {
+        openrtl_const_flow(&rw, &cfg, entry, out, seen, state);
+
+        // registers live on entry to every block, then those live after
+        // every instruction
+        int changed;
+        do {
+            changed = 0;
+            for (size_t b = cfg.len; b-- > 0;) {
+                struct OpenrtlRegSet live;
+                openrtl_strength_block(&rw, &cfg, in, b, &live, NULL);
+                if (memcmp(&live, in + b, sizeof(live))) {
+                    in[b] = live;
+                    changed = 1;
+                }
+            }
+        } while (changed);
+        for (size_t b = 0; b < cfg.len; b++) {
+            struct OpenrtlRegSet live;
+            openrtl_strength_block(&rw, &cfg, in, b, &live, after);
+        }
+
+        // the sequences are chosen first and inserted from the back, so
+        // the instructions of the graph keep their indices meanwhile
+        for (size_t i = 0; i < cfg.reachable; i++) {
+            size_t b = cfg.order[i];
+            const struct OpenrtlBlock *block = cfg.blocks + b;
+            struct OpenrtlConstFlags flags = {0};
+            openrtl_const_entry(&cfg, out, seen, entry, b, state);
+            for (size_t at = block->first; at < block->last; at++) {
+                struct OpenrtlRewriteInst *it = rw.ptr + at;
+                uint64_t result;
+                // every instruction reduced sets the flags, which the
+                // sequence replacing it would not leave the same
+                if (!it->dead && openrtl_sets_flags(it->inst.opcode) && !openrtl_rewrite_flags(&rw, at)) {
+                    openrtl_strength_reduce(seqs + at, state, after + at, &it->inst);
+                }
+                openrtl_const_step(state, &flags, it, &result);
+            }
+        }
+    }
+
+    int edited = 0;
+    for (size_t at = rw.len; at-- > 0 && !status;) {
+        const struct OpenrtlStrength *seq = seqs + at;
+        if (!seq->reduced) {
+            continue;
+        }
+        edited = 1;
+        if (!seq->len) {
+            rw.ptr[at].dead = 1;
+            continue;
+        }
+        // the first instruction takes the place of the reduced one, so
+        // branches to it run the whole sequence
+        rw.ptr[at].inst = seq->inst[0];
+        rw.ptr[at].operand = seq->operand[0];
+        for (size_t k = 1; k < seq->len && !status; k++) {
+            status = openrtl_rewrite_insert(&rw, at + k, seq->inst + k, seq->operand[k]);
+        }
+    }
+
+    openrtl_free(rw.allocator, out);
+    openrtl_free(rw.allocator, seen);
+    openrtl_free(rw.allocator, entry);
+    openrtl_free(rw.allocator, state);
+    openrtl_free(rw.allocator, in);
+    openrtl_free(rw.allocator, after);
+    openrtl_free(rw.allocator, seqs);
+    openrtl_del_cfg(&cfg);
+    if (!status && edited) {
+        status = openrtl_rewrite_commit(&rw, buf);
+    }
+    openrtl_del_rewrite(&rw);
+    return status;
+}
+
+// walks block `b` backwards from the registers live on exit from it and
+// leaves those live on entry in `live`, and those live after every
+// instruction in `after` when it is given
+static void openrtl_strength_block(const struct OpenrtlRewrite *rw, const OpenrtlCfg *cfg, const struct OpenrtlRegSet *in, size_t b, struct OpenrtlRegSet *live, struct OpenrtlRegSet *after) {
+    const struct OpenrtlBlock *block = cfg->blocks + b;
+    memset(live, block->exit ? 0xff : 0, sizeof(*live));
+    for (size_t s = 0; s < block->nsucc; s++) {
+        for (size_t w = 0; w < OPENRTL_REGSET_WORDS; w++) {
+            live->bits[w] |= in[block->succ[s]].bits[w];
+        }
+    }
+    for (size_t at = block->last; at-- > block->first;) {
+        const OpenrtlInst *inst = &rw->ptr[at].inst;
+        if (after) {
+            after[at] = *live;
+        }
+        if (inst->opcode == OPENRTL_OP_CALL || inst->opcode == OPENRTL_OP_CALL_INDIRECT || inst->opcode == OPENRTL_OP_RETURN) {
+            memset(live, 0xff, sizeof(*live));
+            continue;
+        }
+        struct OpenrtlInstRegs regs;
+        openrtl_inst_regs(inst, &regs);
+        if (regs.ndef) {
+            openrtl_regset_del(live, regs.def_file, regs.def);
+        }
+        for (size_t i = 0; i < regs.nuse; i++) {
+            openrtl_regset_add(live, regs.use_file[i], regs.use[i]);
+        }
+    }
+}
+
+// fills `seq` when `inst` multiplies by, divides by or takes the
+// remainder of a constant it can do without
+static void openrtl_strength_reduce(struct OpenrtlStrength *seq, const struct OpenrtlConsts *state, const struct OpenrtlRegSet *after, const OpenrtlInst *inst) {
+    unsigned int size = inst->size;
+    uint8_t src1 = inst->arith.src1;
+    uint8_t src2 = inst->arith.src2;
+    switch (inst->opcode) {
+    case OPENRTL_OP_IMULTIPLY_UNSIGNED:
+    case OPENRTL_OP_IMULTIPLY_SIGNED:
+        if (state->known[src2] > size) {
+            openrtl_strength_multiply(seq, size, inst->arith.dest, src1, state->value[src2] & openrtl_const_mask(size));
+        } else if (state->known[src1] > size) {
+            openrtl_strength_multiply(seq, size, inst->arith.dest, src2, state->value[src1] & openrtl_const_mask(size));
+        }
+        break;
+    case OPENRTL_OP_IDIVIDE_UNSIGNED:
+    case OPENRTL_OP_IMODULO_UNSIGNED:
+        if (state->known[src2] > size) {
+            openrtl_strength_unsigned(seq, after, inst, state->value[src2] & openrtl_const_mask(size));
+        }
+        break;
+    case OPENRTL_OP_IDIVIDE_SIGNED:
+    case OPENRTL_OP_IMODULO_SIGNED:
+        if (state->known[src2] > size) {
+            openrtl_strength_signed(seq, after, inst, openrtl_const_signed(state->value[src2], size));
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+static void openrtl_strength_multiply(struct OpenrtlStrength *seq, unsigned int size, uint8_t dest, uint8_t x, uint64_t c) {
+    int k = openrtl_strength_log2(c);
+    if (!c) {
+        openrtl_strength_imm(seq, size, dest, 0);
+    } else if (k == 0) {
+        openrtl_strength_move(seq, OPENRTL_OP_IMOVE_UNSIGNED, size, dest, x, size);
+    } else if (k > 0) {
+        openrtl_strength_shift(seq, size, dest, x, OPENRTL_SHIFT_LEFT, k);
+    }
+}
+
+// `x / c` is `x * m >> (bits + s)` for the least `s` whose `m` makes the
+// error small enough for every `x` of `bits`, and a divisor above half
+// the range divides at most once
+static void openrtl_strength_unsigned(struct OpenrtlStrength *seq, const struct OpenrtlRegSet *after, const OpenrtlInst *inst, uint64_t c) {
+    unsigned int size = inst->size;
+    unsigned int bits = 8u << size;
+    int modulo = inst->opcode == OPENRTL_OP_IMODULO_UNSIGNED;
+    uint8_t dest = inst->arith.dest;
+    uint8_t x = inst->arith.src1;
+    int k = openrtl_strength_log2(c);
+    if (!c) {
+        return;
+    }
+    if (k >= 0) {
+        if (!modulo && !k) {
+            openrtl_strength_move(seq, OPENRTL_OP_IMOVE_UNSIGNED, size, dest, x, size);
+        } else if (!modulo) {
+            openrtl_strength_shift(seq, size, dest, x, OPENRTL_SHIFT_RIGHT, k);
+        } else if (!k) {
+            openrtl_strength_imm(seq, size, dest, 0);
+        } else {
+            // the low bits are kept by shifting the rest out and back
+            openrtl_strength_shift(seq, size, dest, x, OPENRTL_SHIFT_LEFT, bits - k);
+            openrtl_strength_shift(seq, size, dest, dest, OPENRTL_SHIFT_RIGHT, bits - k);
+        }
+        return;
+    }
+
+    uint8_t temps[2];
+    if (bits == 64 || openrtl_strength_temps(after, inst, modulo, temps, 2) < 2) {
+        return;
+    }
+    uint8_t t = temps[0];
+    uint8_t u = temps[1];
+    uint8_t q = modulo ? u : dest;
+    openrtl_strength_move(seq, OPENRTL_OP_IMOVE_UNSIGNED, OPENRTL_ISIZE_64, t, x, size);
+    if (c > (uint64_t) 1 << (bits - 1)) {
+        openrtl_strength_imm(seq, OPENRTL_ISIZE_64, u, ((uint64_t) 1 << bits) - c);
+        openrtl_strength_arith(seq, OPENRTL_OP_IADD, OPENRTL_ISIZE_64, u, u, t);
+        openrtl_strength_shift(seq, OPENRTL_ISIZE_64, q, u, OPENRTL_SHIFT_RIGHT, bits);
+    } else {
+        unsigned int s = 0;
+        uint64_t m;
+        for (;; s++) {
+            uint64_t p = (uint64_t) 1 << (bits + s);
+            m = p / c + (p % c != 0);
+            if (m * c - p <= (uint64_t) 1 << s) {
+                break;
+            }
+        }
+        if (m < (uint64_t) 1 << bits) {
+            openrtl_strength_imm(seq, OPENRTL_ISIZE_64, u, m);
+            openrtl_strength_arith(seq, OPENRTL_OP_IMULTIPLY_UNSIGNED, OPENRTL_ISIZE_64, u, u, t);
+            openrtl_strength_shift(seq, OPENRTL_ISIZE_64, q, u, OPENRTL_SHIFT_RIGHT, bits + s);
+        } else {
+            // `m` takes a bit more than `x`, the product is split so that
+            // it still fits
+            openrtl_strength_imm(seq, OPENRTL_ISIZE_64, u, m - ((uint64_t) 1 << bits));
+            openrtl_strength_arith(seq, OPENRTL_OP_IMULTIPLY_UNSIGNED, OPENRTL_ISIZE_64, u, u, t);
+            openrtl_strength_shift(seq, OPENRTL_ISIZE_64, u, u, OPENRTL_SHIFT_RIGHT, bits);
+            openrtl_strength_arith(seq, OPENRTL_OP_IADD, OPENRTL_ISIZE_64, u, u, t);
+            openrtl_strength_shift(seq, OPENRTL_ISIZE_64, q, u, OPENRTL_SHIFT_RIGHT, s);
+        }
+    }
+    if (modulo) {
+        openrtl_strength_arith(seq, OPENRTL_OP_IMULTIPLY_UNSIGNED, size, u, u, inst->arith.src2);
+        openrtl_strength_arith(seq, OPENRTL_OP_ISUBTRACT, size, dest, x, u);
+    }
+}
+
+// a power of two is divided by with a shift once the dividend is biased
+// to round towards zero. any other positive divisor has `x * m >> p`
+// rounded down, one more when `x` is negative. negative divisors are
+// left as they are
+static void openrtl_strength_signed(struct OpenrtlStrength *seq, const struct OpenrtlRegSet *after, const OpenrtlInst *inst, int64_t c) {
+    unsigned int size = inst->size;
+    unsigned int bits = 8u << size;
+    int modulo = inst->opcode == OPENRTL_OP_IMODULO_SIGNED;
+    uint8_t dest = inst->arith.dest;
+    uint8_t x = inst->arith.src1;
+    if (c <= 0) {
+        return;
+    }
+    int k = openrtl_strength_log2((uint64_t) c);
+    uint8_t temps[2];
+    if (!k) {
+        if (modulo) {
+            openrtl_strength_imm(seq, size, dest, 0);
+        } else {
+            openrtl_strength_move(seq, OPENRTL_OP_IMOVE_UNSIGNED, size, dest, x, size);
+        }
+        return;
+    }
+    if (k > 0) {
+        if (openrtl_strength_temps(after, inst, 1, temps, 1) < 1) {
+            return;
+        }
+        uint8_t t = temps[0];
+        openrtl_strength_shift(seq, size, t, x, OPENRTL_SHIFT_RIGHT_SIGNED, bits - 1);
+        openrtl_strength_shift(seq, size, t, t, OPENRTL_SHIFT_RIGHT, bits - k);
+        openrtl_strength_arith(seq, OPENRTL_OP_IADD, size, t, t, x);
+        if (modulo) {
+            openrtl_strength_shift(seq, size, t, t, OPENRTL_SHIFT_RIGHT, k);
+            openrtl_strength_shift(seq, size, t, t, OPENRTL_SHIFT_LEFT, k);
+            openrtl_strength_arith(seq, OPENRTL_OP_ISUBTRACT, size, dest, x, t);
+        } else {
+            openrtl_strength_shift(seq, size, dest, t, OPENRTL_SHIFT_RIGHT_SIGNED, k);
+        }
+        return;
+    }
+
+    if (bits == 64 || openrtl_strength_temps(after, inst, modulo, temps, 2) < 2) {
+        return;
+    }
+    uint8_t t = temps[0];
+    uint8_t u = temps[1];
+    unsigned int l = 0;
+    while (((uint64_t) 1 << l) < (uint64_t) c) {
+        ++l;
+    }
+    unsigned int p = bits - 1 + l;
+    uint64_t m = ((uint64_t) 1 << p) / (uint64_t) c + 1;
+    openrtl_strength_move(seq, OPENRTL_OP_IMOVE_SIGNED, OPENRTL_ISIZE_64, t, x, size);
+    openrtl_strength_imm(seq, OPENRTL_ISIZE_64, u, m);
+    openrtl_strength_arith(seq, OPENRTL_OP_IMULTIPLY_SIGNED, OPENRTL_ISIZE_64, u, u, t);
+    openrtl_strength_shift(seq, OPENRTL_ISIZE_64, u, u, OPENRTL_SHIFT_RIGHT_SIGNED, p);
+    openrtl_strength_shift(seq, OPENRTL_ISIZE_64, t, t, OPENRTL_SHIFT_RIGHT, 63);
+    if (modulo) {
+        openrtl_strength_arith(seq, OPENRTL_OP_IADD, OPENRTL_ISIZE_64, u, u, t);
+        openrtl_strength_arith(seq, OPENRTL_OP_IMULTIPLY_SIGNED, size, u, u, inst->arith.src2);
+        openrtl_strength_arith(seq, OPENRTL_OP_ISUBTRACT, size, dest, x, u);
+    } else {
+        openrtl_strength_arith(seq, OPENRTL_OP_IADD, OPENRTL_ISIZE_64, dest, u, t);
+    }
+}
+
+// up to `n` registers a sequence replacing `inst` may write before it
+// writes `dest`: `dest` itself unless the dividend is in it, and the
+// general purpose registers nothing reads after `inst`, whatever is live
+// in the other files. the divisor is kept when `keep` is set
+static size_t openrtl_strength_temps(const struct OpenrtlRegSet *after, const OpenrtlInst *inst, int keep, uint8_t *temps, size_t n) {
+    uint8_t dest = inst->arith.dest;
+    uint8_t x = inst->arith.src1;
+    uint8_t c = inst->arith.src2;
+    size_t len = 0;
+    if (dest != x && !(keep && dest == c)) {
+        temps[len++] = dest;
+    }
+    for (size_t r = 0; r < 256 && len < n; r++) {
+        if (r != dest && r != x && !(keep && r == c) && !openrtl_regset_has(after, OPENRTL_FILE_GP, (uint8_t) r)) {
+            temps[len++] = (uint8_t) r;
+        }
+    }
+    return len;
+}
+
+static void openrtl_strength_arith(struct OpenrtlStrength *seq, unsigned int opcode, unsigned int size, uint8_t dest, uint8_t src1, uint8_t src2) {
+    OpenrtlInst *inst = seq->inst + seq->len;
+    *inst = (OpenrtlInst) {0};
+    inst->opcode = opcode;
+    inst->size = size;
+    inst->arith.dest = dest;
+    inst->arith.src1 = src1;
+    inst->arith.src2 = src2;
+    seq->operand[seq->len++] = 0;
+    seq->reduced = 1;
+}
+
+// a move of a register to itself is left out
+static void openrtl_strength_move(struct OpenrtlStrength *seq, unsigned int opcode, unsigned int size, uint8_t dest, uint8_t src, unsigned int from) {
+    seq->reduced = 1;
+    if (dest == src && size == from) {
+        return;
+    }
+    OpenrtlInst *inst = seq->inst + seq->len;
+    *inst = (OpenrtlInst) {0};
+    inst->opcode = opcode;
+    inst->size = size;
+    inst->arith_b.dest = dest;
+    inst->arith_b.src = src;
+    inst->arith_b.size = from;
+    seq->operand[seq->len++] = 0;
+}
+
+static void openrtl_strength_imm(struct OpenrtlStrength *seq, unsigned int size, uint8_t dest, uint64_t value) {
+    OpenrtlInst *inst = seq->inst + seq->len;
+    *inst = (OpenrtlInst) {0};
+    inst->opcode = OPENRTL_OP_IMOVE_IMMEDIATE;
+    inst->size = size;
+    inst->rel.dest = dest;
+    seq->operand[seq->len++] = value;
+    seq->reduced = 1;
+}
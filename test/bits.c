@@ -0,0 +1,162 @@
+#include <stdio.h>
+#include "../include/openrtl.h"
+
+static uint64_t openrtl_test_mask(unsigned int size) {
+    return size == OPENRTL_ISIZE_64 ? ~(uint64_t) 0 : ((uint64_t) 1 << (8 << size)) - 1;
+}
+
+// what `OPENRTL_OP_IBITS` of `kind` gives for `a`, bit by bit
+static uint64_t openrtl_test_bits(unsigned int kind, unsigned int size, uint64_t a) {
+    unsigned int bits = 8u << size;
+    uint64_t value = 0;
+    a &= openrtl_test_mask(size);
+    for (unsigned int i = 0; i < bits; i++) {
+        int set = (a >> i) & 1;
+        switch (kind) {
+        case OPENRTL_BITS_POPCOUNT:
+            value += set;
+            break;
+        case OPENRTL_BITS_LEADING_ZEROS:
+            value = set ? bits - 1 - i : value;
+            break;
+        case OPENRTL_BITS_TRAILING_ZEROS:
+            value = !set && value == i ? i + 1 : value;
+            break;
+        case OPENRTL_BITS_SWAP:
+            value |= (uint64_t) set << ((bits - 8 - i / 8 * 8) + i % 8);
+            break;
+        }
+    }
+    if (kind == OPENRTL_BITS_LEADING_ZEROS && !a) {
+        value = bits;
+    }
+    return value;
+}
+
+// the single instruction `emit` wrote
+static int openrtl_test_decode(OpenrtlBuffer *buf, OpenrtlInst *inst) {
+    OpenrtlIter it;
+    openrtl_iter(&it, buf);
+    if (!openrtl_iter_next(&it)) {
+        return 1;
+    }
+    *inst = it.inst;
+    return openrtl_iter_next(&it);
+}
+
+// shifts hold their kind in the top two bits of `src2` and the count,
+// below the width, in the rest. rotating right is rotating left by the
+// rest of the width
+static int openrtl_test_encode(void) {
+    struct {
+        int (*emit)(OpenrtlBuffer *, uint8_t, uint8_t, uint8_t, uint8_t);
+        uint8_t size;
+        uint8_t count;
+        uint8_t src2;
+    } cases[] = {
+        { openrtl_ishift_left, OPENRTL_ISIZE_64, 63, OPENRTL_SHIFT_LEFT << 6 | 63 },
+        { openrtl_ishift_right, OPENRTL_ISIZE_16, 5, OPENRTL_SHIFT_RIGHT << 6 | 5 },
+        { openrtl_ishift_right_signed, OPENRTL_ISIZE_32, 7, OPENRTL_SHIFT_RIGHT_SIGNED << 6 | 7 },
+        { openrtl_ishift_left, OPENRTL_ISIZE_8, 9, OPENRTL_SHIFT_LEFT << 6 | 1 },
+        { openrtl_irotate_left, OPENRTL_ISIZE_32, 31, OPENRTL_ROTATE_LEFT << 6 | 31 },
+        { openrtl_irotate_right, OPENRTL_ISIZE_16, 3, OPENRTL_ROTATE_LEFT << 6 | 13 },
+        { openrtl_irotate_right, OPENRTL_ISIZE_64, 0, OPENRTL_ROTATE_LEFT << 6 | 0 },
+    };
+    int status = 0;
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]) && !status; i++) {
+        OpenrtlBuffer buf;
+        openrtl_buffer(&buf);
+        OpenrtlInst inst;
+        status = cases[i].emit(&buf, cases[i].size, 3, 4, cases[i].count) || openrtl_test_decode(&buf, &inst)
+            || inst.opcode != OPENRTL_OP_ISHIFT || inst.size != cases[i].size || inst.arith.dest != 3
+            || inst.arith.src1 != 4 || inst.arith.src2 != cases[i].src2;
+        openrtl_del_buffer(&buf);
+    }
+    return status;
+}
+
+// folds `emit` of a known register and returns the constant it became
+static int openrtl_test_fold(int (*emit)(OpenrtlBuffer *, uint8_t, uint8_t, uint8_t, uint8_t), uint8_t size, uint8_t arg, uint64_t a, uint64_t *value) {
+    OpenrtlBuffer buf;
+    openrtl_buffer(&buf);
+    openrtl_imove_immediate(&buf, OPENRTL_ISIZE_64, 1, a);
+    emit(&buf, size, 2, 1, arg);
+    openrtl_istore(&buf, OPENRTL_ISIZE_64, 2, 5, 6);
+    openrtl_return(&buf);
+    int status = openrtl_fold_constants(&buf);
+    int found = 0;
+    OpenrtlIter it;
+    openrtl_iter(&it, &buf);
+    while (openrtl_iter_next(&it)) {
+        if (it.inst.opcode == OPENRTL_OP_IMOVE_IMMEDIATE && it.inst.rel.dest == 2) {
+            *value = it.operand & openrtl_test_mask(size);
+            found = 1;
+        }
+    }
+    openrtl_del_buffer(&buf);
+    return status || !found;
+}
+
+static int openrtl_test_bits_emit(OpenrtlBuffer *buf, uint8_t size, uint8_t dest, uint8_t src, uint8_t kind) {
+    switch (kind) {
+    case OPENRTL_BITS_POPCOUNT:
+        return openrtl_ipopcount(buf, size, dest, src);
+    case OPENRTL_BITS_LEADING_ZEROS:
+        return openrtl_ileading_zeros(buf, size, dest, src);
+    case OPENRTL_BITS_TRAILING_ZEROS:
+        return openrtl_itrailing_zeros(buf, size, dest, src);
+    default:
+        return openrtl_ibyte_swap(buf, size, dest, src);
+    }
+}
+
+// every bit operation is evaluated at every size, zero included
+static int openrtl_test_constant_bits(void) {
+    const uint64_t inputs[] = { 0, 1, 0x80, 0x8000000000000f10, 0x0123456789abcdef, ~(uint64_t) 0 };
+    for (unsigned int kind = OPENRTL_BITS_POPCOUNT; kind <= OPENRTL_BITS_SWAP; kind++) {
+        for (unsigned int size = OPENRTL_ISIZE_8; size <= OPENRTL_ISIZE_64; size++) {
+            for (size_t i = 0; i < sizeof(inputs) / sizeof(inputs[0]); i++) {
+                uint64_t value;
+                if (openrtl_test_fold(openrtl_test_bits_emit, size, kind, inputs[i], &value)
+                    || value != openrtl_test_bits(kind, size, inputs[i])) {
+                    return 1;
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+// rotating right by a constant gives the bits rotated right
+static int openrtl_test_constant_rotate(void) {
+    const uint64_t a = 0x0123456789abcdef;
+    for (unsigned int size = OPENRTL_ISIZE_8; size <= OPENRTL_ISIZE_64; size++) {
+        unsigned int bits = 8u << size;
+        uint64_t x = a & openrtl_test_mask(size);
+        for (unsigned int count = 0; count < bits; count += 3) {
+            uint64_t want = count ? (x >> count | x << (bits - count)) & openrtl_test_mask(size) : x;
+            uint64_t value;
+            if (openrtl_test_fold(openrtl_irotate_right, size, count, a, &value) || value != want) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+int main(void) {
+    int failed = 0;
+    if (openrtl_test_encode()) {
+        printf("bits: a shift was encoded with the wrong kind or count\n");
+        failed = 1;
+    }
+    if (openrtl_test_constant_bits()) {
+        printf("bits: a bit operation on a constant was evaluated wrong\n");
+        failed = 1;
+    }
+    if (openrtl_test_constant_rotate()) {
+        printf("bits: a rotation of a constant was evaluated wrong\n");
+        failed = 1;
+    }
+    return failed;
+}
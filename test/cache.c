@@ -0,0 +1,71 @@
+#include <stdio.h>
+#include <string.h>
+#include "../include/openrtl.h"
+
+// the same code with a loop that starts either at or after the
+// definition of r1
+static void openrtl_test_loop(OpenrtlBuffer *buf, int after) {
+    openrtl_buffer(buf);
+    if (!after) {
+        openrtl_label(buf, "top");
+    }
+    openrtl_iadd(buf, OPENRTL_SIZE_64, 1, 2, 3);
+    if (after) {
+        openrtl_label(buf, "top");
+    }
+    openrtl_istore(buf, OPENRTL_SIZE_64, 1, 2, 3);
+    openrtl_symbol(buf, OPENRTL_SYMBOL_LOCAL, "top");
+    openrtl_branch_equal(buf, 0);
+    openrtl_return(buf);
+}
+
+// the table of `buf` allocated without a cache
+static int openrtl_test_table(OpenrtlBuffer *buf, struct OpenrtlRegisterTable *table) {
+    OpenrtlRegalloc alloc;
+    openrtl_alloc_linscan(&alloc, 4, 0, NULL);
+    openrtl_alloc_find(&alloc, NULL, buf);
+    int status = openrtl_alloc_allocate(&alloc) || openrtl_alloc_regtable(table, &alloc);
+    openrtl_del_alloc(&alloc);
+    return status;
+}
+
+// buffers whose code is the same but whose labels are not have tables
+// of their own
+static int openrtl_test_labels(void) {
+    OpenrtlBuffer a;
+    OpenrtlBuffer b;
+    openrtl_test_loop(&a, 0);
+    openrtl_test_loop(&b, 1);
+    OpenrtlCache cache;
+    struct OpenrtlRegisterTable first = {0};
+    struct OpenrtlRegisterTable second = {0};
+    struct OpenrtlRegisterTable want = {0};
+    int status = openrtl_cache(&cache, NULL, NULL) || a.len != b.len || memcmp(a.ptr, b.ptr, a.len);
+    if (!status) {
+        OpenrtlRegalloc alloc;
+        openrtl_alloc_linscan(&alloc, 4, 0, NULL);
+        status = openrtl_alloc_cached(&cache, &alloc, NULL, &a, &first);
+        openrtl_del_alloc(&alloc);
+        openrtl_alloc_linscan(&alloc, 4, 0, NULL);
+        status = status || openrtl_alloc_cached(&cache, &alloc, NULL, &b, &second);
+        openrtl_del_alloc(&alloc);
+        status = status || openrtl_test_table(&b, &want) || second.len != want.len
+            || memcmp(second.entries, want.entries, want.len * sizeof(struct OpenrtlRegEntry));
+        openrtl_del_cache(&cache);
+    }
+    openrtl_del_regtable(&first);
+    openrtl_del_regtable(&second);
+    openrtl_del_regtable(&want);
+    openrtl_del_buffer(&a);
+    openrtl_del_buffer(&b);
+    return status;
+}
+
+int main(void) {
+    int failed = 0;
+    if (openrtl_test_labels()) {
+        printf("cache: buffers with labels at different places shared a table\n");
+        failed = 1;
+    }
+    return failed;
+}
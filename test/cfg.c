@@ -0,0 +1,28 @@
+#include <stdio.h>
+#include "../include/openrtl.h"
+
+// literal branch operands and local addresses are outside the buffer,
+// whatever their value, so neither starts a block
+static int openrtl_test_address(void) {
+    OpenrtlBuffer buf;
+    openrtl_buffer(&buf);
+    openrtl_local(&buf, "base", 0);
+    openrtl_istore(&buf, OPENRTL_SIZE_64, 1, 2, 3);
+    openrtl_istore(&buf, OPENRTL_SIZE_64, 4, 5, 6);
+    openrtl_branch(&buf, 4);
+    openrtl_return(&buf);
+    OpenrtlCfg cfg;
+    int status = openrtl_cfg(&cfg, &buf) || cfg.len != 2;
+    openrtl_del_cfg(&cfg);
+    openrtl_del_buffer(&buf);
+    return status;
+}
+
+int main(void) {
+    int failed = 0;
+    if (openrtl_test_address()) {
+        printf("cfg: an address outside the buffer started a block\n");
+        failed = 1;
+    }
+    return failed;
+}
@@ -0,0 +1,57 @@
+#include <stdio.h>
+#include "../include/openrtl.h"
+
+static int openrtl_test_count(OpenrtlBuffer *buf, unsigned int opcode) {
+    int n = 0;
+    OpenrtlIter it;
+    openrtl_iter(&it, buf);
+    while (openrtl_iter_next(&it)) {
+        n += it.inst.opcode == opcode;
+    }
+    return n;
+}
+
+// r3 is still known after x3 is written. the flags of the add are
+// overwritten, so it can be folded
+static int openrtl_test_files(void) {
+    OpenrtlBuffer buf;
+    openrtl_buffer(&buf);
+    openrtl_imove_immediate(&buf, OPENRTL_SIZE_64, 3, 5);
+    openrtl_fadd(&buf, OPENRTL_FSIZE_64, 3, 1, 2);
+    openrtl_iadd(&buf, OPENRTL_SIZE_64, 4, 3, 3);
+    openrtl_isubtract(&buf, OPENRTL_SIZE_64, 6, 1, 2);
+    openrtl_istore(&buf, OPENRTL_SIZE_64, 4, 1, 2);
+    openrtl_return(&buf);
+    int status = openrtl_fold_constants(&buf) || openrtl_test_count(&buf, OPENRTL_OP_IADD) != 0;
+    openrtl_del_buffer(&buf);
+    return status;
+}
+
+// the carry of the add is read by the add with carry after it, so the
+// add stays even though its result is known
+static int openrtl_test_carry(void) {
+    OpenrtlBuffer buf;
+    openrtl_buffer(&buf);
+    openrtl_imove_immediate(&buf, OPENRTL_SIZE_64, 1, ~(uint64_t) 0);
+    openrtl_imove_immediate(&buf, OPENRTL_SIZE_64, 2, 1);
+    openrtl_iadd(&buf, OPENRTL_SIZE_64, 3, 1, 2);
+    openrtl_iadd_carry(&buf, OPENRTL_SIZE_64, 4, 5, 6);
+    openrtl_istore(&buf, OPENRTL_SIZE_64, 4, 1, 2);
+    openrtl_return(&buf);
+    int status = openrtl_fold_constants(&buf) || openrtl_test_count(&buf, OPENRTL_OP_IADD) != 1;
+    openrtl_del_buffer(&buf);
+    return status;
+}
+
+int main(void) {
+    int failed = 0;
+    if (openrtl_test_files()) {
+        printf("constant: a definition of another file forgot a constant\n");
+        failed = 1;
+    }
+    if (openrtl_test_carry()) {
+        printf("constant: an add whose carry is read was folded\n");
+        failed = 1;
+    }
+    return failed;
+}
@@ -0,0 +1,89 @@
+#include <stdio.h>
+#include "../include/openrtl.h"
+
+static int openrtl_test_count(OpenrtlBuffer *buf, unsigned int opcode) {
+    int n = 0;
+    OpenrtlIter it;
+    openrtl_iter(&it, buf);
+    while (openrtl_iter_next(&it)) {
+        n += it.inst.opcode == opcode;
+    }
+    return n;
+}
+
+// registers of different files with the same number are unrelated, a
+// definition of x3 leaves r3 as it was
+static int openrtl_test_files(void) {
+    OpenrtlBuffer buf;
+    openrtl_buffer(&buf);
+    openrtl_iadd(&buf, OPENRTL_SIZE_64, 3, 1, 2);
+    openrtl_fadd(&buf, OPENRTL_FSIZE_64, 3, 1, 2);
+    openrtl_istore(&buf, OPENRTL_SIZE_64, 3, 4, 5);
+    openrtl_return(&buf);
+    int status = openrtl_eliminate_dead(&buf) || openrtl_test_count(&buf, OPENRTL_OP_IADD) != 1;
+    openrtl_del_buffer(&buf);
+    return status;
+}
+
+// a definition that is overwritten in its own file before it is read is
+// still removed
+static int openrtl_test_overwritten(void) {
+    OpenrtlBuffer buf;
+    openrtl_buffer(&buf);
+    openrtl_fadd(&buf, OPENRTL_FSIZE_64, 3, 1, 2);
+    openrtl_fsubtract(&buf, OPENRTL_FSIZE_64, 3, 1, 2);
+    openrtl_fstore(&buf, OPENRTL_FSIZE_64, 3, 4, 5);
+    openrtl_return(&buf);
+    int status = openrtl_eliminate_dead(&buf) || openrtl_test_count(&buf, OPENRTL_OP_FADD) != 0;
+    openrtl_del_buffer(&buf);
+    return status;
+}
+
+// a branch through a local symbol bound to an address leaves the
+// buffer, even when the address is that of the next instruction
+static int openrtl_test_address(void) {
+    OpenrtlBuffer buf;
+    openrtl_buffer(&buf);
+    openrtl_local(&buf, "far", 12);
+    openrtl_symbol(&buf, OPENRTL_SYMBOL_LOCAL, "far");
+    openrtl_branch(&buf, 0);
+    openrtl_return(&buf);
+    int status = openrtl_eliminate_dead(&buf) || openrtl_test_count(&buf, OPENRTL_OP_BRANCH) != 1;
+    openrtl_del_buffer(&buf);
+    return status;
+}
+
+// an add whose result is dead is kept while its carry is read
+static int openrtl_test_carry(void) {
+    OpenrtlBuffer buf;
+    openrtl_buffer(&buf);
+    openrtl_iadd(&buf, OPENRTL_SIZE_64, 3, 1, 2);
+    openrtl_iadd_carry(&buf, OPENRTL_SIZE_64, 4, 5, 6);
+    openrtl_istore(&buf, OPENRTL_SIZE_64, 4, 1, 2);
+    openrtl_imove_immediate(&buf, OPENRTL_SIZE_64, 3, 0);
+    openrtl_return(&buf);
+    int status = openrtl_eliminate_dead(&buf) || openrtl_test_count(&buf, OPENRTL_OP_IADD) != 1;
+    openrtl_del_buffer(&buf);
+    return status;
+}
+
+int main(void) {
+    int failed = 0;
+    if (openrtl_test_files()) {
+        printf("deadcode: a definition of another file killed a live register\n");
+        failed = 1;
+    }
+    if (openrtl_test_overwritten()) {
+        printf("deadcode: an overwritten definition was kept\n");
+        failed = 1;
+    }
+    if (openrtl_test_address()) {
+        printf("deadcode: a branch to an address was taken for a fall through\n");
+        failed = 1;
+    }
+    if (openrtl_test_carry()) {
+        printf("deadcode: an add whose carry is read was removed\n");
+        failed = 1;
+    }
+    return failed;
+}
@@ -0,0 +1,93 @@
+#include <stdio.h>
+#include <string.h>
+#include "../include/openrtl.h"
+
+// address of the global `name` in `ctx`, or -1
+static uint64_t openrtl_test_global(const OpenrtlContext *ctx, const char *name) {
+    for (size_t i = 0; i < ctx->global.len; i++) {
+        if (!strcmp(ctx->global.ptr[i].name, name)) {
+            return ctx->global.ptr[i].addr;
+        }
+    }
+    return (uint64_t) -1;
+}
+
+// operand of the first call in the `i`th buffer of `ctx`
+static uint64_t openrtl_test_call(OpenrtlContext *ctx, size_t i) {
+    OpenrtlIter it;
+    openrtl_iter(&it, ctx->ptr + i);
+    while (openrtl_iter_next(&it)) {
+        if (it.inst.opcode == OPENRTL_OP_CALL) {
+            return it.operand;
+        }
+    }
+    return 0;
+}
+
+// a function named `name` that adds and calls `callee`
+static void openrtl_test_function(OpenrtlContext *ctx, const char *name, const char *callee, uint8_t reg) {
+    OpenrtlBuffer buf;
+    openrtl_context_buffer(ctx, &buf);
+    openrtl_iadd(&buf, OPENRTL_SIZE_64, reg, 1, 2);
+    openrtl_symbol(&buf, OPENRTL_SYMBOL_GLOBAL, callee);
+    openrtl_call(&buf, 0);
+    openrtl_return(&buf);
+    openrtl_add_buffer(ctx, name, &buf);
+}
+
+// two functions that are the same fold into the first, whose index the
+// name of the second now gives. sites are rebuilt for the buffers that
+// are left, so relinking a callee reaches every call of it
+static int openrtl_test_identical(void) {
+    OpenrtlContext ctx;
+    openrtl_context(&ctx);
+    openrtl_test_function(&ctx, "a", "x", 3);
+    openrtl_test_function(&ctx, "x", "y", 4);
+    openrtl_test_function(&ctx, "b", "x", 3);
+    int status = openrtl_fold_identical(&ctx) || ctx.len != 2 || openrtl_test_global(&ctx, "a") != 0
+        || openrtl_test_global(&ctx, "b") != 0 || openrtl_test_global(&ctx, "x") != 1 || ctx.sites.len != 2;
+    for (size_t i = 0; i < ctx.sites.len && !status; i++) {
+        const struct OpenrtlSite *site = ctx.sites.ptr + i;
+        status = site->buffer >= ctx.len || site->symbol >= ctx.ptr[site->buffer].linker.len
+            || ctx.ptr[site->buffer].linker.ptr[site->symbol].type != OPENRTL_SYMBOL_GLOBAL;
+    }
+    if (!status) {
+        openrtl_global(&ctx, "x", 0x2000);
+        openrtl_global(&ctx, "y", 0x3000);
+        status = openrtl_relink(&ctx, "x") || openrtl_relink(&ctx, "y")
+            || openrtl_test_call(&ctx, 0) != 0x2000 || openrtl_test_call(&ctx, 1) != 0x3000;
+    }
+    openrtl_del_context(&ctx);
+    return status;
+}
+
+// functions that call themselves by their own names are the same code,
+// and the one that is kept still calls itself
+static int openrtl_test_recursive(void) {
+    OpenrtlContext ctx;
+    openrtl_context(&ctx);
+    openrtl_test_function(&ctx, "f", "f", 3);
+    openrtl_test_function(&ctx, "g", "g", 3);
+    openrtl_test_function(&ctx, "h", "h", 4);
+    int status = openrtl_fold_identical(&ctx) || ctx.len != 2 || openrtl_test_global(&ctx, "f") != 0
+        || openrtl_test_global(&ctx, "g") != 0 || openrtl_test_global(&ctx, "h") != 1;
+    if (!status) {
+        openrtl_global(&ctx, "f", 0x2000);
+        status = openrtl_link(&ctx) || openrtl_test_call(&ctx, 0) != 0x2000;
+    }
+    openrtl_del_context(&ctx);
+    return status;
+}
+
+int main(void) {
+    int failed = 0;
+    if (openrtl_test_identical()) {
+        printf("fold: identical functions were not folded into one\n");
+        failed = 1;
+    }
+    if (openrtl_test_recursive()) {
+        printf("fold: recursive functions were not folded into one\n");
+        failed = 1;
+    }
+    return failed;
+}
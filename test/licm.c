@@ -0,0 +1,40 @@
+#include <stdio.h>
+#include "../include/openrtl.h"
+
+// opcode of the `n`th instruction
+static unsigned int openrtl_test_opcode(OpenrtlBuffer *buf, size_t n) {
+    OpenrtlIter it;
+    openrtl_iter(&it, buf);
+    while (openrtl_iter_next(&it) && n--) {
+    }
+    return it.inst.opcode;
+}
+
+// r3 and x3 are each defined once in the loop, neither counts as a
+// definition of the other
+static int openrtl_test_files(void) {
+    OpenrtlBuffer buf;
+    openrtl_buffer(&buf);
+    openrtl_imove_immediate(&buf, OPENRTL_SIZE_64, 9, 100);
+    openrtl_label(&buf, "loop");
+    openrtl_istore(&buf, OPENRTL_SIZE_64, 9, 4, 5);
+    openrtl_iadd(&buf, OPENRTL_SIZE_64, 3, 1, 2);
+    openrtl_fadd(&buf, OPENRTL_FSIZE_64, 3, 1, 2);
+    openrtl_istore(&buf, OPENRTL_SIZE_64, 3, 4, 5);
+    openrtl_isubtract(&buf, OPENRTL_SIZE_64, 9, 9, 6);
+    openrtl_symbol(&buf, OPENRTL_SYMBOL_LOCAL, "loop");
+    openrtl_branch_not_equal(&buf, 0);
+    openrtl_return(&buf);
+    int status = openrtl_hoist_invariants(&buf) || openrtl_test_opcode(&buf, 1) != OPENRTL_OP_IADD;
+    openrtl_del_buffer(&buf);
+    return status;
+}
+
+int main(void) {
+    int failed = 0;
+    if (openrtl_test_files()) {
+        printf("licm: a definition of another file kept an invariant in the loop\n");
+        failed = 1;
+    }
+    return failed;
+}
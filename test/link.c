@@ -0,0 +1,188 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../include/openrtl.h"
+
+// the system allocator, failing once `user` allocations have been made
+static void *openrtl_test_alloc(void *user, size_t size) {
+    size_t *budget = user;
+    return *budget && (*budget)-- ? malloc(size) : NULL;
+}
+
+static void *openrtl_test_realloc(void *user, void *ptr, size_t old, size_t size) {
+    (void) old;
+    size_t *budget = user;
+    return *budget && (*budget)-- ? realloc(ptr, size) : NULL;
+}
+
+static void openrtl_test_free(void *user, void *ptr) {
+    (void) user;
+    free(ptr);
+}
+
+// operand of the first call in the `i`th buffer of `ctx`
+static uint64_t openrtl_test_call(OpenrtlContext *ctx, size_t i) {
+    OpenrtlIter it;
+    openrtl_iter(&it, ctx->ptr + i);
+    while (openrtl_iter_next(&it)) {
+        if (it.inst.opcode == OPENRTL_OP_CALL) {
+            return it.operand;
+        }
+    }
+    return 0;
+}
+
+// relaxing leaves the slot of a global wide enough for any address it
+// is redefined to later
+static int openrtl_test_redefine(void) {
+    OpenrtlContext ctx;
+    openrtl_context(&ctx);
+    OpenrtlBuffer buf;
+    openrtl_context_buffer(&ctx, &buf);
+    openrtl_symbol(&buf, OPENRTL_SYMBOL_GLOBAL, "callee");
+    openrtl_call(&buf, 0);
+    openrtl_return(&buf);
+    openrtl_add_buffer(&ctx, "caller", &buf);
+    openrtl_global(&ctx, "callee", 0);
+    int status = openrtl_relax(&ctx);
+    openrtl_global(&ctx, "callee", 0x7f0012345678);
+    status = status || openrtl_link(&ctx) || openrtl_test_call(&ctx, 0) != 0x7f0012345678;
+    openrtl_del_context(&ctx);
+    return status;
+}
+
+// a local address that outgrows the slot relaxing narrowed it to is
+// reported rather than cut short
+static int openrtl_test_overflow(void) {
+    OpenrtlContext ctx;
+    openrtl_context(&ctx);
+    OpenrtlBuffer buf;
+    openrtl_context_buffer(&ctx, &buf);
+    openrtl_local(&buf, "base", 0x10);
+    openrtl_symbol(&buf, OPENRTL_SYMBOL_LOCAL, "base");
+    openrtl_call(&buf, 0);
+    openrtl_return(&buf);
+    openrtl_add_buffer(&ctx, "caller", &buf);
+    int status = openrtl_relax(&ctx);
+    openrtl_local(ctx.ptr, "base", 0x7f0012345678);
+    status = status || openrtl_link(&ctx) != 2 || openrtl_link_parallel(&ctx, 2) != 2;
+    openrtl_del_context(&ctx);
+    return status;
+}
+
+// relaxing fails without touching the buffer when it runs out of memory
+static int openrtl_test_memory(void) {
+    size_t budget = 64;
+    OpenrtlAllocator allocator = { openrtl_test_alloc, openrtl_test_realloc, openrtl_test_free, &budget };
+    OpenrtlBuffer buf;
+    openrtl_buffer_with(&buf, &allocator);
+    openrtl_label(&buf, "top");
+    openrtl_istore(&buf, OPENRTL_SIZE_64, 1, 2, 3);
+    openrtl_symbol(&buf, OPENRTL_SYMBOL_LOCAL, "top");
+    openrtl_branch(&buf, 0);
+    openrtl_return(&buf);
+    size_t len = buf.len;
+    int status = 0;
+    for (size_t i = 0; i < 2; i++) {
+        budget = i;
+        status = status || openrtl_relax_buffer(NULL, &buf) != 1 || buf.len != len;
+    }
+    budget = 64;
+    status = status || openrtl_relax_buffer(NULL, &buf) || buf.len >= len;
+    openrtl_del_buffer(&buf);
+    return status;
+}
+
+// a name that cannot be copied is not interned, nor bound
+static int openrtl_test_intern(void) {
+    size_t budget = 64;
+    OpenrtlAllocator allocator = { openrtl_test_alloc, openrtl_test_realloc, openrtl_test_free, &budget };
+    OpenrtlContext ctx;
+    openrtl_context_with(&ctx, &allocator);
+    budget = 0;
+    int status = openrtl_intern(&ctx.strings, "callee") != NULL || openrtl_global(&ctx, "callee", 1) != 1;
+    budget = 64;
+    status = status || !openrtl_intern(&ctx.strings, "callee") || openrtl_global(&ctx, "callee", 1);
+    openrtl_del_context(&ctx);
+    return status;
+}
+
+// `n` functions calling each other by name, half of them pc-relative
+// with a loop to a local label
+static void openrtl_test_context(OpenrtlContext *ctx, const OpenrtlAllocator *allocator, size_t n) {
+    char name[32];
+    openrtl_context_with(ctx, allocator);
+    for (size_t i = 0; i < n; i++) {
+        OpenrtlBuffer buf;
+        openrtl_context_buffer(ctx, &buf);
+        buf.pcrel = i % 2;
+        openrtl_label(&buf, "top");
+        for (size_t j = 0; j < 4; j++) {
+            snprintf(name, sizeof(name), "f%zu", (i * 7 + j * 13) % n);
+            openrtl_symbol(&buf, OPENRTL_SYMBOL_GLOBAL, name);
+            openrtl_call(&buf, 0);
+        }
+        openrtl_symbol(&buf, OPENRTL_SYMBOL_LOCAL, "top");
+        openrtl_branch_equal(&buf, 0);
+        openrtl_return(&buf);
+        snprintf(name, sizeof(name), "f%zu", i);
+        openrtl_add_buffer(ctx, name, &buf);
+        openrtl_global(ctx, name, 0x100000 + 64 * i);
+    }
+}
+
+// linking on several threads gives the bytes linking on one does
+static int openrtl_test_parallel(void) {
+    OpenrtlContext serial;
+    OpenrtlContext parallel;
+    openrtl_test_context(&serial, NULL, 100);
+    openrtl_test_context(&parallel, NULL, 100);
+    int status = openrtl_link(&serial) || openrtl_link_parallel(&parallel, 4);
+    for (size_t i = 0; i < serial.len && !status; i++) {
+        status = serial.ptr[i].len != parallel.ptr[i].len || memcmp(serial.ptr[i].ptr, parallel.ptr[i].ptr, serial.ptr[i].len);
+    }
+    openrtl_del_context(&serial);
+    openrtl_del_context(&parallel);
+    return status;
+}
+
+// out of memory, linking in parallel fails before it starts
+static int openrtl_test_parallel_memory(void) {
+    size_t budget = 4096;
+    OpenrtlAllocator allocator = { openrtl_test_alloc, openrtl_test_realloc, openrtl_test_free, &budget };
+    OpenrtlContext ctx;
+    openrtl_test_context(&ctx, &allocator, 8);
+    budget = 0;
+    int status = openrtl_link_parallel(&ctx, 4) != 1;
+    openrtl_del_context(&ctx);
+    return status;
+}
+
+int main(void) {
+    int failed = 0;
+    if (openrtl_test_redefine()) {
+        printf("link: a redefined global did not fit a relaxed slot\n");
+        failed = 1;
+    }
+    if (openrtl_test_overflow()) {
+        printf("link: an address that did not fit its slot went unreported\n");
+        failed = 1;
+    }
+    if (openrtl_test_memory()) {
+        printf("link: relaxing did not fail cleanly out of memory\n");
+        failed = 1;
+    }
+    if (openrtl_test_intern()) {
+        printf("link: interning did not fail cleanly out of memory\n");
+        failed = 1;
+    }
+    if (openrtl_test_parallel()) {
+        printf("link: linking in parallel differed from linking serially\n");
+        failed = 1;
+    }
+    if (openrtl_test_parallel_memory()) {
+        printf("link: linking in parallel did not fail cleanly out of memory\n");
+        failed = 1;
+    }
+    return failed;
+}
@@ -0,0 +1,111 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "../include/openrtl.h"
+
+// the system allocator, failing once `user` allocations have been made
+static void *openrtl_test_alloc(void *user, size_t size) {
+    size_t *budget = user;
+    return *budget && (*budget)-- ? malloc(size) : NULL;
+}
+
+static void *openrtl_test_realloc(void *user, void *ptr, size_t old, size_t size) {
+    (void) old;
+    size_t *budget = user;
+    return *budget && (*budget)-- ? realloc(ptr, size) : NULL;
+}
+
+static void openrtl_test_free(void *user, void *ptr) {
+    (void) user;
+    free(ptr);
+}
+
+// three linked functions calling each other by name
+static void openrtl_test_context(OpenrtlContext *ctx, const OpenrtlAllocator *allocator) {
+    char name[32];
+    openrtl_context_with(ctx, allocator);
+    for (size_t i = 0; i < 3; i++) {
+        OpenrtlBuffer buf;
+        openrtl_context_buffer(ctx, &buf);
+        openrtl_label(&buf, "top");
+        openrtl_iadd(&buf, OPENRTL_SIZE_64, 3, 1, 2);
+        snprintf(name, sizeof(name), "f%zu", (i + 1) % 3);
+        openrtl_symbol(&buf, OPENRTL_SYMBOL_GLOBAL, name);
+        openrtl_call(&buf, 0);
+        openrtl_symbol(&buf, OPENRTL_SYMBOL_LOCAL, "top");
+        openrtl_branch_equal(&buf, 0);
+        openrtl_return(&buf);
+        snprintf(name, sizeof(name), "f%zu", i);
+        openrtl_add_buffer(ctx, name, &buf);
+        openrtl_global(ctx, name, 0x1000 * (i + 1));
+    }
+    openrtl_link(ctx);
+}
+
+// a saved context loads back with the same code, names and matrices
+static int openrtl_test_roundtrip(void) {
+    char path[] = "/tmp/openrtl-module-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        return 1;
+    }
+    close(fd);
+    OpenrtlContext ctx;
+    openrtl_test_context(&ctx, NULL);
+    OpenrtlModule mod;
+    int status = openrtl_module_save(&ctx, path, OPENRTL_MODULE_MATRIX) || openrtl_module_load(&mod, path);
+    if (!status) {
+        OpenrtlContext *loaded = mod.ctx;
+        status = loaded->len != ctx.len || loaded->sites.len != ctx.sites.len || loaded->global.len != ctx.global.len
+            || !openrtl_intern(&loaded->strings, "f2") || openrtl_intern(&loaded->strings, "f3")
+            || openrtl_link(loaded) != 1;
+        for (size_t i = 0; i < ctx.len && !status; i++) {
+            OpenrtlBuffer *a = ctx.ptr + i;
+            OpenrtlBuffer *b = loaded->ptr + i;
+            status = a->len != b->len || memcmp(a->ptr, b->ptr, a->len) || a->linker.len != b->linker.len
+                || a->local.len != b->local.len || a->matrix.len != b->matrix.len
+                || openrtl_matrix_last_def(&a->matrix, OPENRTL_GP_REGISTER, 3) != openrtl_matrix_last_def(&b->matrix, OPENRTL_GP_REGISTER, 3)
+                || strcmp(b->name, a->name);
+        }
+        openrtl_module_close(&mod);
+    }
+    openrtl_del_context(&ctx);
+    unlink(path);
+    return status;
+}
+
+// out of memory, saving fails and writes nothing
+static int openrtl_test_memory(void) {
+    char path[] = "/tmp/openrtl-module-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        return 1;
+    }
+    close(fd);
+    unlink(path);
+    size_t budget = 4096;
+    OpenrtlAllocator allocator = { openrtl_test_alloc, openrtl_test_realloc, openrtl_test_free, &budget };
+    OpenrtlContext ctx;
+    openrtl_test_context(&ctx, &allocator);
+    int status = 0;
+    for (size_t i = 0; i < 5 && !status; i++) {
+        budget = i;
+        status = openrtl_module_save(&ctx, path, OPENRTL_MODULE_MATRIX) != 1 || access(path, F_OK) == 0;
+    }
+    openrtl_del_context(&ctx);
+    return status;
+}
+
+int main(void) {
+    int failed = 0;
+    if (openrtl_test_roundtrip()) {
+        printf("module: a saved context did not load back the same\n");
+        failed = 1;
+    }
+    if (openrtl_test_memory()) {
+        printf("module: saving did not fail cleanly out of memory\n");
+        failed = 1;
+    }
+    return failed;
+}
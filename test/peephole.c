@@ -0,0 +1,33 @@
+#include <stdio.h>
+#include "../include/openrtl.h"
+
+// a literal branch operand is an address outside the buffer, even one
+// that is smaller than the buffer, and stays put when code is deleted
+static int openrtl_test_address(void) {
+    OpenrtlBuffer buf;
+    openrtl_buffer(&buf);
+    openrtl_imove_unsigned(&buf, OPENRTL_SIZE_64, 1, 1, OPENRTL_SIZE_64);
+    openrtl_istore(&buf, OPENRTL_SIZE_64, 2, 4, 5);
+    openrtl_branch(&buf, 4);
+    openrtl_return(&buf);
+    int status = openrtl_peephole(&buf);
+    uint64_t operand = 0;
+    OpenrtlIter it;
+    openrtl_iter(&it, &buf);
+    while (openrtl_iter_next(&it)) {
+        if (it.inst.opcode == OPENRTL_OP_BRANCH) {
+            operand = it.operand;
+        }
+    }
+    openrtl_del_buffer(&buf);
+    return status || operand != 4;
+}
+
+int main(void) {
+    int failed = 0;
+    if (openrtl_test_address()) {
+        printf("peephole: a literal branch address was moved with the code\n");
+        failed = 1;
+    }
+    return failed;
+}
@@ -0,0 +1,73 @@
+#include <stdio.h>
+#include "../include/openrtl.h"
+
+// r3 and x3 are both live across the branch, the web of r3 starts at
+// its definition and not where x3 is live from
+static int openrtl_test_files(void) {
+    OpenrtlBuffer buf;
+    openrtl_buffer(&buf);
+    openrtl_fadd(&buf, OPENRTL_FSIZE_64, 9, 1, 2);
+    size_t def = buf.len;
+    openrtl_iadd(&buf, OPENRTL_SIZE_64, 3, 1, 2);
+    openrtl_symbol(&buf, OPENRTL_SYMBOL_LOCAL, "next");
+    openrtl_branch(&buf, 0);
+    openrtl_label(&buf, "next");
+    openrtl_istore(&buf, OPENRTL_SIZE_64, 3, 4, 5);
+    openrtl_fstore(&buf, OPENRTL_FSIZE_64, 3, 4, 5);
+    openrtl_return(&buf);
+
+    OpenrtlRegalloc alloc;
+    openrtl_alloc_linscan(&alloc, 4, 0, NULL);
+    openrtl_alloc_find(&alloc, NULL, &buf);
+    int found = 0;
+    int status = 0;
+    for (size_t i = 0; i < alloc.live.len; i++) {
+        const struct OpenrtlInterval *interval = alloc.live.intervals + i;
+        if ((interval->name & 255) == 3) {
+            found++;
+            status |= interval->start != (OpenrtlLifetime) def;
+        }
+    }
+    openrtl_del_alloc(&alloc);
+    openrtl_del_buffer(&buf);
+    return status || found != 1;
+}
+
+// parameters passed on the stack keep their own lifetime in the table,
+// there are more of them than registers live
+static int openrtl_test_stack(void) {
+    OpenrtlBuffer buf;
+    openrtl_buffer(&buf);
+    buf.params = 3;
+    openrtl_iadd(&buf, OPENRTL_SIZE_64, 3, 1, 2);
+    openrtl_istore(&buf, OPENRTL_SIZE_64, 3, 1, 2);
+    openrtl_return(&buf);
+
+    OpenrtlRegalloc alloc;
+    openrtl_alloc_linscan(&alloc, 1, 0, NULL);
+    openrtl_alloc_find(&alloc, NULL, &buf);
+    struct OpenrtlRegisterTable table = {0};
+    int status = openrtl_alloc_allocate(&alloc) || openrtl_alloc_regtable(&table, &alloc) || alloc.stack.len != 3;
+    for (size_t i = 0; i < alloc.stack.len && !status; i++) {
+        const struct OpenrtlInterval *interval = alloc.stack.intervals + i;
+        const struct OpenrtlRegEntry *ent = table.entries + table.len - alloc.stack.len + i;
+        status = ent->key != interval->name || ent->start != interval->start || ent->end != interval->end;
+    }
+    openrtl_del_regtable(&table);
+    openrtl_del_alloc(&alloc);
+    openrtl_del_buffer(&buf);
+    return status;
+}
+
+int main(void) {
+    int failed = 0;
+    if (openrtl_test_files()) {
+        printf("regalloc: a register of another file joined a web\n");
+        failed = 1;
+    }
+    if (openrtl_test_stack()) {
+        printf("regalloc: a stack entry took the lifetime of a register\n");
+        failed = 1;
+    }
+    return failed;
+}
@@ -0,0 +1,36 @@
+#include <stdio.h>
+#include "../include/openrtl.h"
+
+// every register is live on return, writing x5 before it leaves r5
+// live and r7 is the only temporary the division may use
+static int openrtl_test_files(void) {
+    OpenrtlBuffer buf;
+    openrtl_buffer(&buf);
+    openrtl_imove_immediate(&buf, OPENRTL_SIZE_32, 2, 7);
+    openrtl_idivide_unsigned(&buf, OPENRTL_SIZE_32, 3, 1, 2);
+    openrtl_fadd(&buf, OPENRTL_FSIZE_64, 5, 1, 2);
+    openrtl_isubtract(&buf, OPENRTL_SIZE_64, 7, 1, 2);
+    openrtl_return(&buf);
+    int status = openrtl_reduce_strength(&buf);
+
+    int divides = 0;
+    int clobbered = 0;
+    OpenrtlIter it;
+    openrtl_iter(&it, &buf);
+    while (openrtl_iter_next(&it)) {
+        unsigned int opcode = it.inst.opcode;
+        divides += opcode == OPENRTL_OP_IDIVIDE_UNSIGNED;
+        clobbered |= opcode != OPENRTL_OP_FADD && it.inst.arith.dest == 5;
+    }
+    openrtl_del_buffer(&buf);
+    return status || divides || clobbered;
+}
+
+int main(void) {
+    int failed = 0;
+    if (openrtl_test_files()) {
+        printf("strength: a live register was used as a temporary\n");
+        failed = 1;
+    }
+    return failed;
+}
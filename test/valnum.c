@@ -0,0 +1,86 @@
+#include <stdio.h>
+#include "../include/openrtl.h"
+
+static int openrtl_test_count(OpenrtlBuffer *buf, unsigned int opcode) {
+    int n = 0;
+    OpenrtlIter it;
+    openrtl_iter(&it, buf);
+    while (openrtl_iter_next(&it)) {
+        n += it.inst.opcode == opcode;
+    }
+    return n;
+}
+
+// the block after the branch is only entered from the one before it, so
+// the sum computed there is still in r3
+static int openrtl_test_carried(void) {
+    OpenrtlBuffer buf;
+    openrtl_buffer(&buf);
+    openrtl_iadd(&buf, OPENRTL_SIZE_64, 3, 1, 2);
+    openrtl_isubtract(&buf, OPENRTL_SIZE_64, 8, 1, 2);
+    openrtl_symbol(&buf, OPENRTL_SYMBOL_LOCAL, "out");
+    openrtl_branch_equal(&buf, 0);
+    openrtl_iadd(&buf, OPENRTL_SIZE_64, 4, 1, 2);
+    openrtl_isubtract(&buf, OPENRTL_SIZE_64, 8, 5, 6);
+    openrtl_istore(&buf, OPENRTL_SIZE_64, 4, 5, 6);
+    openrtl_label(&buf, "out");
+    openrtl_return(&buf);
+    int status = openrtl_number_values(&buf) || openrtl_test_count(&buf, OPENRTL_OP_IADD) != 1
+        || openrtl_test_count(&buf, OPENRTL_OP_IMOVE_UNSIGNED) != 1;
+    openrtl_del_buffer(&buf);
+    return status;
+}
+
+// a load from where a value was just stored reads that value
+static int openrtl_test_forward(void) {
+    OpenrtlBuffer buf;
+    openrtl_buffer(&buf);
+    openrtl_istore(&buf, OPENRTL_SIZE_64, 3, 1, 2);
+    openrtl_iload(&buf, OPENRTL_SIZE_64, 4, 1, 2);
+    openrtl_istore(&buf, OPENRTL_SIZE_64, 4, 5, 6);
+    openrtl_return(&buf);
+    int status = openrtl_number_values(&buf) || openrtl_test_count(&buf, OPENRTL_OP_ILOAD) != 0
+        || openrtl_test_count(&buf, OPENRTL_OP_IMOVE_UNSIGNED) != 1;
+    openrtl_del_buffer(&buf);
+    return status;
+}
+
+// a store elsewhere or a call may change what a load read, so the load
+// after it is kept. `call` picks the call over the store
+static int openrtl_test_epoch(int call) {
+    OpenrtlBuffer buf;
+    openrtl_buffer(&buf);
+    openrtl_iload(&buf, OPENRTL_SIZE_64, 3, 1, 2);
+    if (call) {
+        openrtl_call(&buf, 0x1000);
+    } else {
+        openrtl_istore(&buf, OPENRTL_SIZE_64, 5, 6, 7);
+    }
+    openrtl_iload(&buf, OPENRTL_SIZE_64, 4, 1, 2);
+    openrtl_istore(&buf, OPENRTL_SIZE_64, 4, 5, 6);
+    openrtl_return(&buf);
+    int status = openrtl_number_values(&buf) || openrtl_test_count(&buf, OPENRTL_OP_ILOAD) != 2;
+    openrtl_del_buffer(&buf);
+    return status;
+}
+
+int main(void) {
+    int failed = 0;
+    if (openrtl_test_carried()) {
+        printf("valnum: a sum was not carried into the block only its own leads to\n");
+        failed = 1;
+    }
+    if (openrtl_test_forward()) {
+        printf("valnum: a load of what was just stored was kept\n");
+        failed = 1;
+    }
+    if (openrtl_test_epoch(0)) {
+        printf("valnum: a load was reused across a store\n");
+        failed = 1;
+    }
+    if (openrtl_test_epoch(1)) {
+        printf("valnum: a load was reused across a call\n");
+        failed = 1;
+    }
+    return failed;
+}
@@ -0,0 +1,472 @@
+#include <string.h>
+#include "include/openrtl.h"
+#include "internal.h"
+
+#define DEFAULT_VALUES_CAP 256
+#define VALUE_BUCKETS 1024
+
+enum {
+    // a register of a file that is not known, treated as any of them
+    OPENRTL_FILE_ANY = OPENRTL_FILE_V + 1,
+};
+
+// an expression that was computed into `holder`, `prev` chains the
+// entries of a bucket as an index plus one
+struct OpenrtlValue {
+    uint8_t opcode;
+    uint8_t size;
+    uint8_t aux;
+    uint8_t file;
+    uint8_t holder;
+    uint32_t a;
+    uint32_t b;
+    uint32_t epoch;
+    uint64_t imm;
+    uint32_t vn;
+    size_t prev;
+};
+
+// a value number a register held before it was overwritten
+struct OpenrtlValueUndo {
+    uint16_t slot;
+    uint32_t vn;
+};
+
+// value numbers of the registers of every file, zero when none was
+// given yet. entries and undos are stacks, so the state at the end of a
+// block is restored by popping them when the next block that follows
+// it alone is visited
+struct OpenrtlValues {
+    const OpenrtlAllocator *allocator;
+    uint32_t vn[3 * 256];
+    uint32_t next;
+    uint32_t epoch;
+    size_t buckets[VALUE_BUCKETS];
+    size_t cap;
+    size_t len;
+    struct OpenrtlValue *ptr;
+    size_t undo_cap;
+    size_t undo_len;
+    struct OpenrtlValueUndo *undo;
+};
+
+// a block of the tree of blocks that have a single predecessor, with
+// the state to restore once its successors were visited
+struct OpenrtlValueFrame {
+    size_t block;
+    size_t succ;
+    size_t len;
+    size_t undo;
+    uint32_t epoch;
+};
+
+static int openrtl_values_block(struct OpenrtlValues *vals, struct OpenrtlRewrite *rw, const OpenrtlCfg *cfg, size_t b, int *edited);
+static int openrtl_values_inst(struct OpenrtlValues *vals, struct OpenrtlRewrite *rw, size_t at, int *edited);
+static int openrtl_values_set(struct OpenrtlValues *vals, int file, uint8_t reg, uint32_t vn);
+static void openrtl_values_clear(struct OpenrtlValues *vals);
+static uint32_t openrtl_values_get(struct OpenrtlValues *vals, int file, uint8_t reg, int *status);
+static const struct OpenrtlValue *openrtl_values_find(const struct OpenrtlValues *vals, const struct OpenrtlValue *key);
+static int openrtl_values_insert(struct OpenrtlValues *vals, const struct OpenrtlValue *value);
+static void openrtl_values_pop(struct OpenrtlValues *vals, size_t len, size_t undo);
+static size_t openrtl_values_hash(const struct OpenrtlValue *key);
+
+// files of the register an instruction writes and of the two it reads,
+// for the instructions that are numbered
+static int openrtl_values_files(unsigned int opcode, int *dest, int *src) {
+    switch (opcode) {
+    case OPENRTL_OP_IADD:
+    case OPENRTL_OP_IAND:
+    case OPENRTL_OP_IOR:
+    case OPENRTL_OP_IXOR:
+    case OPENRTL_OP_ISUBTRACT:
+    case OPENRTL_OP_IMULTIPLY_UNSIGNED:
+    case OPENRTL_OP_IMULTIPLY_SIGNED:
+    case OPENRTL_OP_IDIVIDE_UNSIGNED:
+    case OPENRTL_OP_IDIVIDE_SIGNED:
+    case OPENRTL_OP_IMODULO_UNSIGNED:
+    case OPENRTL_OP_IMODULO_SIGNED:
+    case OPENRTL_OP_IMOVE_IMMEDIATE:
+    case OPENRTL_OP_IMOVE_UNSIGNED:
+    case OPENRTL_OP_IMOVE_SIGNED:
+    case OPENRTL_OP_ISHIFT:
+    case OPENRTL_OP_ISHIFT_VARIABLE:
+    case OPENRTL_OP_IBITS:
+    case OPENRTL_OP_ILOAD:
+        *dest = OPENRTL_FILE_GP;
+        *src = OPENRTL_FILE_GP;
+        return 1;
+    case OPENRTL_OP_F2I:
+        *dest = OPENRTL_FILE_GP;
+        *src = OPENRTL_FILE_FP;
+        return 1;
+    case OPENRTL_OP_FADD:
+    case OPENRTL_OP_FSUBTRACT:
+    case OPENRTL_OP_FMULTIPLY:
+    case OPENRTL_OP_FDIVIDE:
+        *dest = OPENRTL_FILE_FP;
+        *src = OPENRTL_FILE_FP;
+        return 1;
+    case OPENRTL_OP_FLOAD:
+    case OPENRTL_OP_I2F:
+        *dest = OPENRTL_FILE_FP;
+        *src = OPENRTL_FILE_GP;
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+static int openrtl_values_commutes(unsigned int opcode) {
+    switch (opcode) {
+    case OPENRTL_OP_IADD:
+    case OPENRTL_OP_IAND:
+    case OPENRTL_OP_IOR:
+    case OPENRTL_OP_IXOR:
+    case OPENRTL_OP_IMULTIPLY_UNSIGNED:
+    case OPENRTL_OP_IMULTIPLY_SIGNED:
+    case OPENRTL_OP_FADD:
+    case OPENRTL_OP_FMULTIPLY:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+// replaces arithmetic and loads that recompute a value a register still
+// holds with a move from that register. a load is redundant when no
+// store, push, pop or call came between it and the load or store of the
+// same base and offset. values are numbered within a block and carried
+// on into the blocks that only it leads to
+int openrtl_number_values(OpenrtlBuffer *buf) {
+    struct OpenrtlRewrite rw;
+    OpenrtlCfg cfg;
+    if (openrtl_rewrite(&rw, buf)) {
+        openrtl_del_rewrite(&rw);
+        return 1;
+    }
+    if (openrtl_cfg(&cfg, buf)) {
+        openrtl_del_cfg(&cfg);
+        openrtl_del_rewrite(&rw);
+        return 1;
+    }
+
+    struct OpenrtlValues *vals = openrtl_calloc(rw.allocator, 1, sizeof(struct OpenrtlValues));
+    uint8_t *entry = openrtl_rewrite_entries(&rw, buf);
+    uint8_t *seen = openrtl_calloc(rw.allocator, cfg.len ? cfg.len : 1, 1);
+    struct OpenrtlValueFrame *stack = openrtl_malloc(rw.allocator, (cfg.len ? cfg.len : 1) * sizeof(struct OpenrtlValueFrame));
+    int status = !vals || !entry || !seen || !stack;
+    if (!status) {
+        vals->allocator = rw.allocator;
+        vals->cap = DEFAULT_VALUES_CAP;
+        vals->ptr = openrtl_malloc(vals->allocator, vals->cap * sizeof(struct OpenrtlValue));
+        vals->undo_cap = DEFAULT_VALUES_CAP;
+        vals->undo = openrtl_malloc(vals->allocator, vals->undo_cap * sizeof(struct OpenrtlValueUndo));
+        status = !vals->ptr || !vals->undo;
+    }
+
+    // blocks are walked down the tree of those entered from a single
+    // predecessor, every other block starts with nothing known
+    int edited = 0;
+    for (size_t root = 0; root < cfg.len && !status; root++) {
+        const struct OpenrtlBlock *block = cfg.blocks + root;
+        if (block->npred == 1 && !entry[block->first] && cfg.preds[block->pred] != root) {
+            continue;
+        }
+        size_t top = 0;
+        stack[top++] = (struct OpenrtlValueFrame) { root, 0, 0, 0, 0 };
+        while (top && !status) {
+            struct OpenrtlValueFrame *frame = stack + top - 1;
+            const struct OpenrtlBlock *it = cfg.blocks + frame->block;
+            if (!seen[frame->block]) {
+                seen[frame->block] = 1;
+                if (top == 1) {
+                    openrtl_values_clear(vals);
+                }
+                status = openrtl_values_block(vals, &rw, &cfg, frame->block, &edited);
+                frame->len = vals->len;
+                frame->undo = vals->undo_len;
+                frame->epoch = vals->epoch;
+                continue;
+            }
+            if (frame->succ == it->nsucc) {
+                --top;
+                continue;
+            }
+            size_t succ = it->succ[frame->succ++];
+            const struct OpenrtlBlock *next = cfg.blocks + succ;
+            if (seen[succ] || next->npred != 1 || entry[next->first]) {
+                continue;
+            }
+            // back to the state at the end of the predecessor
+            openrtl_values_pop(vals, frame->len, frame->undo);
+            vals->epoch = frame->epoch;
+            stack[top++] = (struct OpenrtlValueFrame) { succ, 0, 0, 0, 0 };
+        }
+    }
+    // blocks that only follow one another in a cycle no root leads to
+    for (size_t b = 0; b < cfg.len && !status; b++) {
+        if (!seen[b]) {
+            seen[b] = 1;
+            openrtl_values_clear(vals);
+            status = openrtl_values_block(vals, &rw, &cfg, b, &edited);
+        }
+    }
+
+    if (vals) {
+        openrtl_free(rw.allocator, vals->ptr);
+        openrtl_free(rw.allocator, vals->undo);
+    }
+    openrtl_free(rw.allocator, vals);
+    openrtl_free(rw.allocator, entry);
+    openrtl_free(rw.allocator, seen);
+    openrtl_free(rw.allocator, stack);
+    openrtl_del_cfg(&cfg);
+    if (!status && edited) {
+        status = openrtl_rewrite_commit(&rw, buf);
+    }
+    openrtl_del_rewrite(&rw);
+    return status;
+}
+
+static int openrtl_values_block(struct OpenrtlValues *vals, struct OpenrtlRewrite *rw, const OpenrtlCfg *cfg, size_t b, int *edited) {
+    for (size_t at = cfg->blocks[b].first; at < cfg->blocks[b].last; at++) {
+        if (openrtl_values_inst(vals, rw, at, edited)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int openrtl_values_inst(struct OpenrtlValues *vals, struct OpenrtlRewrite *rw, size_t at, int *edited) {
+    struct OpenrtlRewriteInst *it = rw->ptr + at;
+    OpenrtlInst *inst = &it->inst;
+    unsigned int opcode = inst->opcode;
+    int status = 0;
+    switch (opcode) {
+    case OPENRTL_OP_CALL:
+    case OPENRTL_OP_CALL_INDIRECT:
+        // whatever is called may write any register and any memory
+        for (size_t slot = 0; slot < 3 * 256 && !status; slot++) {
+            if (vals->vn[slot]) {
+                status = openrtl_values_set(vals, slot >> 8, slot & 255, 0);
+            }
+        }
+        vals->epoch = ++vals->next;
+        return status;
+    case OPENRTL_OP_ISTORE:
+    case OPENRTL_OP_FSTORE: {
+        vals->epoch = ++vals->next;
+        // what was stored is what a load right after it would read
+        int file = opcode == OPENRTL_OP_ISTORE ? OPENRTL_FILE_GP : OPENRTL_FILE_FP;
+        struct OpenrtlValue value = {0};
+        value.opcode = opcode == OPENRTL_OP_ISTORE ? OPENRTL_OP_ILOAD : OPENRTL_OP_FLOAD;
+        value.size = inst->size;
+        value.file = file;
+        value.holder = inst->arith.dest;
+        value.a = openrtl_values_get(vals, OPENRTL_FILE_GP, inst->arith.src1, &status);
+        value.b = openrtl_values_get(vals, OPENRTL_FILE_GP, inst->arith.src2, &status);
+        value.epoch = vals->epoch;
+        value.vn = openrtl_values_get(vals, file, inst->arith.dest, &status);
+        return status || openrtl_values_insert(vals, &value);
+    }
+    case OPENRTL_OP_VSTORE:
+    case OPENRTL_OP_IPUSH:
+    case OPENRTL_OP_FPUSH:
+        vals->epoch = ++vals->next;
+        return 0;
+    case OPENRTL_OP_IPOP:
+    case OPENRTL_OP_FPOP:
+        vals->epoch = ++vals->next;
+        break;
+    case OPENRTL_OP_FMOVE:
+        return openrtl_values_set(vals, OPENRTL_FILE_FP, inst->arith.dest, openrtl_values_get(vals, OPENRTL_FILE_FP, inst->arith.src1, &status)) || status;
+    default:
+        break;
+    }
+
+    int dfile;
+    int sfile;
+    if (!openrtl_values_files(opcode, &dfile, &sfile) || (opcode == OPENRTL_OP_IMOVE_IMMEDIATE && it->symbol)) {
+        // anything else leaves a register whose value is not known
+        struct OpenrtlInstRegs regs;
+        openrtl_inst_regs(inst, &regs);
+        return regs.ndef ? openrtl_values_set(vals, OPENRTL_FILE_ANY, regs.def, 0) : 0;
+    }
+
+    struct OpenrtlValue key = {0};
+    key.opcode = opcode;
+    key.size = inst->size;
+    key.file = dfile;
+    switch (opcode) {
+    case OPENRTL_OP_IMOVE_IMMEDIATE:
+        key.imm = it->operand;
+        break;
+    case OPENRTL_OP_IMOVE_UNSIGNED:
+    case OPENRTL_OP_IMOVE_SIGNED:
+    case OPENRTL_OP_F2I:
+    case OPENRTL_OP_I2F:
+        key.a = openrtl_values_get(vals, sfile, inst->arith_b.src, &status);
+        key.aux = inst->arith_b.size;
+        if (opcode != OPENRTL_OP_F2I && opcode != OPENRTL_OP_I2F && key.size == OPENRTL_ISIZE_64 && key.aux == OPENRTL_ISIZE_64) {
+            // a full copy
+            return status || openrtl_values_set(vals, dfile, inst->arith_b.dest, key.a);
+        }
+        break;
+    case OPENRTL_OP_ISHIFT:
+    case OPENRTL_OP_IBITS:
+        key.a = openrtl_values_get(vals, sfile, inst->arith.src1, &status);
+        key.aux = inst->arith.src2;
+        break;
+    case OPENRTL_OP_ISHIFT_VARIABLE:
+        key.a = openrtl_values_get(vals, sfile, inst->arith.dest, &status);
+        key.b = openrtl_values_get(vals, sfile, inst->arith.src1, &status);
+        key.aux = inst->arith.src2;
+        break;
+    case OPENRTL_OP_ILOAD:
+    case OPENRTL_OP_FLOAD:
+        key.epoch = vals->epoch;
+        // fallthrough
+    default:
+        key.a = openrtl_values_get(vals, sfile, inst->arith.src1, &status);
+        key.b = openrtl_values_get(vals, sfile, inst->arith.src2, &status);
+        if (openrtl_values_commutes(opcode) && key.a > key.b) {
+            uint32_t a = key.a;
+            key.a = key.b;
+            key.b = a;
+        }
+        break;
+    }
+    if (status) {
+        return 1;
+    }
+
+    uint8_t dest = inst->arith.dest;
+    const struct OpenrtlValue *found = openrtl_values_find(vals, &key);
+    if (!found) {
+        key.vn = ++vals->next;
+        key.holder = dest;
+        return openrtl_values_set(vals, dfile, dest, key.vn) || openrtl_values_insert(vals, &key);
+    }
+
+    key.vn = found->vn;
+    key.holder = dest;
+    uint8_t holder = found->holder;
+    if (!it->symbol && !(openrtl_sets_flags(opcode) && openrtl_rewrite_flags(rw, at))) {
+        OpenrtlInst move = {0};
+        move.size = inst->size;
+        if (dfile == OPENRTL_FILE_GP) {
+            move.opcode = OPENRTL_OP_IMOVE_UNSIGNED;
+            move.arith_b.dest = dest;
+            move.arith_b.src = holder;
+            move.arith_b.size = inst->size;
+        } else {
+            move.opcode = OPENRTL_OP_FMOVE;
+            move.arith.dest = dest;
+            move.arith.src1 = holder;
+        }
+        *inst = move;
+        it->operand = 0;
+        it->dead = dest == holder;
+        *edited = 1;
+    }
+    // `dest` holds the value as well, for when `holder` is overwritten
+    return openrtl_values_set(vals, dfile, dest, key.vn) || (dest != holder && openrtl_values_insert(vals, &key));
+}
+
+// gives `reg` of `file` the value number `vn`, remembering the one it
+// had. a register of any file is changed in all of them
+static int openrtl_values_set(struct OpenrtlValues *vals, int file, uint8_t reg, uint32_t vn) {
+    if (file == OPENRTL_FILE_ANY) {
+        for (file = 0; file < OPENRTL_FILE_ANY; file++) {
+            if (openrtl_values_set(vals, file, reg, vn)) {
+                return 1;
+            }
+        }
+        return 0;
+    }
+    size_t slot = (size_t) file * 256 + reg;
+    if (vals->vn[slot] == vn) {
+        return 0;
+    }
+    if (vals->undo_len == vals->undo_cap) {
+        size_t cap = 2 * vals->undo_cap;
+        void *ptr = openrtl_realloc(vals->allocator, vals->undo, vals->undo_cap * sizeof(struct OpenrtlValueUndo), cap * sizeof(struct OpenrtlValueUndo));
+        if (!ptr) {
+            return 1;
+        }
+        vals->undo = ptr;
+        vals->undo_cap = cap;
+    }
+    vals->undo[vals->undo_len++] = (struct OpenrtlValueUndo) { (uint16_t) slot, vals->vn[slot] };
+    vals->vn[slot] = vn;
+    return 0;
+}
+
+// forgets everything, for a block that may be entered with any values
+static void openrtl_values_clear(struct OpenrtlValues *vals) {
+    openrtl_values_pop(vals, 0, 0);
+    vals->epoch = ++vals->next;
+}
+
+// value number of `reg`, a register that has none yet gets a new one
+static uint32_t openrtl_values_get(struct OpenrtlValues *vals, int file, uint8_t reg, int *status) {
+    size_t slot = (size_t) file * 256 + reg;
+    if (!vals->vn[slot] && openrtl_values_set(vals, file, reg, ++vals->next)) {
+        *status = 1;
+    }
+    return vals->vn[slot];
+}
+
+// latest entry for the expression of `key` whose holder still has it
+static const struct OpenrtlValue *openrtl_values_find(const struct OpenrtlValues *vals, const struct OpenrtlValue *key) {
+    size_t at = vals->buckets[openrtl_values_hash(key)];
+    while (at) {
+        const struct OpenrtlValue *it = vals->ptr + at - 1;
+        if (it->opcode == key->opcode && it->size == key->size && it->aux == key->aux && it->file == key->file
+            && it->a == key->a && it->b == key->b && it->epoch == key->epoch && it->imm == key->imm
+            && vals->vn[(size_t) it->file * 256 + it->holder] == it->vn) {
+            return it;
+        }
+        at = it->prev;
+    }
+    return NULL;
+}
+
+static int openrtl_values_insert(struct OpenrtlValues *vals, const struct OpenrtlValue *value) {
+    if (vals->len == vals->cap) {
+        size_t cap = 2 * vals->cap;
+        void *ptr = openrtl_realloc(vals->allocator, vals->ptr, vals->cap * sizeof(struct OpenrtlValue), cap * sizeof(struct OpenrtlValue));
+        if (!ptr) {
+            return 1;
+        }
+        vals->ptr = ptr;
+        vals->cap = cap;
+    }
+    size_t *bucket = vals->buckets + openrtl_values_hash(value);
+    struct OpenrtlValue *it = vals->ptr + vals->len++;
+    *it = *value;
+    it->prev = *bucket;
+    *bucket = vals->len;
+    return 0;
+}
+
+// drops the entries and undoes the value numbers given after `len` and
+// `undo` were reached
+static void openrtl_values_pop(struct OpenrtlValues *vals, size_t len, size_t undo) {
+    while (vals->len > len) {
+        const struct OpenrtlValue *it = vals->ptr + --vals->len;
+        vals->buckets[openrtl_values_hash(it)] = it->prev;
+    }
+    while (vals->undo_len > undo) {
+        const struct OpenrtlValueUndo *it = vals->undo + --vals->undo_len;
+        vals->vn[it->slot] = it->vn;
+    }
+}
+
+static size_t openrtl_values_hash(const struct OpenrtlValue *key) {
+    uint64_t hash = key->opcode | (uint64_t) key->size << 8 | (uint64_t) key->aux << 16 | (uint64_t) key->file << 24;
+    hash = (hash ^ key->a) * 0x9e3779b97f4a7c15;
+    hash = (hash ^ key->b ^ (uint64_t) key->epoch << 32) * 0x9e3779b97f4a7c15;
+    hash = (hash ^ key->imm) * 0x9e3779b97f4a7c15;
+    return (hash >> 40) & (VALUE_BUCKETS - 1);
+}